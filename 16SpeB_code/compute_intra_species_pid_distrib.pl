@@ -53,6 +53,9 @@ OPTIONS:
 --exact=<INT>        Threshold of using exact method before random sampling
 --randseed=<INT>     Random seed
 --genus=<STRING>     Genus-of-interest
+--cache=<FILE>       Alignment cache shared by reruns (palign -cache)
+--scoring=<NAME>     Scoring preset, blastn (default) or matlab (palign -scoring)
+--threads=<INT>      Aligning threads shared by all species (palign -threads)
 
 PID extraction (choose one):
 --aggregate          aggregate all the PIDs
@@ -74,6 +77,9 @@ USAGE
 	my $rnd_iters = undef;
 	my $fsadir = undef;
 	my $is_aggregate = undef;
+	my $cache_fname = undef;
+	my $scoring = undef;
+	my $threads = undef;
 	foreach my $a (@ARGV) {
 		if( $a =~ /^--randseed=(\d+)/) {
 			$user_randseed = $1;
@@ -93,6 +99,15 @@ USAGE
 		elsif( $a =~ /^--aggregate/) {
 			$is_aggregate = 1;
 		}
+		elsif( $a =~ /^--cache=(\S+)/) {
+			$cache_fname = $1;
+		}
+		elsif( $a =~ /^--scoring=(\w+)/) {
+			$scoring = $1;
+		}
+		elsif( $a =~ /^--threads=(\d+)/) {
+			$threads = $1;
+		}
 		else {
 			die "Unrecognized parameter: $a\n";
 		}
@@ -125,51 +140,61 @@ USAGE
 	}
 	closedir($dh);
 
+	#one palign process aligns every species, its PIDs written to ${genus}_<species>.tsv
+	my @species_fsa = ();
+	foreach my $f (sort @fsalst) {
+		if($f =~ /^${genus}_(\w+)\.fsa/) {
+			push(@species_fsa, $f);
+		}
+		else {
+			die "Invalid FASTA file found: $f\n";
+		}
+	}
+	my $list_fh = File::Temp->new(DIR => $TMP_DIR, SUFFIX => '.lst');
+	print $list_fh join("\n", map { "$fsadir/$_" } @species_fsa) . "\n";
+	close($list_fh);
+
+	my $mode_opt = (defined($rnd_iters) ? "-rand-pair $rnd_iters -rand-above $numseqs_before_rnd" : "-all-pair");
+	my $cache_opt = (defined($cache_fname) ? "-cache $cache_fname" : "");
+	my $scoring_opt = (defined($scoring) ? "-scoring $scoring" : "");
+	my $threads_opt = (defined($threads) ? "-threads $threads" : "");
+	my $batch_log = sprintf("%s/%s_batch.log", $fsadir, $genus);
+	my $cmd = "$ALIGN_EXE -batch $list_fh $mode_opt -s $RAND_SEED -out-format tsv $cache_opt $scoring_opt $threads_opt 1>$batch_log 2>&1";
+	print STDERR "$cmd\n\n";
+	system("$cmd") == 0 or die "palign failed, see $batch_log\n";
+
 	my $count = 0;
-	my %pids_hash= ();
+	my %summary_hash= ();
 	my %numseqs_hash = ();
 	my @aggregate_pids = ();
-	foreach my $f (@fsalst) {
+	foreach my $f (@species_fsa) {
 		if($f =~ /^${genus}_(\w+)\.fsa/) {
 			my $species = $1;
-			my $mode = undef;
 			my $fsa = parseFa("$fsadir/$f");
 			my $numseqs = scalar(@$fsa);
-			if($numseqs > $numseqs_before_rnd) {
-				$mode = "-rand-pair $rnd_iters";
-				print STDERR "WARNING: using --rand-pair mode\n";
-			}
-			else {
-				$mode = "-all-pair";
+			if(defined($rnd_iters) && $numseqs > $numseqs_before_rnd) {
+				print STDERR "WARNING: using --rand-pair mode for $species\n";
 			}
-			my $outfname = sprintf("%s_%s.txt", $genus, $species);
-			my $cmd = "$ALIGN_EXE $fsadir/$f $mode -s $RAND_SEED -quiet 1>$fsadir/$outfname 2>&1";
-			print STDERR "$cmd\n\n";
-			system("$cmd");
+			my $recfname = sprintf("%s_%s.tsv", $genus, $species);
 
 			#pid list
 			my $pid_over_alignlen_fn = sprintf("%s_%s_pid_over_alignlen.txt", $genus, $species);
-			$cmd = "grep 'PID over align' $fsadir/$outfname | awk {'print \$4'} > $fsadir/$pid_over_alignlen_fn";
-			print STDERR "$cmd\n\n";
-			system($cmd);
-
-			#parse pid file
-			my $sorted = extract_and_sort_pids("$fsadir/$pid_over_alignlen_fn");
-
-			push(@aggregate_pids, @$sorted);
+			write_pid_column("$fsadir/$recfname", "pid_over_alignlen", "$fsadir/$pid_over_alignlen_fn");
 			$numseqs_hash{$species} = $numseqs;
 
-			if(!$is_aggregate) {
-				#minimum
-				$pids_hash{$species} = $sorted;
+			if($is_aggregate) {
+				#parse pid file
+				my $sorted = extract_and_sort_pids("$fsadir/$pid_over_alignlen_fn");
+				push(@aggregate_pids, @$sorted);
+			}
+			else {
+				#quantiles palign kept as it aligned
+				$summary_hash{$species} = read_pid_summary(sprintf("%s/%s_%s.txt", $fsadir, $genus, $species));
 			}
 
 			#count
 			$count++;
 		}
-		else {
-			die "Invalid FASTA file found: $f\n";
-		}
 	}
 
 
@@ -181,13 +206,8 @@ USAGE
 
 	my %minpid_hash = ();
 	print STDERR "PIDs (min, 5%-quantile, median, 95%-quantile, max):\n";
-	foreach my $species (sort keys %pids_hash){
-		my $sorted = $pids_hash{$species};
-		my $minpid = min(@$sorted);
-		my $quantile05 = compute_empirical_quantile($sorted, 0.05);
-		my $quantile95 = compute_empirical_quantile($sorted, 0.95);
-		my $median = compute_empirical_quantile($sorted, 0.50);
-		my $maxpid = max(@$sorted);
+	foreach my $species (sort keys %summary_hash){
+		my ($minpid, $quantile05, $median, $quantile95, $maxpid, $numpairs) = @{$summary_hash{$species}};
 		$minpid_hash{$species} = $minpid;
 		printf STDERR (
 			"(%.5lf, %.5lf, %.5lf, %.5lf, %.5lf)  $genus $species with %d sequences (%d pairs)\n",
@@ -197,7 +217,7 @@ USAGE
 			$quantile95,
 			$maxpid,
             $numseqs_hash{$species},
-			scalar(@$sorted),
+			$numpairs,
 		);
 
 	}
@@ -214,6 +234,44 @@ USAGE
 
 }
 
+#copies one column of a palign -out-format tsv file, one value per line
+sub write_pid_column
+{
+	my ($tsv_fname, $column, $out_fname) = @_;
+
+	open(IN, "<$tsv_fname") or die "Cannot open $tsv_fname for read: $!";
+	open(OUT, ">$out_fname") or die "Cannot open $out_fname for write: $!";
+	my $names = <IN>;
+	chomp($names);
+	my @names = split(/\t/, $names);
+	my ($index) = grep { $names[$_] eq $column } 0..$#names;
+	die "No $column column in $tsv_fname\n" if(!defined($index));
+	while(my $ln = <IN>) {
+		chomp($ln);
+		my @fields = split(/\t/, $ln);
+		print OUT $fields[$index] . "\n";
+	}
+	close(OUT);
+	close(IN);
+}
+
+#the PID summary line of a palign -batch output: [min, 5%, median, 95%, max, pairs]
+sub read_pid_summary
+{
+	my ($fname) = @_;
+
+	open(IN, "<$fname") or die "Cannot open $fname for read: $!";
+	my @summary = ();
+	while(my $ln = <IN>) {
+		if($ln =~ /^PID summary over alignment-length \(min, 5%, median, 95%, max\): \(([^)]*)\) of (\d+) pairs/) {
+			@summary = (split(/,\s*/, $1), $2);
+		}
+	}
+	close(IN);
+	die "No PID summary in $fname\n" if(scalar(@summary) != 6);
+	return \@summary;
+}
+
 sub extract_and_sort_pids
 {
 	my ($fname) = @_;
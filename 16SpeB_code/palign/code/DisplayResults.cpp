@@ -1,4 +1,5 @@
 #include "DisplayResults.h"
+#include "textout.h"
 
 using namespace std;
 
@@ -13,15 +14,10 @@ Results::~Results() {
 }
 
 void Results::displaySeq(ostream &out, int *seq, int len) {
-	for(int i = 0; i < len; i++ ) {
-		if(seq[i] == GAP_CHAR) {
-			out << '-';
-		}
-		else {
-			out << numToChar(seq[i]);
-		}
-	}
-	out << endl;
+	//reused by every call on the thread
+	static thread_local TextBuffer line = {NULL, 0, 0};
+	appendSeq(&line, seq, len);
+	writeTextBuffer(&line, out);
 }
 
 
@@ -0,0 +1,403 @@
+#include "aligncache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char ALIGN_CACHE_MAGIC[8] = {'P','A','L','N','C','A','C','H'};
+static const unsigned int ALIGN_RECORD_MAGIC = 0x52434150; //"PACR"
+
+typedef struct {
+	char magic[8];
+	int version;
+	int reserved;
+} AlignCacheHeader;
+
+//fixed part of a record, followed by nruns column runs
+typedef struct {
+	unsigned int magic;
+	unsigned int params;
+	unsigned long long hash1;
+	unsigned long long hash2;
+	int len1;
+	int len2;
+	int score;
+	int alignlen;
+	int identities;
+	int nongap;
+	int nruns;
+	unsigned int checksum; //FNV-1a of the record with this field 0, runs included
+} AlignCacheRecord;
+
+static
+unsigned int _fnv32(unsigned int hash, const void *data, long len) {
+	const unsigned char *bytes = (const unsigned char*) data;
+	for(long k = 0; k < len; k++) {
+		hash = (hash ^ bytes[k]) * 16777619u;
+	}
+	return hash;
+}
+
+static
+unsigned int _record_checksum(const AlignCacheRecord *rec, const unsigned int *runs) {
+	AlignCacheRecord copy = *rec;
+	copy.checksum = 0;
+	unsigned int hash = _fnv32(2166136261u, &copy, sizeof(copy));
+	return _fnv32(hash, runs, sizeof(unsigned int) * (long) rec->nruns);
+}
+
+//length of the valid record at offset, 0 if it is cut short or corrupt
+static
+long _record_length(const char *map, long mapLen, long offset) {
+	if(offset + (long) sizeof(AlignCacheRecord) > mapLen) {
+		return 0;
+	}
+	AlignCacheRecord rec;
+	memcpy(&rec, map + offset, sizeof(rec));
+	if(rec.magic != ALIGN_RECORD_MAGIC || rec.nruns < 0
+			|| rec.nruns > (mapLen - offset - (long) sizeof(rec)) / (long) sizeof(unsigned int)) {
+		return 0;
+	}
+	const unsigned int *runs = (const unsigned int*) (map + offset + sizeof(rec));
+	if(_record_checksum(&rec, runs) != rec.checksum) {
+		return 0;
+	}
+	return sizeof(rec) + sizeof(unsigned int) * (long) rec.nruns;
+}
+
+static
+unsigned long long _key_hash(const AlignCacheKey *key) {
+	unsigned long long hash = key->hash1 * 0x9E3779B97F4A7C15ULL;
+	hash ^= key->hash2 + 0x632BE59BD9B4E019ULL + (hash << 6) + (hash >> 2);
+	hash ^= ((unsigned long long) key->params << 32) ^ (unsigned int) key->len1;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	return hash ^ (hash >> 33);
+}
+
+static
+bool _same_key(const AlignCacheRecord *rec, const AlignCacheKey *key) {
+	return (rec->hash1 == key->hash1 && rec->hash2 == key->hash2 && rec->len1 == key->len1
+			&& rec->len2 == key->len2 && rec->params == key->params);
+}
+
+static
+void _die(const char *what, const char *filename) {
+	fprintf(stderr, "Error: %s alignment cache %s: %s\n", what, filename, strerror(errno));
+	exit(1);
+}
+
+AlignCache* openAlignCache(const char *filename) {
+	AlignCache *cache = (AlignCache*) malloc(sizeof(AlignCache));
+	cache->fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if(cache->fd < 0) {
+		_die("cannot open", filename);
+	}
+
+	//a writer holds the lock for its whole record, so under the lock any
+	//invalid tail is left over from a crash and can be cut
+	if(flock(cache->fd, LOCK_EX) != 0) {
+		_die("cannot lock", filename);
+	}
+	struct stat st;
+	if(fstat(cache->fd, &st) != 0) {
+		_die("cannot stat", filename);
+	}
+	long size = st.st_size;
+	if(size < (long) sizeof(AlignCacheHeader)) {
+		AlignCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, ALIGN_CACHE_MAGIC, sizeof(header.magic));
+		header.version = ALIGN_CACHE_VERSION;
+		if(ftruncate(cache->fd, 0) != 0 || pwrite(cache->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+			_die("cannot initialize", filename);
+		}
+		size = sizeof(header);
+	}
+
+	cache->map = (char*) mmap(NULL, size, PROT_READ, MAP_SHARED, cache->fd, 0);
+	if(cache->map == MAP_FAILED) {
+		_die("cannot map", filename);
+	}
+	AlignCacheHeader header;
+	memcpy(&header, cache->map, sizeof(header));
+	if(memcmp(header.magic, ALIGN_CACHE_MAGIC, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "Error: %s is not an alignment cache\n", filename);
+		exit(1);
+	}
+
+	long offset = sizeof(header);
+	long records = 0;
+	if(header.version == ALIGN_CACHE_VERSION) {
+		for(long len; (len = _record_length(cache->map, size, offset)) > 0; offset += len) {
+			records++;
+		}
+	}
+	else {
+		//results of other kernel versions cannot be trusted: start over
+		offset = sizeof(header);
+		header.version = ALIGN_CACHE_VERSION;
+		if(pwrite(cache->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+			_die("cannot initialize", filename);
+		}
+	}
+	if(offset < size) {
+		if(ftruncate(cache->fd, offset) != 0) {
+			_die("cannot truncate", filename);
+		}
+	}
+	flock(cache->fd, LOCK_UN);
+	cache->mapLen = offset;
+	cache->mappedBytes = size;
+
+	//open addressing, at most half full
+	cache->numSlots = 16;
+	while(cache->numSlots < 2 * records) {
+		cache->numSlots *= 2;
+	}
+	cache->slots = (long*) malloc(sizeof(long) * cache->numSlots);
+	if(cache->slots == NULL) {
+		fprintf(stderr, "Out of memory at openAlignCache()\n");
+		abort();
+	}
+	for(long k = 0; k < cache->numSlots; k++) {
+		cache->slots[k] = -1;
+	}
+	for(offset = sizeof(header); offset < cache->mapLen; ) {
+		AlignCacheRecord rec;
+		memcpy(&rec, cache->map + offset, sizeof(rec));
+		AlignCacheKey key = {rec.hash1, rec.hash2, rec.len1, rec.len2, rec.params};
+		long slot = (long) (_key_hash(&key) & (cache->numSlots - 1));
+		while(cache->slots[slot] >= 0) {
+			slot = (slot + 1) & (cache->numSlots - 1);
+		}
+		cache->slots[slot] = offset;
+		offset += sizeof(rec) + sizeof(unsigned int) * (long) rec.nruns;
+	}
+
+	cache->records = records;
+	cache->appended = 0;
+	cache->tailEnd = cache->mapLen;
+	cache->tailKeys = NULL;
+	cache->tailState = NULL;
+	cache->numTailSlots = 0;
+	cache->tailRecords = 0;
+	cache->buffer = NULL;
+	cache->buffer_capacity = 0;
+	return cache;
+}
+
+void closeAlignCache(AlignCache *cache) {
+	munmap(cache->map, cache->mappedBytes);
+	close(cache->fd);
+	free(cache->slots);
+	free(cache->tailKeys);
+	free(cache->tailState);
+	free(cache->buffer);
+	free(cache);
+}
+
+unsigned long long alignCacheSeqHash(int *seq, int len) {
+	//FNV-1a over the length and the residues
+	unsigned long long hash = 14695981039346656037ULL;
+	hash = (hash ^ (unsigned long long) len) * 1099511628211ULL;
+	for(int j = 0; j < len; j++) {
+		hash = (hash ^ (unsigned long long) seq[j]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+unsigned int alignCacheParams(int match, int mismatch, int gapopen, int gapext, unsigned int kernelTag) {
+	int values[6] = {match, mismatch, gapopen, gapext, (int) kernelTag, ALIGN_CACHE_VERSION};
+	return _fnv32(2166136261u, values, sizeof(values));
+}
+
+bool lookupAlignCache(AlignCache *cache, const AlignCacheKey *key, bool needAlignment, AlignCacheEntry *entry) {
+	long slot = (long) (_key_hash(key) & (cache->numSlots - 1));
+	for(; cache->slots[slot] >= 0; slot = (slot + 1) & (cache->numSlots - 1)) {
+		const char *at = cache->map + cache->slots[slot];
+		AlignCacheRecord rec;
+		memcpy(&rec, at, sizeof(rec));
+		if(_same_key(&rec, key) && (rec.nruns > 0 || !needAlignment)) {
+			entry->counts.score = rec.score;
+			entry->counts.alignlen = rec.alignlen;
+			entry->counts.identities = rec.identities;
+			entry->counts.nongap = rec.nongap;
+			entry->nruns = rec.nruns;
+			entry->runs = (const unsigned int*) (at + sizeof(rec));
+			return true;
+		}
+	}
+	return false;
+}
+
+static
+bool _same_cache_key(const AlignCacheKey *a, const AlignCacheKey *b) {
+	return (a->hash1 == b->hash1 && a->hash2 == b->hash2 && a->len1 == b->len1
+			&& a->len2 == b->len2 && a->params == b->params);
+}
+
+//slot of key among the records after map, or the empty slot it would take
+static
+long _tail_slot(const AlignCache *cache, const AlignCacheKey *key) {
+	long slot = (long) (_key_hash(key) & (cache->numTailSlots - 1));
+	while(cache->tailState[slot] != 0 && !_same_cache_key(&cache->tailKeys[slot], key)) {
+		slot = (slot + 1) & (cache->numTailSlots - 1);
+	}
+	return slot;
+}
+
+static
+void _add_tail_key(AlignCache *cache, const AlignCacheKey *key, bool withAlignment) {
+	//at most half full
+	if(2 * (cache->tailRecords + 1) > cache->numTailSlots) {
+		AlignCacheKey *keys = cache->tailKeys;
+		signed char *state = cache->tailState;
+		long numSlots = cache->numTailSlots;
+		cache->numTailSlots = (numSlots > 0 ? 2 * numSlots : 16);
+		cache->tailKeys = (AlignCacheKey*) malloc(sizeof(AlignCacheKey) * cache->numTailSlots);
+		cache->tailState = (signed char*) calloc(cache->numTailSlots, sizeof(signed char));
+		if(cache->tailKeys == NULL || cache->tailState == NULL) {
+			fprintf(stderr, "Out of memory at appendAlignCache()\n");
+			abort();
+		}
+		for(long k = 0; k < numSlots; k++) {
+			if(state[k] != 0) {
+				long slot = _tail_slot(cache, &keys[k]);
+				cache->tailKeys[slot] = keys[k];
+				cache->tailState[slot] = state[k];
+			}
+		}
+		free(keys);
+		free(state);
+	}
+	long slot = _tail_slot(cache, key);
+	if(cache->tailState[slot] == 0) {
+		cache->tailKeys[slot] = *key;
+		cache->tailRecords++;
+	}
+	if(cache->tailState[slot] < (withAlignment ? 2 : 1)) {
+		cache->tailState[slot] = (withAlignment ? 2 : 1);
+	}
+}
+
+//with the lock held: indexes the records appended after tailEnd, by this
+//run or others
+static
+void _index_tail(AlignCache *cache) {
+	struct stat st;
+	if(fstat(cache->fd, &st) != 0) {
+		perror("Error: cannot stat alignment cache");
+		exit(1);
+	}
+	long len = st.st_size - cache->tailEnd;
+	if(len <= 0) {
+		return;
+	}
+	char *tail = (char*) malloc(len);
+	if(tail == NULL) {
+		fprintf(stderr, "Out of memory at appendAlignCache()\n");
+		abort();
+	}
+	if(pread(cache->fd, tail, len, cache->tailEnd) != (ssize_t) len) {
+		perror("Error: cannot read alignment cache");
+		exit(1);
+	}
+	//a record cut short by a crash ends what can be read; the next open cuts it
+	long offset = 0;
+	for(long recLen; (recLen = _record_length(tail, len, offset)) > 0; offset += recLen) {
+		AlignCacheRecord rec;
+		memcpy(&rec, tail + offset, sizeof(rec));
+		AlignCacheKey key = {rec.hash1, rec.hash2, rec.len1, rec.len2, rec.params};
+		_add_tail_key(cache, &key, rec.nruns > 0);
+	}
+	cache->tailEnd += offset;
+	free(tail);
+}
+
+//with the lock held: whether the file has the result of key, with its
+//alignment if withAlignment
+static
+bool _has_record(AlignCache *cache, const AlignCacheKey *key, bool withAlignment) {
+	AlignCacheEntry entry;
+	if(lookupAlignCache(cache, key, withAlignment, &entry)) {
+		return true;
+	}
+	_index_tail(cache);
+	return (cache->numTailSlots > 0 && cache->tailState[_tail_slot(cache, key)] >= (withAlignment ? 2 : 1));
+}
+
+void appendAlignCache(AlignCache *cache, const AlignCacheKey *key, const NWPairCounts *counts, AlignPair *pair) {
+	AlignCacheRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = ALIGN_RECORD_MAGIC;
+	rec.params = key->params;
+	rec.hash1 = key->hash1;
+	rec.hash2 = key->hash2;
+	rec.len1 = key->len1;
+	rec.len2 = key->len2;
+	rec.score = counts->score;
+	rec.alignlen = counts->alignlen;
+	rec.identities = counts->identities;
+	rec.nongap = counts->nongap;
+
+	//record and runs go out in one write(), so they need one buffer
+	long bytes = sizeof(rec) + sizeof(unsigned int) * (long) (pair != NULL ? pair->len : 0);
+	if(bytes > cache->buffer_capacity) {
+		free(cache->buffer);
+		cache->buffer = (char*) malloc(bytes);
+		cache->buffer_capacity = bytes;
+		if(cache->buffer == NULL) {
+			fprintf(stderr, "Out of memory at appendAlignCache()\n");
+			abort();
+		}
+	}
+	unsigned int *runs = (unsigned int*) (cache->buffer + sizeof(rec));
+
+	for(int k = 0; pair != NULL && k < pair->len; k++) {
+		int c1 = pair->align1[k];
+		int c2 = pair->align2[k];
+		unsigned int type = (c2 == GAP_CHAR ? ALIGN_RUN_GAP2 : (c1 == GAP_CHAR ? ALIGN_RUN_GAP1 : ALIGN_RUN_PAIRED));
+		if(rec.nruns > 0 && (runs[rec.nruns-1] & 3) == type) {
+			runs[rec.nruns-1] += 4;
+		}
+		else {
+			runs[rec.nruns++] = 4 | type;
+		}
+	}
+	rec.checksum = _record_checksum(&rec, runs);
+	memcpy(cache->buffer, &rec, sizeof(rec));
+	bytes = sizeof(rec) + sizeof(unsigned int) * (long) rec.nruns;
+
+	if(flock(cache->fd, LOCK_EX) != 0) {
+		perror("Error: cannot lock alignment cache");
+		exit(1);
+	}
+	//another run, or an earlier pair of the same content, may have stored it
+	if(_has_record(cache, key, rec.nruns > 0)) {
+		flock(cache->fd, LOCK_UN);
+		return;
+	}
+	if(lseek(cache->fd, 0, SEEK_END) < 0 || write(cache->fd, cache->buffer, bytes) != (ssize_t) bytes) {
+		perror("Error: cannot append to alignment cache");
+		exit(1);
+	}
+	_index_tail(cache);
+	flock(cache->fd, LOCK_UN);
+	cache->appended++;
+}
+
+void alignCacheRestore(const AlignCacheEntry *entry, int *seq1, int *seq2, AlignPair *pair) {
+	int i = 0, j = 0, k = 0;
+	for(int r = 0; r < entry->nruns; r++) {
+		unsigned int type = entry->runs[r] & 3;
+		for(unsigned int n = entry->runs[r] >> 2; n > 0; n--, k++) {
+			pair->align1[k] = (type == ALIGN_RUN_GAP1 ? GAP_CHAR : seq1[i++]);
+			pair->align2[k] = (type == ALIGN_RUN_GAP2 ? GAP_CHAR : seq2[j++]);
+		}
+	}
+	pair->len = k;
+	pair->score = entry->counts.score;
+}
@@ -0,0 +1,76 @@
+#ifndef _ALIGNCACHE_H
+#define _ALIGNCACHE_H
+
+#include "stdinc.h"
+#include "nwalign.h"
+
+//On-disk cache of pairwise alignment results, keyed by the content of the
+//two sequences, the scoring and the kernel, so reruns over unchanged FASTA
+//files read PIDs back instead of aligning.
+//
+//The file is a header followed by append-only records, each a fixed part
+//and optionally the alignment as column runs.  It is memory-mapped when
+//opened and indexed by an in-memory hash table; records are appended under
+//an exclusive flock() in a single write(), so parallel runs can share one
+//file.  Under that lock the records other runs appended since are indexed
+//too, and a result already in the file is not appended again.  A record
+//cut short by a crash fails its checksum and is dropped (with whatever
+//follows it) by the next run that opens the file.
+
+//bumped whenever a kernel change could alter a stored result
+#define ALIGN_CACHE_VERSION 1
+
+typedef struct {
+	unsigned long long hash1; //alignCacheSeqHash() of each sequence
+	unsigned long long hash2;
+	int len1;
+	int len2;
+	unsigned int params; //alignCacheParams() of the run
+} AlignCacheKey;
+
+//column runs of a stored alignment: (length << 2) | ALIGN_RUN_*
+enum AlignRunType { ALIGN_RUN_PAIRED, ALIGN_RUN_GAP2, ALIGN_RUN_GAP1};
+
+typedef struct {
+	NWPairCounts counts;
+	int nruns; //0 if the alignment was not stored
+	const unsigned int *runs; //points into the cache
+} AlignCacheEntry;
+
+typedef struct {
+	int fd;
+	char *map; //the file as it was when opened
+	long mapLen; //the valid records end here
+	long mappedBytes; //passed to mmap(), more than mapLen if a torn tail was cut
+	long *slots; //offsets of records in map, -1 for empty slots
+	long numSlots; //power of two
+	long records; //valid records when opened
+	long appended;
+	long tailEnd; //end of the records indexed so far, in map or after it
+	AlignCacheKey *tailKeys; //records after map, open addressing like slots
+	signed char *tailState; //0 empty slot, 1 counts only, 2 with the alignment
+	long numTailSlots;
+	long tailRecords;
+	char *buffer; //record being appended
+	long buffer_capacity;
+} AlignCache;
+
+//opens filename, creating it if needed; exits on I/O errors
+extern AlignCache* openAlignCache(const char *filename);
+extern void closeAlignCache(AlignCache *cache);
+
+extern unsigned long long alignCacheSeqHash(int *seq, int len);
+//identifies the scoring and the kernel (tag 0 for kernels giving the
+//nwalign() alignment, others for heuristic or co-optimal ones)
+extern unsigned int alignCacheParams(int match, int mismatch, int gapopen, int gapext, unsigned int kernelTag);
+
+//true and fills entry if key is in the file (with its alignment if
+//needAlignment)
+extern bool lookupAlignCache(AlignCache *cache, const AlignCacheKey *key, bool needAlignment, AlignCacheEntry *entry);
+//appends a result, with the columns of pair unless it is NULL, unless the
+//file has it already (with its alignment if pair is not NULL)
+extern void appendAlignCache(AlignCache *cache, const AlignCacheKey *key, const NWPairCounts *counts, AlignPair *pair);
+//rebuilds the alignment of entry (which must have runs) into pair
+extern void alignCacheRestore(const AlignCacheEntry *entry, int *seq1, int *seq2, AlignPair *pair);
+
+#endif
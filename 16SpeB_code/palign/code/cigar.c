@@ -0,0 +1,146 @@
+#include "cigar.h"
+
+#include <map>
+
+using namespace std;
+
+static
+char _column_op(int c1, int c2) {
+	if(c1 == GAP_CHAR) {
+		return 'I';
+	}
+	if(c2 == GAP_CHAR) {
+		return 'D';
+	}
+	return (c1 == c2 ? '=' : 'X');
+}
+
+void appendCigar(TextBuffer *buf, const int *align1, const int *align2, int len) {
+	int k = 0;
+	while(k < len) {
+		char op = _column_op(align1[k], align2[k]);
+		int run = 1;
+		while(k + run < len && _column_op(align1[k + run], align2[k + run]) == op) {
+			run++;
+		}
+		appendInt(buf, run);
+		appendChar(buf, op);
+		k += run;
+	}
+}
+
+bool decodeCigar(const char *cigar, int *seq1, int len1, int *seq2, int len2, AlignPair *pair) {
+	int i = 0;
+	int j = 0;
+	int len = 0;
+	const char *next = cigar;
+	while(*next != '\0' && !isspace(*next)) {
+		if(!isdigit(*next)) {
+			return false;
+		}
+		long run = strtol(next, (char**) &next, 10);
+		char op = *next++;
+		bool uses1 = (op == '=' || op == 'X' || op == 'D');
+		bool uses2 = (op == '=' || op == 'X' || op == 'I');
+		if(!uses1 && !uses2) {
+			return false;
+		}
+		if(run <= 0 || (uses1 && run > len1 - i) || (uses2 && run > len2 - j)
+				|| len + run > pair->capacity) {
+			return false;
+		}
+		for(long r = 0; r < run; r++) {
+			pair->align1[len] = (uses1 ? seq1[i++] : GAP_CHAR);
+			pair->align2[len] = (uses2 ? seq2[j++] : GAP_CHAR);
+			if(uses1 && uses2 && (pair->align1[len] == pair->align2[len]) != (op == '=')) {
+				return false;
+			}
+			len++;
+		}
+	}
+	pair->len = len;
+	return (i == len1 && j == len2);
+}
+
+void appendGappedFasta(TextBuffer *text, Input *input, int seqind1, int seqind2,
+		const AlignPair *pair, const NWPairCounts *counts) {
+	double pidOverNongap = countsPidOverNongap(counts);
+	double pidOverAlignlen = countsPidOverAlignlen(counts);
+	appendChar(text, '>');
+	appendText(text, input->fastaHeaders[seqind1]);
+	appendText(text, "; PID1-over-non-gap=");
+	appendDouble(text, pidOverNongap);
+	appendText(text, "; PID1-over-alignlen=");
+	appendDouble(text, pidOverAlignlen);
+	appendChar(text, '\n');
+	appendSeq(text, pair->align1, pair->len);
+	appendChar(text, '>');
+	appendText(text, input->fastaHeaders[seqind2]);
+	appendText(text, "; PID2-over-non-gap=");
+	appendDouble(text, pidOverNongap);
+	appendText(text, "; PID2-over-alignlen=");
+	appendDouble(text, pidOverAlignlen);
+	appendChar(text, '\n');
+	appendSeq(text, pair->align2, pair->len);
+	appendChar(text, '\n');
+}
+
+void decodeCigars(const char *fastaFilename, const char *cigarFilename) {
+	ifstream in(cigarFilename);
+	if(!in.is_open()) {
+		cerr<<"Error: cannot open "<<cigarFilename<<endl;
+		exit(1);
+	}
+	Input *input = new Input(fastaFilename);
+	map<string, int> seqIndex;
+	for(int k = input->seqset->numseqs - 1; k >= 0; k--) {
+		seqIndex[input->fastaHeaders[k]] = k;
+	}
+	int seqMaxlen = input->seqset->maxseqlen;
+	AlignPair *pair = constructAlignPair(seqMaxlen, seqMaxlen);
+	TextBuffer text;
+	initTextBuffer(&text);
+
+	string header1;
+	string header2;
+	string line;
+	long lineNumber = 0;
+	long decoded = 0;
+	while(getline(in, line)) {
+		lineNumber++;
+		if(!line.empty() && line[0] == '>') {
+			header1 = header2;
+			header2 = line.substr(1);
+			continue;
+		}
+		if(line.compare(0, 7, "CIGAR: ") != 0) {
+			continue;
+		}
+		map<string, int>::const_iterator it1 = seqIndex.find(header1);
+		map<string, int>::const_iterator it2 = seqIndex.find(header2);
+		if(it1 == seqIndex.end() || it2 == seqIndex.end()) {
+			cerr<<"Error: "<<cigarFilename<<" line "<<lineNumber<<": the pair is not one of "<<fastaFilename<<endl;
+			exit(1);
+		}
+		int seqind1 = it1->second;
+		int seqind2 = it2->second;
+		if(!decodeCigar(line.c_str() + 7, input->seqset->seqs[seqind1], input->seqset->seqlen[seqind1],
+				input->seqset->seqs[seqind2], input->seqset->seqlen[seqind2], pair)) {
+			cerr<<"Error: "<<cigarFilename<<" line "<<lineNumber<<": the CIGAR does not align the sequences of "
+				<<fastaFilename<<endl;
+			exit(1);
+		}
+		NWPairCounts counts;
+		computePairCounts(pair, &counts);
+		appendGappedFasta(&text, input, seqind1, seqind2, pair, &counts);
+		writeTextBuffer(&text, cout);
+		decoded++;
+	}
+	if(decoded == 0) {
+		cerr<<"Error: no CIGAR in "<<cigarFilename<<endl;
+		exit(1);
+	}
+	freeTextBuffer(&text);
+	nilAlignPair(pair);
+	delete input;
+}
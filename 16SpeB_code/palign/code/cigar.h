@@ -0,0 +1,35 @@
+#ifndef _CIGAR_H
+#define _CIGAR_H
+
+#include "stdinc.h"
+#include "nwalign.h"
+#include "textout.h"
+#include "Input.h"
+
+//An alignment as the run-length CIGAR string of -cigar, with the first
+//sequence as the reference: <count><op> runs of '=' (identical pair), 'X'
+//(mismatched pair), 'I' (a residue of the second sequence against a gap)
+//and 'D' (a residue of the first sequence against a gap).  With both
+//sequences it gives back every column, so the gapped view need not be
+//printed.
+
+//the CIGAR string of the len columns of align1 and align2
+extern void appendCigar(TextBuffer *buf, const int *align1, const int *align2, int len);
+
+//Rebuilds into pair the alignment of seq1 and seq2 that cigar (up to its
+//first blank) describes.  False if cigar is malformed, disagrees with the
+//residues on '=' or 'X', or does not use both sequences up exactly.
+extern bool decodeCigar(const char *cigar, int *seq1, int len1, int *seq2, int len2, AlignPair *pair);
+
+//the -print-fsa view of a pair: both FASTA headers with the PIDs and the
+//gapped sequences
+extern void appendGappedFasta(TextBuffer *text, Input *input, int seqind1, int seqind2,
+		const AlignPair *pair, const NWPairCounts *counts);
+
+//The decode-cigar subcommand: prints to stdout what -print-fsa would have
+//printed for the pairs of a -cigar output of fastaFilename.  A pair is the
+//two header lines before its "CIGAR:" line, each sequence being the first
+//with its header.  Exits on a pair or CIGAR that does not fit the FASTA.
+extern void decodeCigars(const char *fastaFilename, const char *cigarFilename);
+
+#endif
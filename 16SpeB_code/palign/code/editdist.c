@@ -0,0 +1,103 @@
+//Myers' bit-vector edit distance (J. ACM 46(3), 1999), in the block form
+//of Hyyro (2003) for sequences longer than one word.
+//
+//Column j of the DP matrix (seq2[0..j) against every prefix of the pattern)
+//is kept as vertical deltas D[i][j] - D[i-1][j] in {-1,0,+1}, one bit per
+//row in Pv/Mv; a column step costs a few word operations per 64 rows.  The
+//horizontal delta leaving a block is carried into the next one, row 0
+//always gets +1 (global alignment: D[0][j] = j), and the score is followed
+//at the last pattern row, so padding bits of the last block never count.
+
+#include "editdist.h"
+
+static const int EDIT_WORD_BITS = 64;
+
+EditDistParams* constructEditDistParams(int seq_maxlen) {
+	EditDistParams *params = (EditDistParams*) malloc(sizeof(EditDistParams));
+	params->block_capacity = seq_maxlen / EDIT_WORD_BITS + 1;
+	params->peq = (EditWord*) malloc(sizeof(EditWord) * (NUMALPHAS + 1) * params->block_capacity);
+	params->pv = (EditWord*) malloc(sizeof(EditWord) * params->block_capacity);
+	params->mv = (EditWord*) malloc(sizeof(EditWord) * params->block_capacity);
+	if(params->peq == NULL || params->pv == NULL || params->mv == NULL) {
+		fprintf(stderr, "Out of memory at constructEditDistParams()\n");
+		abort();
+	}
+	return params;
+}
+
+void nilEditDistParams(EditDistParams *params) {
+	free(params->peq);
+	free(params->pv);
+	free(params->mv);
+	free(params);
+}
+
+//advances one block by one column; hin/the return value are the horizontal
+//deltas entering at the block's top row and leaving at its row outBit
+static inline
+int _advance_block(EditWord &Pv, EditWord &Mv, EditWord Eq, int hin, int outBit) {
+	EditWord hinIsNeg = (hin < 0 ? 1 : 0);
+	EditWord Xv = Eq | Mv;
+	Eq |= hinIsNeg;
+	EditWord Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+	EditWord Ph = Mv | ~(Xh | Pv);
+	EditWord Mh = Pv & Xh;
+
+	int hout = (int) ((Ph >> outBit) & 1) - (int) ((Mh >> outBit) & 1);
+
+	Ph <<= 1;
+	Mh <<= 1;
+	Mh |= hinIsNeg;
+	Ph |= (hin > 0 ? 1 : 0);
+	Pv = Mh | ~(Xv | Ph);
+	Mv = Ph & Xv;
+	return hout;
+}
+
+int editDistance(EditDistParams *params, int *seq1, int len1, int *seq2, int len2) {
+	//the shorter sequence is the bit-parallel pattern
+	if(len1 > len2) {
+		int *tmpseq = seq1; seq1 = seq2; seq2 = tmpseq;
+		int tmplen = len1; len1 = len2; len2 = tmplen;
+	}
+	if(len1 == 0) {
+		return len2;
+	}
+
+	const int blocks = (len1 + EDIT_WORD_BITS - 1) / EDIT_WORD_BITS;
+	const int lastBit = (len1 - 1) % EDIT_WORD_BITS;
+	if(DEBUG0) {
+		assert(blocks <= params->block_capacity);
+	}
+
+	EditWord *peq = params->peq;
+	EditWord *Pv = params->pv;
+	EditWord *Mv = params->mv;
+	memset(peq, 0, sizeof(EditWord) * (NUMALPHAS + 1) * blocks);
+	for(int i = 0; i < len1; i++) {
+		peq[seq1[i] * blocks + i / EDIT_WORD_BITS] |= (EditWord) 1 << (i % EDIT_WORD_BITS);
+	}
+	for(int b = 0; b < blocks; b++) {
+		Pv[b] = ~(EditWord) 0; //D[i][0] = i
+		Mv[b] = 0;
+	}
+
+	int score = len1;
+	for(int j = 0; j < len2; j++) {
+		const EditWord *eq = peq + seq2[j] * blocks;
+		int h = 1; //D[0][j+1] - D[0][j]
+		for(int b = 0; b < blocks - 1; b++) {
+			h = _advance_block(Pv[b], Mv[b], eq[b], h, EDIT_WORD_BITS - 1);
+		}
+		score += _advance_block(Pv[blocks-1], Mv[blocks-1], eq[blocks-1], h, lastBit);
+	}
+	return score;
+}
+
+double editDistancePidBound(int dist, int len1, int len2) {
+	int mn = (len1 < len2 ? len1 : len2);
+	if(mn + dist == 0) {
+		return 0;
+	}
+	return ((double) mn) / (mn + dist);
+}
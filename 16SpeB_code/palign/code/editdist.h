@@ -0,0 +1,32 @@
+#ifndef _EDITDIST_H
+#define _EDITDIST_H
+
+#include "stdinc.h"
+
+//Unit-cost (Levenshtein) global edit distance with Myers' bit-vector
+//algorithm, 64 DP cells per word operation.
+
+typedef unsigned long long EditWord;
+
+//match masks and vertical deltas of the shorter sequence, grown on demand
+typedef struct {
+	EditWord *peq; //(NUMALPHAS + 1) symbols by block_capacity words, GAP_CHAR included
+	EditWord *pv; //vertical +1 deltas, one word per block
+	EditWord *mv; //vertical -1 deltas
+	int block_capacity;
+} EditDistParams;
+
+extern EditDistParams* constructEditDistParams(int seq_maxlen);
+extern void nilEditDistParams(EditDistParams *params);
+
+//number of substitutions, insertions and deletions turning seq1 into seq2;
+//symbols compare like in nwalign(), so GAP_CHAR matches GAP_CHAR
+extern int editDistance(EditDistParams *params, int *seq1, int len1, int *seq2, int len2);
+
+//Highest PID over alignment-length of any alignment of a len1 x len2 pair
+//with edit distance dist: an alignment of length L has at most L - dist
+//identities and at most min(len1,len2), which gives min / (min + dist).
+//Used as the identity estimate of -edit-distance and by the prefilter.
+extern double editDistancePidBound(int dist, int len1, int len2);
+
+#endif
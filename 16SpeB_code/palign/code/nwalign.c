@@ -1,8 +1,7 @@
 #include "nwalign.h"
+#include "nwalign_scoring.h"
 #include "symbols.h"
 
-enum DirectionType { DIR_ERR, DIR_M, DIR_IX, DIR_IY};
-
 static
 void _display_seq(FILE *fptr, int *seq, int len) {
 	for(int i = 0; i < len; i++ ) {
@@ -16,85 +15,22 @@ void _display_seq(FILE *fptr, int *seq, int len) {
 	fprintf(fptr, "\n");
 }
 
-static
-void inplace_reverse_seq(int *seq, int len) {
-	int left = 0;
-	int right = len-1;
-	while(left < right) {
-		int temp = seq[left];
-		seq[left] = seq[right];
-		seq[right] = temp;
-
-		left++;
-		right--;
+//next direction in the packed traceback of the full-matrix kernels
+struct DpNextDirection {
+	const unsigned char *tb; //(len1+1) rows of len2+1 cells
+	long stride;
+	inline int operator()(int i, int j, int dirtyp) const {
+		return tbNextDirection(tb[i * stride + j], dirtyp);
 	}
-}
+};
 
 static
-void traceback_align(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, AlignPair *result) {
-	int *align1 = result->align1;
-	int *align2 = result->align2;
-
-	int align_pos = 0;
-	int i = len1; //remember that tbmatrix is size len1+1 by len2+1
-	int j = len2;
-
-	//starting direction/matrix
-	int dirtyp;
-	if(params->Ix[len1][len2] >= params->Iy[len1][len2] && params->Ix[len1][len2] >= params->dpm[len1][len2]) {
-		dirtyp = DIR_IX;
-	}
-	else if(params->Iy[len1][len2] >= params->Ix[len1][len2] && params->Iy[len1][len2] >= params->dpm[len1][len2]) {
-		dirtyp = DIR_IY;
-	}
-	else {
-		dirtyp = DIR_M;
-	}
-
-
-	//create the alignment in reverse
-	while( i > 0 || j > 0 ) {
-		if(DEBUG0) {
-			assert(align_pos < result->capacity);
-		}
-
-		if(dirtyp == DIR_IX) {
-			align1[align_pos] = seq1[i-1];
-			align2[align_pos] = GAP_CHAR;
-			dirtyp = params->tb_Ix[i][j];
-			i--;
-		}
-		else if(dirtyp == DIR_IY) {
-			align1[align_pos] = GAP_CHAR;
-			align2[align_pos] = seq2[j-1];
-			dirtyp = params->tb_Iy[i][j];
-			j--;
-		}
-		else if(dirtyp == DIR_M) {
-			align1[align_pos] = seq1[i-1];
-			align2[align_pos] = seq2[j-1];
-			dirtyp = params->tb_dpm[i][j];
-			i--;
-			j--;
-		}
-		else {
-			if(DEBUG0) {
-				fprintf(stderr, "Error: DIR_ERR found at position (%d,%d) and align_pos %d\n", i,j, align_pos);
-			}
-			abort();
-		}
-
-		align_pos++;
-	}
-
-	//reverse the alignment
-	inplace_reverse_seq(align1, align_pos);
-	inplace_reverse_seq(align2, align_pos);
-
-	result->len = align_pos;
+void traceback_align(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, int dirtyp, AlignPair *result) {
+	DpNextDirection next = {params->dp->tb, params->dp->tb_stride};
+	tracebackAlign(next, seq1, len1, seq2, len2, dirtyp, result);
 
 	if(DEBUG0) {
-		assert(align_pos <= len1 + len2);
+		assert(result->len <= len1 + len2);
 
 		//check if all alphabets are present without gaps
 		int pos = 0;
@@ -124,143 +60,489 @@ void traceback_align(NWAlignParams *params, int *seq1, int len1, int *seq2, int
 	}
 }
 
-static void _print_intmatrix(double **mat, int dim1, int dim2) {
-	FILE *fptr = stderr;
-	for(int i = 0; i < dim1; i++) {
-		for(int j = 0; j < dim2; j++) {
-			fprintf(fptr, "%8.0lf", mat[i][j]);
+//starting direction/matrix for the traceback at (len1, len2)
+template <typename ScoreT>
+static int _start_direction(ScoreT m, ScoreT ix, ScoreT iy) {
+	if(ix >= iy && ix >= m) {
+		return DIR_IX;
+	}
+	else if(iy >= ix && iy >= m) {
+		return DIR_IY;
+	}
+	return DIR_M;
+}
+
+//early exit of _nwfill() used by nwalignPidClass()
+typedef struct {
+	double threshold; //PID over alignment-length the pair has to reach
+	int rowsFilled; //set to the number of rows filled
+} NWFillBound;
+
+//rows filled between two checks of the NWFillBound
+static const int NW_BOUND_ROWS = 32;
+
+//Upper bound on the PID over alignment-length of any len1 x len2 alignment
+//scoring at most maxScore.  With I identities, X mismatches and G gap
+//characters in O runs, score = (a-x)I + xN/2 + G(e - x/2) + (o-e)O for
+//N = len1 + len2, where (o-e)O >= min(o-e,0)G, and the alignment length is
+//(N+G)/2, so
+//PID <= 2(K + cG) / ((a-x)(N+G)) with K = maxScore - xN/2 and
+//c = x/2 - e - min(o-e,0); also PID <= (N-G)/(N+G) since I <= (N-G)/2.
+//The first is monotone in G and the second decreasing, so the largest
+//minimum over |len1-len2| <= G <= N is at an end or where they cross.
+static
+double _pid_alignlen_bound(NWAlignParams *params, double maxScore, int len1, int len2) {
+	double ax = params->match - params->mismatch;
+	double N = len1 + len2;
+	double K = maxScore - params->mismatch * N / 2;
+	double oe = params->gapopen - params->gapext;
+	double c = params->mismatch / 2.0 - params->gapext - (oe < 0 ? oe : 0);
+
+	double gmin = abs(len1 - len2);
+	double gcross = (ax * N - 2 * K) / (2 * c + ax);
+	double candidates[3] = {gmin, N, (gcross < gmin ? gmin : (gcross > N ? N : gcross))};
+	double best = -DBL_MAX;
+	for(int k = 0; k < 3; k++) {
+		double G = candidates[k];
+		if(N + G <= 0) {
+			continue;
+		}
+		double f = 2 * (K + c * G) / (ax * (N + G));
+		double h = (N - G) / (N + G);
+		double v = (f < h ? f : h);
+		if(v > best) {
+			best = v;
 		}
-		fprintf(fptr, "\n");
 	}
+	return best;
 }
 
+//true if the bound above is valid: the rest of the matrix is scored by
+//assuming pairs are worth a and gap characters max(o,e), which only
+//overestimates when trading a pair for two gap characters never helps
+static
+bool _pid_bound_applies(NWAlignParams *params) {
+	int a = (params->match > params->mismatch ? params->match : params->mismatch);
+	int g = (params->gapopen > params->gapext ? params->gapopen : params->gapext);
+	return (params->match > params->mismatch && 2 * g <= a);
+}
 
-//See Durbin p. 29, equation (2.16)
-void nwalign(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, AlignPair* result){
-	if(DEBUG0) {
-		if(len1+1 > params->matrix_capacity || len2+1 > params->matrix_capacity) {
-			fprintf(stderr, "DP matrix out of range.\n");
-			abort();
+//true if no alignment through row i (held in the "up" rows) can reach the
+//threshold: the path leaves row i at some column j with a score of at most
+//max(dpm, Ix, Iy) there, and the rest of the matrix adds at most a per pair
+//plus max(o,e) for each of the |(len1-i)-(len2-j)| unavoidable gaps
+template <typename ScoreT>
+static bool _below_pid_bound(NWAlignParams *params, const ScoreT *dpm, const ScoreT *Ix, const ScoreT *Iy,
+		int i, int len1, int len2, double threshold) {
+	const int a = (params->match > params->mismatch ? params->match : params->mismatch);
+	const int g = (params->gapopen > params->gapext ? params->gapopen : params->gapext);
+	long best = LONG_MIN;
+	for(int j = 0; j < len2 + 1; j++) {
+		long v = dpm[j];
+		if(Ix[j] > v) v = Ix[j];
+		if(Iy[j] > v) v = Iy[j];
+		int restRows = len1 - i;
+		int restCols = len2 - j;
+		v += (long) a * (restRows < restCols ? restRows : restCols) + (long) g * abs(restRows - restCols);
+		if(v > best) {
+			best = v;
 		}
 	}
+	return (_pid_alignlen_bound(params, best, len1, len2) < threshold - 1e-9);
+}
 
-	double **dpm = params->dpm;
-	double **Ix = params->Ix;
-	double **Iy = params->Iy;
+static const long NW_DP_ALIGN = 64; //a cache line
+static const long NW_HUGE_PAGE = 2L << 20;
 
-	int **tb_dpm = params->tb_dpm; //traceback
-	int **tb_Ix = params->tb_Ix; //traceback
-	int **tb_Iy = params->tb_Iy; //traceback
+//Lays the workspace out for a len1 x len2 pair: rowBytes of score rows,
+//then the traceback from the next 64-byte boundary with a row stride of
+//len2+1, so a short pair touches one dense block instead of a corner of a
+//matrix sized for the longest sequence.  The block only grows, by at least
+//half each time; contents are not kept.
+NWDpWorkspace* reserveDpWorkspace(NWAlignParams *params, long rowBytes, int len1, int len2) {
+	NWDpWorkspace *ws = params->dp;
+	if(ws == NULL) {
+		ws = (NWDpWorkspace*) malloc(sizeof(NWDpWorkspace));
+		ws->block = NULL;
+		ws->capacity = 0;
+		ws->peak = 0;
+		params->dp = ws;
+	}
 
-	int match = params->match;
-	int mismatch = params->mismatch;
-	int gapopen = params->gapopen;
-	int gapext = params->gapext;
+	long tbOffset = (rowBytes + NW_DP_ALIGN - 1) / NW_DP_ALIGN * NW_DP_ALIGN;
+	long bytes = tbOffset + (long) (len1 + 1) * (len2 + 1);
+	if(bytes > ws->capacity) {
+		long capacity = (ws->capacity + ws->capacity / 2 > bytes ? ws->capacity + ws->capacity / 2 : bytes);
+		long alignment = (params->hugePages && capacity >= NW_HUGE_PAGE ? NW_HUGE_PAGE : NW_DP_ALIGN);
+		capacity = (capacity + alignment - 1) / alignment * alignment;
 
-	if(DEBUG1) {
-		cerr<<"match "<<match<<endl;
-		cerr<<"mismatch "<<mismatch<<endl;
-		cerr<<"gapopen "<<gapopen<<endl;
-		cerr<<"gapext "<<gapext<<endl;
-	}
-
-	//initialize
-	dpm[0][0] = 0; //M(i,j) is the best score up to (i,j) given that x_i is aligned to y_i
-	Ix[0][0] = -INFINITY; //so that gap open must start from dpm
-	Iy[0][0] = -INFINITY;
-	tb_dpm[0][0] = DIR_ERR;
-	tb_Ix[0][0] = DIR_ERR;
-	tb_Iy[0][0] = DIR_ERR;
-	for(int i = 1; i < len1+1; i++) {
-		dpm[i][0] = -INFINITY;
-		Ix[i][0] = gapopen + (i-1) * gapext;
-		Iy[i][0] = -INFINITY;
-
-		tb_dpm[i][0] = DIR_ERR;
-		tb_Ix[i][0] = (i == 1 ? DIR_M : DIR_IX);
-		tb_Iy[i][0] = DIR_ERR;
+		free(ws->block);
+		void *block = NULL;
+		if(posix_memalign(&block, alignment, capacity) != 0) {
+			fprintf(stderr, "Out of memory at reserveDpWorkspace()\n");
+			abort();
+		}
+#ifdef MADV_HUGEPAGE
+		if(alignment == NW_HUGE_PAGE) {
+			madvise(block, capacity, MADV_HUGEPAGE); //only a hint, failure is harmless
+		}
+#endif
+		ws->block = (char*) block;
+		ws->capacity = capacity;
 	}
-	for(int j = 1; j < len2+1; j++) {
-		dpm[0][j] = -INFINITY;
-		Ix[0][j] = -INFINITY;
-		Iy[0][j] = gapopen + (j-1) * gapext;
+	if(bytes > ws->peak) {
+		ws->peak = bytes;
+	}
+
+	ws->rows = ws->block;
+	ws->tb = (unsigned char*) ws->block + tbOffset;
+	ws->tb_stride = len2 + 1;
+	return ws;
+}
+
+//Fills the Gotoh recurrences with integer scores, keeping only two rows of
+//each matrix and one packed traceback byte per cell; negInf is a finite
+//sentinel small enough that no real alignment score ever reaches it.
+//Returns the direction the traceback starts from and sets score to the
+//alignment score, or returns DIR_ERR if bound is given and the pair was
+//found to miss its PID threshold before the last row.
+template <typename ScoreT, typename Scoring>
+static int _nwfill(NWAlignParams *params, ScoreT negInf,
+		int *seq1, int len1, int *seq2, int len2, int &score, NWFillBound *bound) {
+	const long capacity = len2 + 1; //entries per score row
+	NWDpWorkspace *ws = reserveDpWorkspace(params, sizeof(ScoreT) * 6 * capacity, len1, len2);
+	ScoreT *rows = (ScoreT*) ws->rows;
+	unsigned char *tb = ws->tb; //traceback
+	const long stride = ws->tb_stride;
 
-		tb_dpm[0][j] = DIR_ERR;
-		tb_Ix[0][j] = DIR_ERR;
-		tb_Iy[0][j] = (j == 1 ? DIR_M : DIR_IY);
+	const ScoreT match = Scoring::match(params);
+	const ScoreT mismatch = Scoring::mismatch(params);
+	const ScoreT gapopen = Scoring::gapopen(params);
+	const ScoreT gapext = Scoring::gapext(params);
+
+	ScoreT *dpm_up = rows;
+	ScoreT *Ix_up = rows + capacity;
+	ScoreT *Iy_up = rows + 2 * capacity;
+	ScoreT *dpm_cur = rows + 3 * capacity;
+	ScoreT *Ix_cur = rows + 4 * capacity;
+	ScoreT *Iy_cur = rows + 5 * capacity;
+
+	//initialize row 0
+	dpm_up[0] = 0; //M(i,j) is the best score up to (i,j) given that x_i is aligned to y_i
+	Ix_up[0] = negInf; //so that gap open must start from dpm
+	Iy_up[0] = negInf;
+	tb[0] = DIR_ERR;
+	for(int j = 1; j < len2+1; j++) {
+		dpm_up[j] = negInf;
+		Ix_up[j] = negInf;
+		Iy_up[j] = gapopen + (j-1) * gapext;
+		tb[j] = DIR_ERR | (j == 1 ? 0 : TB_IY_EXT);
 	}
 
 	//set DP matrix
 	for(int i = 1; i < len1 + 1; i++) {
+		const int c1 = seq1[i-1];
+		unsigned char *tb_cur = tb + i * stride;
+
+		//column 0
+		dpm_cur[0] = negInf;
+		Ix_cur[0] = gapopen + (i-1) * gapext;
+		Iy_cur[0] = negInf;
+		tb_cur[0] = DIR_ERR | (i == 1 ? 0 : TB_IX_EXT);
+
 		for(int j = 1; j < len2 +1; j++) {
-			double m_val, ix_val, iy_val;
-			int s = (seq1[i-1] == seq2[j-1] ? match : mismatch);
+			ScoreT m_val, ix_val, iy_val;
+			ScoreT s = (c1 == seq2[j-1] ? match : mismatch);
+			unsigned char cell;
 
 			//Setting dpm 
-			m_val = dpm[i-1][j-1]+s;
-			ix_val = Ix[i-1][j-1]+s;
-			iy_val = Iy[i-1][j-1]+s;
+			m_val = dpm_up[j-1]+s;
+			ix_val = Ix_up[j-1]+s;
+			iy_val = Iy_up[j-1]+s;
 		
 			if(ix_val >= m_val && ix_val >= iy_val) {
-				dpm[i][j] = ix_val;
-				tb_dpm[i][j] = DIR_IX;
+				dpm_cur[j] = ix_val;
+				cell = DIR_IX;
 			}
 			else if(iy_val >= m_val && iy_val >= ix_val) {
-				dpm[i][j] = iy_val;
-				tb_dpm[i][j] = DIR_IY;
+				dpm_cur[j] = iy_val;
+				cell = DIR_IY;
 			}
 			else {
-				dpm[i][j] = m_val;
-				tb_dpm[i][j] = DIR_M;
+				dpm_cur[j] = m_val;
+				cell = DIR_M;
 			}
 
 			//Setting Ix
-			m_val = dpm[i-1][j] + gapopen;
-			ix_val = Ix[i-1][j] + gapext;
+			m_val = dpm_up[j] + gapopen;
+			ix_val = Ix_up[j] + gapext;
 
 			if(ix_val >= m_val) {
-				Ix[i][j] = ix_val;
-				tb_Ix[i][j] = DIR_IX;
+				Ix_cur[j] = ix_val;
+				cell |= TB_IX_EXT;
 			}
 			else {
-				Ix[i][j] = m_val;
-				tb_Ix[i][j] = DIR_M;
+				Ix_cur[j] = m_val;
 			}
 
 			//Setting Iy
-			m_val = dpm[i][j-1] + gapopen;
-			iy_val = Iy[i][j-1] + gapext;
+			m_val = dpm_cur[j-1] + gapopen;
+			iy_val = Iy_cur[j-1] + gapext;
 
 			if(iy_val >= m_val) {
-				Iy[i][j] = iy_val;
-				tb_Iy[i][j] = DIR_IY;
+				Iy_cur[j] = iy_val;
+				cell |= TB_IY_EXT;
 			}
 			else {
-				Iy[i][j] = m_val;
-				tb_Iy[i][j] = DIR_M;
+				Iy_cur[j] = m_val;
 			}
+
+			tb_cur[j] = cell;
 		}
+
+		ScoreT *tmp;
+		tmp = dpm_up; dpm_up = dpm_cur; dpm_cur = tmp;
+		tmp = Ix_up; Ix_up = Ix_cur; Ix_cur = tmp;
+		tmp = Iy_up; Iy_up = Iy_cur; Iy_cur = tmp;
+
+		if(bound != NULL && i % NW_BOUND_ROWS == 0 && i < len1
+				&& _below_pid_bound(params, dpm_up, Ix_up, Iy_up, i, len1, len2, bound->threshold)) {
+			bound->rowsFilled = i;
+			return DIR_ERR;
+		}
+	}
+
+	//the last row filled is now in the "up" rows
+	if(bound != NULL) {
+		bound->rowsFilled = len1;
+	}
+	if(DEBUG1) {
+		fprintf(stderr, "dpm_score=%d\n", (int) dpm_up[len2]);
+		fprintf(stderr, "Ix_score=%d\n", (int) Ix_up[len2]);
+		fprintf(stderr, "Iy_score=%d\n", (int) Iy_up[len2]);
 	}
 
-	traceback_align(params, seq1, len1, seq2, len2, result);
+	score = dpm_up[len2];
+	if(Ix_up[len2] > score) score = Ix_up[len2];
+	if(Iy_up[len2] > score) score = Iy_up[len2];
+	return _start_direction(dpm_up[len2], Ix_up[len2], Iy_up[len2]);
+}
+
+
+//_nwfill() with the constants of the blastn preset folded in when the
+//run uses it
+template <typename ScoreT>
+static int _nwfill_scored(NWAlignParams *params, ScoreT negInf,
+		int *seq1, int len1, int *seq2, int len2, int &score, NWFillBound *bound = NULL) {
+	if(BlastnScoring::matches(params)) {
+		return _nwfill<ScoreT, BlastnScoring>(params, negInf, seq1, len1, seq2, len2, score, bound);
+	}
+	return _nwfill<ScoreT, ParamScoring>(params, negInf, seq1, len1, seq2, len2, score, bound);
+}
+
+//See Durbin p. 29, equation (2.16)
+void nwalign(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, AlignPair* result){
+	if(DEBUG0) {
+		if(len1+1 > params->matrix_capacity || len2+1 > params->matrix_capacity) {
+			fprintf(stderr, "DP matrix out of range.\n");
+			abort();
+		}
+	}
+
+	bool fitsInt16 = nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2);
+	if(DEBUG1) {
+		cerr<<"match "<<params->match<<endl;
+		cerr<<"mismatch "<<params->mismatch<<endl;
+		cerr<<"gapopen "<<params->gapopen<<endl;
+		cerr<<"gapext "<<params->gapext<<endl;
+		cerr<<"score width "<<(fitsInt16 ? 16 : 32)<<endl;
+	}
+
+	int dirtyp;
+	if(fitsInt16) {
+		dirtyp = _nwfill_scored<short>(params, NW_NEG_INF16, seq1, len1, seq2, len2, result->score);
+	}
+	else {
+		dirtyp = _nwfill_scored<int>(params, NW_NEG_INF32, seq1, len1, seq2, len2, result->score);
+	}
+
+	traceback_align(params, seq1, len1, seq2, len2, dirtyp, result);
 
 	if(DEBUG1) {
-		//fprintf(stderr, "DP matrix\n");
-		//_print_intmatrix(dpm, len1 + 1, len2+1) ;
-		//fprintf(stderr, "\n");
-		//fprintf(stderr, "Traceback matrix\n");
-		//_print_intmatrix(tbm, len1 + 1, len2+1) ;
-		//fprintf(stderr, "\n");
-
-		fprintf(stderr, "dpm_score=%.1lf\n", dpm[len1][len2]);
-		fprintf(stderr, "Ix_score=%.1lf\n", Ix[len1][len2]);
-		fprintf(stderr, "Iy_score=%.1lf\n", Iy[len1][len2]);
 		_display_seq(stderr, result->align1, result->len);
 		_display_seq(stderr, result->align2, result->len);
 		fprintf(stderr, "\n");
 	}
 }
 
+//Follows the same path as traceback_align() without writing the alignment,
+//counting identities, aligned pairs and columns, and stops as soon as the
+//part of the path still ahead (at most i+j columns, at most min(i,j) of
+//them pairs) can no longer move the PID across threshold.  Rounding is
+//monotone, so a bound that clears the threshold in double arithmetic means
+//computePidOver*() would clear it too.
+static
+int _traceback_pid_class(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, int dirtyp,
+		double threshold, bool overNongap, long &steps) {
+	const unsigned char *tb = params->dp->tb;
+	const long stride = params->dp->tb_stride;
+	int i = len1;
+	int j = len2;
+	long ident = 0;
+	long nongap = 0;
+	long alignlen = 0;
+
+	while(true) {
+		long mn = (i < j ? i : j);
+		double lower, upper;
+		if(overNongap) {
+			lower = (nongap + mn > 0 ? (double) ident / (nongap + mn) : 0);
+			upper = (nongap + mn > 0 ? (double) (ident + mn) / (nongap + mn) : 0);
+		}
+		else {
+			long mx = (i > j ? i : j);
+			lower = (alignlen + i + j > 0 ? (double) ident / (alignlen + i + j) : 0);
+			upper = (alignlen + mx > 0 ? (double) (ident + mn) / (alignlen + mx) : 0);
+		}
+		if(lower >= threshold) {
+			return PID_ABOVE;
+		}
+		if(upper < threshold) {
+			return PID_BELOW;
+		}
+
+		if(dirtyp == DIR_IX) {
+			dirtyp = tbNextDirection(tb[i * stride + j], dirtyp);
+			i--;
+		}
+		else if(dirtyp == DIR_IY) {
+			dirtyp = tbNextDirection(tb[i * stride + j], dirtyp);
+			j--;
+		}
+		else if(dirtyp == DIR_M) {
+			nongap++;
+			ident += (seq1[i-1] == seq2[j-1] ? 1 : 0);
+			dirtyp = tbNextDirection(tb[i * stride + j], dirtyp);
+			i--;
+			j--;
+		}
+		else {
+			if(DEBUG0) {
+				fprintf(stderr, "Error: DIR_ERR found at position (%d,%d)\n", i, j);
+			}
+			abort();
+		}
+		alignlen++;
+		steps++;
+	}
+}
+
+int nwalignPidClass(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2,
+		double threshold, bool overNongap, NWPidClassStats *stats) {
+	if(DEBUG0) {
+		if(len1+1 > params->matrix_capacity || len2+1 > params->matrix_capacity) {
+			fprintf(stderr, "DP matrix out of range.\n");
+			abort();
+		}
+	}
+
+	//the score bound only speaks about the PID over alignment-length
+	NWFillBound bound;
+	bound.threshold = threshold;
+	bound.rowsFilled = len1;
+	NWFillBound *boundp = (!overNongap && _pid_bound_applies(params) ? &bound : NULL);
+
+	int dirtyp;
+	int score;
+	if(nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2)) {
+		dirtyp = _nwfill_scored<short>(params, NW_NEG_INF16, seq1, len1, seq2, len2, score, boundp);
+	}
+	else {
+		dirtyp = _nwfill_scored<int>(params, NW_NEG_INF32, seq1, len1, seq2, len2, score, boundp);
+	}
+
+	int cls = PID_BELOW;
+	long steps = 0;
+	if(dirtyp != DIR_ERR) {
+		cls = _traceback_pid_class(params, seq1, len1, seq2, len2, dirtyp, threshold, overNongap, steps);
+	}
+
+	if(DEBUG1) {
+		fprintf(stderr, "pid class %d: rows %d of %d, %ld traceback steps\n", cls, bound.rowsFilled, len1, steps);
+	}
+
+	if(stats != NULL) {
+		stats->pairs++;
+		stats->above += (cls == PID_ABOVE ? 1 : 0);
+		stats->decidedInDp += (dirtyp == DIR_ERR ? 1 : 0);
+		stats->rowsFilled += bound.rowsFilled;
+		stats->rows += len1;
+		stats->traced += (dirtyp != DIR_ERR ? 1 : 0);
+		stats->tracebackSteps += steps;
+	}
+	return cls;
+}
+
+//one definition per instruction set, see nwalign_simd.c
+extern void nwalignSimd_sse41(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, AlignPair* result);
+extern void nwalignSimd_avx2(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, AlignPair* result);
+
+void nwalignSimd(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, AlignPair* result) {
+	if(len1 == 0 || len2 == 0) {
+		nwalign(params, seq1, len1, seq2, len2, result);
+	}
+	else if(__builtin_cpu_supports("avx2")) {
+		nwalignSimd_avx2(params, seq1, len1, seq2, len2, result);
+	}
+	else if(__builtin_cpu_supports("sse4.1")) {
+		nwalignSimd_sse41(params, seq1, len1, seq2, len2, result);
+	}
+	else {
+		nwalign(params, seq1, len1, seq2, len2, result);
+	}
+}
+
+const char* nwalignSimdName() {
+	if(__builtin_cpu_supports("avx2")) {
+		return "AVX2";
+	}
+	else if(__builtin_cpu_supports("sse4.1")) {
+		return "SSE4.1";
+	}
+	return "none (scalar fallback)";
+}
+
+//one definition per instruction set, see nwalign_batch.c
+extern void nwalignBatch_sse41(NWAlignParams*, int *seq1, int len1, int **seqs2, int *lens2, int count,
+		AlignPair **results, NWBatchStats *stats);
+extern void nwalignBatch_avx2(NWAlignParams*, int *seq1, int len1, int **seqs2, int *lens2, int count,
+		AlignPair **results, NWBatchStats *stats);
+
+void nwalignBatch(NWAlignParams *params, int *seq1, int len1, int **seqs2, int *lens2, int count,
+		AlignPair **results, NWBatchStats *stats) {
+	if(__builtin_cpu_supports("avx2")) {
+		nwalignBatch_avx2(params, seq1, len1, seqs2, lens2, count, results, stats);
+	}
+	else if(__builtin_cpu_supports("sse4.1")) {
+		nwalignBatch_sse41(params, seq1, len1, seqs2, lens2, count, results, stats);
+	}
+	else {
+		for(int k = 0; k < count; k++) {
+			nwalign(params, seq1, len1, seqs2[k], lens2[k], results[k]);
+		}
+	}
+}
+
+int nwalignBatchLanes() {
+	if(__builtin_cpu_supports("avx2")) {
+		return 16;
+	}
+	else if(__builtin_cpu_supports("sse4.1")) {
+		return 8;
+	}
+	return 1;
+}
+
 double computePidOverAlignlen(int *align1, int *align2, int len) {
 	int ident = 0;
 	for(int i = 0; i < len; i++) {
@@ -291,7 +573,32 @@ double computePidOverNongap(int *align1, int *align2, int len) {
 	else {
 		return ((double)ident)/nongap;
 	}
+}
 
+void computePairCounts(AlignPair *pair, NWPairCounts *counts) {
+	counts->score = pair->score;
+	counts->alignlen = pair->len;
+	counts->identities = 0;
+	counts->nongap = 0;
+	for(int i = 0; i < pair->len; i++) {
+		if(pair->align1[i] != GAP_CHAR && pair->align2[i] != GAP_CHAR) {
+			counts->nongap++;
+			if(pair->align1[i] == pair->align2[i]) {
+				counts->identities++;
+			}
+		}
+	}
+}
+
+double countsPidOverAlignlen(const NWPairCounts *counts) {
+	return ((double)counts->identities) / counts->alignlen;
+}
+
+double countsPidOverNongap(const NWPairCounts *counts) {
+	if(counts->nongap == 0) {
+		return 0; //because identities must be 0 as well
+	}
+	return ((double)counts->identities)/counts->nongap;
 }
 
 //-----------------------------------------------------------------------------------------
@@ -302,10 +609,11 @@ AlignPair* constructAlignPair(int len1, int len2) {
 	AlignPair *pair = (AlignPair*) malloc(sizeof(AlignPair));
 	pair->len = 0;
 	pair->capacity = len1+len2;
+	pair->score = 0;
 	pair->align1 = (int*) malloc(sizeof(int) * pair->capacity);
 	pair->align2 = (int*) malloc(sizeof(int) * pair->capacity);
 
-	if(pair->align1 <= 0 || pair->align2 <=0 ) {
+	if(pair->align1 == NULL || pair->align2 == NULL) {
 		fprintf(stderr, "Out of memory at constructAlignPair()\n");
 		abort();
 	}
@@ -319,6 +627,52 @@ void nilAlignPair(AlignPair *pair) {
 	free(pair);
 }
 
+const NWScoring nwScoringPresets[] = {
+	{"blastn", NW_SCORING_BLASTN},
+	{"matlab", NW_SCORING_MATLAB},
+	{NULL, 0, 0, 0, 0}
+};
+
+const NWScoring* findNWScoring(const char *name) {
+	for(const NWScoring *s = nwScoringPresets; s->name != NULL; s++) {
+		if(!strcmp(s->name, name)) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+//nwalign() cannot go from Ix to Iy directly; one matrix can, which only
+//changes the optimum if two opposite gap columns beat a mismatch
+bool nwLinearGapScoring(int mismatch, int gapopen, int gapext) {
+	return (gapopen == gapext && 2 * gapext <= mismatch);
+}
+
+//Scores of a len1 x len2 alignment are bounded in magnitude by (len1+len2)
+//times the largest scoring constant; sentinel cells take at most two more
+//additions, so the whole range must stay clear of NW_NEG_INF16.
+bool nwScoreFitsInt16(int match, int mismatch, int gapopen, int gapext, int len1, int len2) {
+	int maxabs = abs(match);
+	if(abs(mismatch) > maxabs) maxabs = abs(mismatch);
+	if(abs(gapopen) > maxabs) maxabs = abs(gapopen);
+	if(abs(gapext) > maxabs) maxabs = abs(gapext);
+
+	long bound = ((long) len1 + len2 + 2) * maxabs;
+	return bound < -(long) NW_NEG_INF16;
+}
+
+//The same bound against NW_NEG_INF32, in 64 bits since the int32 range is
+//what it checks.
+bool nwScoreFitsInt32(int match, int mismatch, int gapopen, int gapext, int len1, int len2) {
+	long long maxabs = llabs((long long) match);
+	if(llabs((long long) mismatch) > maxabs) maxabs = llabs((long long) mismatch);
+	if(llabs((long long) gapopen) > maxabs) maxabs = llabs((long long) gapopen);
+	if(llabs((long long) gapext) > maxabs) maxabs = llabs((long long) gapext);
+
+	long long bound = ((long long) len1 + len2 + 2) * maxabs;
+	return bound < -(long long) NW_NEG_INF32;
+}
+
 NWAlignParams* constructNWAlignParams(int match, int mismatch, int gapopen, int gapext, int seq_maxlen) {
 	NWAlignParams *params = (NWAlignParams*) malloc(sizeof(NWAlignParams));
 	params->gapopen = gapopen;
@@ -326,53 +680,349 @@ NWAlignParams* constructNWAlignParams(int match, int mismatch, int gapopen, int
 	params->match = match;
 	params->mismatch = mismatch;
 	params->matrix_capacity = seq_maxlen + 1;
+	params->hugePages = false;
+
+	params->dp = NULL;
+	params->simd = NULL;
+	params->linear = NULL;
+	params->band = NULL;
+	params->batch = NULL;
+	params->wfa = NULL;
+	params->anchor = NULL;
+	params->stats = NULL;
 
-	params->dpm = (double**) malloc(sizeof(double*) * params->matrix_capacity);
-	for(int i = 0; i < params->matrix_capacity; i++) {
-		params->dpm[i] = (double*) malloc(sizeof(double) * params->matrix_capacity);
+	return params;
+}
+
+NWSimdWorkspace* reserveSimdWorkspace(NWAlignParams *params, long tbBytes, int numDiags, long rowBytes) {
+	NWSimdWorkspace *ws = params->simd;
+	if(ws == NULL) {
+		ws = (NWSimdWorkspace*) malloc(sizeof(NWSimdWorkspace));
+		ws->tb = NULL;
+		ws->tb_capacity = 0;
+		ws->diag_offset = NULL;
+		ws->diag_capacity = 0;
+		ws->rows = NULL;
+		ws->rows_capacity = 0;
+		params->simd = ws;
+	}
+
+	if(tbBytes > ws->tb_capacity) {
+		free(ws->tb);
+		ws->tb = (unsigned char*) malloc(tbBytes);
+		ws->tb_capacity = tbBytes;
 	}
-	params->Ix= (double**) malloc(sizeof(double*) * params->matrix_capacity);
-	for(int i = 0; i < params->matrix_capacity; i++) {
-		params->Ix[i] = (double*) malloc(sizeof(double) * params->matrix_capacity);
+	if(numDiags > ws->diag_capacity) {
+		free(ws->diag_offset);
+		ws->diag_offset = (long*) malloc(sizeof(long) * numDiags);
+		ws->diag_capacity = numDiags;
 	}
-	params->Iy = (double**) malloc(sizeof(double*) * params->matrix_capacity);
-	for(int i = 0; i < params->matrix_capacity; i++) {
-		params->Iy[i] = (double*) malloc(sizeof(double) * params->matrix_capacity);
+	if(rowBytes > ws->rows_capacity) {
+		free(ws->rows);
+		ws->rows = (char*) malloc(rowBytes);
+		ws->rows_capacity = rowBytes;
 	}
 
-	params->tb_dpm = (int**) malloc(sizeof(int*) * params->matrix_capacity);
-	for(int i = 0; i < params->matrix_capacity; i++) {
-		params->tb_dpm[i] = (int*) malloc(sizeof(int) * params->matrix_capacity);
+	if(ws->tb == NULL || ws->diag_offset == NULL || ws->rows == NULL) {
+		fprintf(stderr, "Out of memory at reserveSimdWorkspace()\n");
+		abort();
 	}
-	params->tb_Ix = (int**) malloc(sizeof(int*) * params->matrix_capacity);
-	for(int i = 0; i < params->matrix_capacity; i++) {
-		params->tb_Ix[i] = (int*) malloc(sizeof(int) * params->matrix_capacity);
+
+	return ws;
+}
+
+static
+void _freeLinearRows(NWLinearWorkspace *ws) {
+	for(int k = 0; k < ws->stack_depth; k++) {
+		free(ws->stack[k]);
 	}
-	params->tb_Iy = (int**) malloc(sizeof(int*) * params->matrix_capacity);
-	for(int i = 0; i < params->matrix_capacity; i++) {
-		params->tb_Iy[i] = (int*) malloc(sizeof(int) * params->matrix_capacity);
+	free(ws->stack);
+	free(ws->roll[0]);
+	free(ws->roll[1]);
+	free(ws->last);
+}
+
+NWLinearWorkspace* reserveLinearWorkspace(NWAlignParams *params, int rowCapacity, int depth, long blockBytes) {
+	NWLinearWorkspace *ws = params->linear;
+	if(ws == NULL) {
+		ws = (NWLinearWorkspace*) malloc(sizeof(NWLinearWorkspace));
+		ws->stack = NULL;
+		ws->stack_depth = 0;
+		ws->roll[0] = NULL;
+		ws->roll[1] = NULL;
+		ws->last = NULL;
+		ws->row_capacity = 0;
+		ws->block = NULL;
+		ws->block_capacity = 0;
+		params->linear = ws;
 	}
 
-	return params;
+	if(rowCapacity > ws->row_capacity || depth > ws->stack_depth) {
+		_freeLinearRows(ws);
+		if(rowCapacity < ws->row_capacity) {
+			rowCapacity = ws->row_capacity;
+		}
+		if(depth < ws->stack_depth) {
+			depth = ws->stack_depth;
+		}
+		ws->row_capacity = rowCapacity;
+		ws->stack_depth = depth;
+		ws->stack = (int**) malloc(sizeof(int*) * depth);
+		for(int k = 0; k < depth; k++) {
+			ws->stack[k] = (int*) malloc(sizeof(int) * 3 * rowCapacity);
+		}
+		ws->roll[0] = (int*) malloc(sizeof(int) * 3 * rowCapacity);
+		ws->roll[1] = (int*) malloc(sizeof(int) * 3 * rowCapacity);
+		ws->last = (int*) malloc(sizeof(int) * 3 * rowCapacity);
+		if(ws->stack == NULL || ws->roll[0] == NULL || ws->roll[1] == NULL || ws->last == NULL) {
+			fprintf(stderr, "Out of memory at reserveLinearWorkspace()\n");
+			abort();
+		}
+	}
+	if(blockBytes > ws->block_capacity) {
+		free(ws->block);
+		ws->block = (unsigned char*) malloc(blockBytes);
+		ws->block_capacity = blockBytes;
+		if(ws->block == NULL) {
+			fprintf(stderr, "Out of memory at reserveLinearWorkspace()\n");
+			abort();
+		}
+	}
+
+	return ws;
 }
 
-void nilNWAlignParams(NWAlignParams *params) {
-	for(int i = 0; i < params->matrix_capacity; i++) {
-		free(params->dpm[i]);
-		free(params->Ix[i]);
-		free(params->Iy[i]);
-		free(params->tb_dpm[i]);
-		free(params->tb_Ix[i]);
-		free(params->tb_Iy[i]);
-	}
-	free(params->dpm);
-	free(params->Ix);
-	free(params->Iy);
-	free(params->tb_dpm);
-	free(params->tb_Ix);
-	free(params->tb_Iy);
+NWBandWorkspace* reserveBandWorkspace(NWAlignParams *params, long tbBytes, int rowCapacity) {
+	NWBandWorkspace *ws = params->band;
+	if(ws == NULL) {
+		ws = (NWBandWorkspace*) malloc(sizeof(NWBandWorkspace));
+		ws->tb = NULL;
+		ws->tb_capacity = 0;
+		ws->rows = NULL;
+		ws->rows_capacity = 0;
+		params->band = ws;
+	}
 
-	free(params);
+	if(tbBytes > ws->tb_capacity) {
+		free(ws->tb);
+		ws->tb = (unsigned char*) malloc(tbBytes);
+		ws->tb_capacity = tbBytes;
+	}
+	if(6L * rowCapacity > ws->rows_capacity) {
+		free(ws->rows);
+		ws->rows = (int*) malloc(sizeof(int) * 6 * rowCapacity);
+		ws->rows_capacity = 6L * rowCapacity;
+	}
+
+	if(ws->tb == NULL || ws->rows == NULL) {
+		fprintf(stderr, "Out of memory at reserveBandWorkspace()\n");
+		abort();
+	}
+
+	return ws;
+}
+
+NWBatchWorkspace* reserveBatchWorkspace(NWAlignParams *params, long tbBytes, long rowBytes, int orderCount) {
+	NWBatchWorkspace *ws = params->batch;
+	if(ws == NULL) {
+		ws = (NWBatchWorkspace*) malloc(sizeof(NWBatchWorkspace));
+		ws->tb = NULL;
+		ws->tb_capacity = 0;
+		ws->rows = NULL;
+		ws->rows_capacity = 0;
+		ws->order = NULL;
+		ws->order_capacity = 0;
+		params->batch = ws;
+	}
+
+	if(tbBytes > ws->tb_capacity) {
+		free(ws->tb);
+		ws->tb = (unsigned char*) malloc(tbBytes);
+		ws->tb_capacity = tbBytes;
+	}
+	if(rowBytes > ws->rows_capacity) {
+		free(ws->rows);
+		ws->rows = (char*) malloc(rowBytes);
+		ws->rows_capacity = rowBytes;
+	}
+	if(orderCount > ws->order_capacity) {
+		free(ws->order);
+		ws->order = (int*) malloc(sizeof(int) * orderCount);
+		ws->order_capacity = orderCount;
+	}
+
+	if((ws->tb_capacity > 0 && ws->tb == NULL) || (ws->rows_capacity > 0 && ws->rows == NULL)
+			|| (ws->order_capacity > 0 && ws->order == NULL)) {
+		fprintf(stderr, "Out of memory at reserveBatchWorkspace()\n");
+		abort();
+	}
+
+	return ws;
+}
+
+NWWfaWorkspace* reserveWfaWorkspace(NWAlignParams *params, int scores, long moreOffsets) {
+	NWWfaWorkspace *ws = params->wfa;
+	if(ws == NULL) {
+		ws = (NWWfaWorkspace*) malloc(sizeof(NWWfaWorkspace));
+		ws->offsets = NULL;
+		ws->offsets_capacity = 0;
+		ws->offsets_used = 0;
+		ws->lo = NULL;
+		ws->hi = NULL;
+		ws->base = NULL;
+		ws->score_capacity = 0;
+		params->wfa = ws;
+	}
+
+	if(ws->offsets_used + moreOffsets > ws->offsets_capacity) {
+		long capacity = 2 * ws->offsets_capacity;
+		if(capacity < ws->offsets_used + moreOffsets) {
+			capacity = ws->offsets_used + moreOffsets;
+		}
+		ws->offsets = (int*) realloc(ws->offsets, sizeof(int) * capacity);
+		ws->offsets_capacity = capacity;
+	}
+	if(scores > ws->score_capacity) {
+		int capacity = 2 * ws->score_capacity;
+		if(capacity < scores) {
+			capacity = scores;
+		}
+		ws->lo = (int*) realloc(ws->lo, sizeof(int) * capacity);
+		ws->hi = (int*) realloc(ws->hi, sizeof(int) * capacity);
+		ws->base = (long*) realloc(ws->base, sizeof(long) * capacity);
+		ws->score_capacity = capacity;
+	}
+
+	if(ws->offsets == NULL || ws->lo == NULL || ws->hi == NULL || ws->base == NULL) {
+		fprintf(stderr, "Out of memory at reserveWfaWorkspace()\n");
+		abort();
+	}
+
+	return ws;
+}
+
+NWStatsWorkspace* reserveStatsWorkspace(NWAlignParams *params, long rowBytes) {
+	NWStatsWorkspace *ws = params->stats;
+	if(ws == NULL) {
+		ws = (NWStatsWorkspace*) malloc(sizeof(NWStatsWorkspace));
+		ws->rows = NULL;
+		ws->rows_capacity = 0;
+		params->stats = ws;
+	}
+
+	if(rowBytes > ws->rows_capacity) {
+		free(ws->rows);
+		ws->rows = (char*) malloc(rowBytes);
+		ws->rows_capacity = rowBytes;
+	}
+
+	if(ws->rows == NULL) {
+		fprintf(stderr, "Out of memory at reserveStatsWorkspace()\n");
+		abort();
+	}
+
+	return ws;
 }
 
+NWAnchorWorkspace* reserveAnchorWorkspace(NWAlignParams *params, int seqCapacity, int alignCapacity) {
+	NWAnchorWorkspace *ws = params->anchor;
+	if(ws == NULL) {
+		ws = (NWAnchorWorkspace*) malloc(sizeof(NWAnchorWorkspace));
+		ws->kmers1 = NULL;
+		ws->kmers2 = NULL;
+		ws->match = NULL;
+		ws->blocks = NULL;
+		ws->best = NULL;
+		ws->prev = NULL;
+		ws->chain = NULL;
+		ws->seq_capacity = 0;
+		ws->segment = NULL;
+		params->anchor = ws;
+	}
 
+	if(seqCapacity > ws->seq_capacity) {
+		free(ws->kmers1);
+		free(ws->kmers2);
+		free(ws->match);
+		free(ws->blocks);
+		free(ws->best);
+		free(ws->prev);
+		free(ws->chain);
+		ws->kmers1 = (unsigned long long*) malloc(sizeof(unsigned long long) * seqCapacity);
+		ws->kmers2 = (unsigned long long*) malloc(sizeof(unsigned long long) * seqCapacity);
+		ws->match = (int*) malloc(sizeof(int) * seqCapacity);
+		ws->blocks = (int*) malloc(sizeof(int) * 3 * seqCapacity);
+		ws->best = (long*) malloc(sizeof(long) * seqCapacity);
+		ws->prev = (int*) malloc(sizeof(int) * seqCapacity);
+		ws->chain = (int*) malloc(sizeof(int) * seqCapacity);
+		ws->seq_capacity = seqCapacity;
+	}
+	if(ws->segment == NULL || alignCapacity > ws->segment->capacity) {
+		if(ws->segment != NULL) {
+			nilAlignPair(ws->segment);
+		}
+		ws->segment = constructAlignPair(alignCapacity, 0);
+	}
+
+	if(ws->kmers1 == NULL || ws->kmers2 == NULL || ws->match == NULL || ws->blocks == NULL
+			|| ws->best == NULL || ws->prev == NULL || ws->chain == NULL) {
+		fprintf(stderr, "Out of memory at reserveAnchorWorkspace()\n");
+		abort();
+	}
+
+	return ws;
+}
+
+void nilNWAlignParams(NWAlignParams *params) {
+	if(params->dp != NULL) {
+		free(params->dp->block);
+		free(params->dp);
+	}
+
+	if(params->simd != NULL) {
+		free(params->simd->tb);
+		free(params->simd->diag_offset);
+		free(params->simd->rows);
+		free(params->simd);
+	}
+	if(params->linear != NULL) {
+		_freeLinearRows(params->linear);
+		free(params->linear->block);
+		free(params->linear);
+	}
+	if(params->band != NULL) {
+		free(params->band->tb);
+		free(params->band->rows);
+		free(params->band);
+	}
+	if(params->batch != NULL) {
+		free(params->batch->tb);
+		free(params->batch->rows);
+		free(params->batch->order);
+		free(params->batch);
+	}
+	if(params->wfa != NULL) {
+		free(params->wfa->offsets);
+		free(params->wfa->lo);
+		free(params->wfa->hi);
+		free(params->wfa->base);
+		free(params->wfa);
+	}
+	if(params->stats != NULL) {
+		free(params->stats->rows);
+		free(params->stats);
+	}
+	if(params->anchor != NULL) {
+		free(params->anchor->kmers1);
+		free(params->anchor->kmers2);
+		free(params->anchor->match);
+		free(params->anchor->blocks);
+		free(params->anchor->best);
+		free(params->anchor->prev);
+		free(params->anchor->chain);
+		nilAlignPair(params->anchor->segment);
+		free(params->anchor);
+	}
+
+	free(params);
+}
@@ -3,41 +3,387 @@
 
 #include "stdinc.h"
 
+enum DirectionType { DIR_ERR, DIR_M, DIR_IX, DIR_IY};
+
+//packed traceback byte, one per DP cell:
+//bits 0-1 hold the DirectionType into dpm, bit 2 is set when Ix extends Ix
+//(otherwise it opens from dpm) and bit 3 likewise for Iy
+#define TB_DPM_MASK 3
+#define TB_IX_EXT 4
+#define TB_IY_EXT 8
+
+//direction taken after leaving a cell in direction dirtyp
+static inline int tbNextDirection(unsigned char tb, int dirtyp) {
+	if(dirtyp == DIR_IX) {
+		return ((tb & TB_IX_EXT) ? DIR_IX : DIR_M);
+	}
+	else if(dirtyp == DIR_IY) {
+		return ((tb & TB_IY_EXT) ? DIR_IY : DIR_M);
+	}
+	return (tb & TB_DPM_MASK);
+}
+
 typedef struct {
 	int *align1;
 	int *align2;
 	int len;
 	int capacity;
+	int score; //score of the alignment under the NWAlignParams it was made with
 
 } AlignPair;
 
+//Builds into result the alignment whose path leaves cell (len1,len2) in
+//direction dirtyp and walks back to (0,0).  Every kernel keeps its
+//traceback in its own layout and passes next(i, j, dirtyp): the direction
+//taken after leaving cell (i,j) in direction dirtyp.
+template <typename NextDirection>
+static void tracebackAlign(const NextDirection &next, int *seq1, int len1, int *seq2, int len2,
+		int dirtyp, AlignPair *result) {
+	int *align1 = result->align1;
+	int *align2 = result->align2;
+
+	int align_pos = 0;
+	int i = len1;
+	int j = len2;
+
+	//create the alignment in reverse
+	while( i > 0 || j > 0 ) {
+		if(DEBUG0) {
+			assert(align_pos < result->capacity);
+		}
+		if(dirtyp != DIR_IX && dirtyp != DIR_IY && dirtyp != DIR_M) {
+			if(DEBUG0) {
+				fprintf(stderr, "Error: DIR_ERR found at position (%d,%d) and align_pos %d\n", i,j, align_pos);
+			}
+			abort();
+		}
+		int following = next(i, j, dirtyp);
+
+		if(dirtyp == DIR_IX) {
+			align1[align_pos] = seq1[i-1];
+			align2[align_pos] = GAP_CHAR;
+			i--;
+		}
+		else if(dirtyp == DIR_IY) {
+			align1[align_pos] = GAP_CHAR;
+			align2[align_pos] = seq2[j-1];
+			j--;
+		}
+		else {
+			align1[align_pos] = seq1[i-1];
+			align2[align_pos] = seq2[j-1];
+			i--;
+			j--;
+		}
+
+		dirtyp = following;
+		align_pos++;
+	}
+
+	//reverse the alignment
+	for(int left = 0, right = align_pos-1; left < right; left++, right--) {
+		int temp = align1[left];
+		align1[left] = align1[right];
+		align1[right] = temp;
+		temp = align2[left];
+		align2[left] = align2[right];
+		align2[right] = temp;
+	}
+
+	result->len = align_pos;
+}
+
+//what the PIDs of an alignment are computed from
+typedef struct {
+	int score;
+	int alignlen;
+	int identities;
+	int nongap; //columns without GAP_CHAR
+} NWPairCounts;
+
+//scoring presets as match, mismatch, gapopen, gapext
+#define NW_SCORING_BLASTN 1, -2, -5, -2
+#define NW_SCORING_MATLAB 5, -4, -8, -8 //NUC44 and a linear gap of 8
+
+//a scoring scheme selectable with -scoring
+typedef struct {
+	const char *name;
+	int match;
+	int mismatch;
+	int gapopen;
+	int gapext;
+} NWScoring;
+
+//finite stand-ins for -INFINITY; half the type range leaves headroom for
+//the few additions a sentinel cell receives before it loses every max()
+#define NW_NEG_INF32 (INT_MIN / 2)
+#define NW_NEG_INF16 (SHRT_MIN / 2)
+
+//score rows and traceback of the full-matrix kernels (nwalign(),
+//nwalignPidClass(), nwalignLinearGap()) in one 64-byte aligned block laid
+//out for the current pair, grown geometrically on demand
+typedef struct {
+	char *block;
+	long capacity;
+	long peak; //most bytes one pair has used
+	char *rows; //score rows, start of the block
+	unsigned char *tb; //packed traceback, (len1+1) rows of tb_stride bytes
+	long tb_stride; //len2 + 1 of the current pair
+} NWDpWorkspace;
+
+//anti-diagonal buffers of the SIMD kernel, grown on demand
+typedef struct {
+	unsigned char *tb; //interior cells, one anti-diagonal after another
+	long tb_capacity;
+	long *diag_offset; //start of each anti-diagonal in tb
+	int diag_capacity;
+	char *rows; //scores of three anti-diagonals and lane-typed sequences
+	long rows_capacity;
+} NWSimdWorkspace;
+
+//score rows and traceback block of nwalignLinear(), grown on demand
+typedef struct {
+	int **stack; //one score row (dpm, Ix, Iy) per recursion level
+	int stack_depth;
+	int *roll[2];
+	int *last;
+	int row_capacity; //entries per matrix in each score row
+	unsigned char *block; //packed traceback of the segment being traced
+	long block_capacity;
+} NWLinearWorkspace;
+
+//traceback band and score rows of nwalignBanded(), grown on demand
+typedef struct {
+	unsigned char *tb; //(len1+1) rows of band-width bytes
+	long tb_capacity;
+	int *rows; //dpm, Ix, Iy of the previous and the current row
+	long rows_capacity;
+} NWBandWorkspace;
+
+//traceback, score rows and target order of nwalignBatch(), grown on demand
+typedef struct {
+	unsigned char *tb; //len1 by width cells, the lanes of each cell side by side
+	long tb_capacity;
+	char *rows; //lane-typed score rows and transposed targets
+	long rows_capacity;
+	int *order; //targets sorted by length
+	int order_capacity;
+} NWBatchWorkspace;
+
+//how much work nwalignBatch() did over a run
+typedef struct {
+	long batches;
+	long pairs; //pairs aligned in SIMD lanes
+	double cells; //DP cells the batched pairs needed
+	double laneCells; //DP cells computed, counting padding and idle lanes
+} NWBatchStats;
+
+//wavefronts of nwalignWfa() for every penalty of the current pair, grown
+//on demand (contents are kept when growing)
+typedef struct {
+	int *offsets; //M, I and D offsets of each wavefront, one after another
+	long offsets_capacity;
+	long offsets_used;
+	int *lo; //diagonal range of the wavefront of each penalty
+	int *hi;
+	long *base; //start of its M offsets, -1 if nothing has that penalty
+	int score_capacity;
+} NWWfaWorkspace;
+
+//how much work nwalignWfa() did over a run
+typedef struct {
+	long pairs; //pairs aligned by wavefronts
+	long fallback; //pairs too divergent, aligned by nwalign() instead
+	double penalty; //WFA penalties of the aligned pairs
+	double offsets; //wavefront offsets computed for them
+	double cells; //DP cells nwalign() would have filled for them
+} NWWfaStats;
+
+//score and path-count rows (or anti-diagonals) of nwalignCounts(), grown
+//on demand
+typedef struct {
+	char *rows;
+	long rows_capacity;
+} NWStatsWorkspace;
+
+//k-mers, blocks and segment alignment of nwalignAnchored(), grown on demand
+typedef struct {
+	unsigned long long *kmers1; //(k-mer << 32 | position), sorted
+	unsigned long long *kmers2;
+	int *match; //unique seq2 match of each seq1 k-mer
+	int *blocks; //(i, j, len) of each exact block
+	long *best; //chain weight ending at each block
+	int *prev;
+	int *chain;
+	int seq_capacity;
+	AlignPair *segment; //alignment of one inter-anchor segment
+} NWAnchorWorkspace;
+
+//how much work nwalignAnchored() did over a run
+typedef struct {
+	long pairs; //pairs aligned through anchors
+	long fallback; //pairs with too little anchor coverage, aligned in full
+	double anchored; //bases inside chained anchors
+	double cells; //DP cells filled, fallbacks included
+	double fullCells; //DP cells nwalign() would have filled
+} NWAnchorStats;
+
+//how much work nwalignBanded() did over a run
+typedef struct {
+	long pairs;
+	long widened; //pairs that needed more than the initial band
+	long full; //pairs whose band grew to the whole matrix
+	long passes; //band fills over all pairs
+	double cells; //DP cells filled
+	double fullCells; //DP cells nwalign() would have filled
+} NWBandStats;
+
+//outcome of nwalignPidClass()
+enum PidClass { PID_BELOW, PID_ABOVE};
+
+//how nwalignPidClass() decided its pairs over a run
+typedef struct {
+	long pairs;
+	long above;
+	long decidedInDp; //pairs ruled out by the score bound before the last row
+	double rowsFilled; //DP rows filled
+	double rows; //DP rows nwalign() would have filled
+	long traced; //pairs that reached the traceback
+	double tracebackSteps; //traceback steps walked before the answer was known
+} NWPidClassStats;
+
 typedef struct {
 	int match;
 	int mismatch;
 	int gapopen;
 	int gapext;
 
-	double **dpm; //capacity by capacity
-	double **Ix; //capacity by capacity
-	double **Iy; //capacity by capacity
-	int **tb_dpm;
-	int **tb_Ix;
-	int **tb_Iy;
-	int matrix_capacity; //seq_maxlen + 1 because 0 positions are for no alignment
+	int matrix_capacity; //seq_maxlen + 1: longest pairs the full-matrix kernels take
+	bool hugePages; //ask for transparent huge pages on large workspaces
+
+	NWDpWorkspace *dp; //NULL until a full-matrix kernel is first called
+	NWSimdWorkspace *simd; //NULL until nwalignSimd() is first called
+	NWLinearWorkspace *linear; //NULL until nwalignLinear() is first called
+	NWBandWorkspace *band; //NULL until nwalignBanded() is first called
+	NWBatchWorkspace *batch; //NULL until nwalignBatch() is first called
+	NWWfaWorkspace *wfa; //NULL until nwalignWfa() is first called
+	NWAnchorWorkspace *anchor; //NULL until nwalignAnchored() is first called
+	NWStatsWorkspace *stats; //NULL until nwalignCounts() is first called
 
 } NWAlignParams;
 
 //return aligned sequence-pair
 extern void nwalign(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, AlignPair* result);
 
+//anti-diagonal SSE4.1/AVX2 version of nwalign(); gives the same alignment
+//and falls back to nwalign() when the CPU has neither instruction set
+extern void nwalignSimd(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, AlignPair* result);
+extern const char* nwalignSimdName();
+
+//one query against count targets, several targets at a time in the SIMD
+//lanes; results[k] gets the nwalign() alignment of seq1 and seqs2[k].
+//Falls back to nwalign() per target when the CPU has no SSE4.1; stats may
+//be NULL
+extern void nwalignBatch(NWAlignParams*, int *seq1, int len1, int **seqs2, int *lens2, int count,
+		AlignPair **results, NWBatchStats *stats);
+//targets per batch with int16 scores on this CPU
+extern int nwalignBatchLanes();
+
+//gap-affine wavefront version of nwalign(), O((len1+len2) s) time for an
+//alignment penalty s: gives an alignment with the same score (possibly a
+//different co-optimal one) and falls back to nwalign() for divergent pairs;
+//stats may be NULL
+extern void nwalignWfa(NWAlignParams*, int *seq1, int len1, int *seq2, int len2,
+		AlignPair* result, NWWfaStats *stats);
+
+//score, length, identities and non-gap columns of the nwalign() alignment
+//without building it: memory linear in the lengths, no traceback and no
+//matrix_capacity limit
+extern void nwalignCounts(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result);
+
+//Single-matrix versions of nwalign() and nwalignCounts() for linear gap
+//scoring (see nwLinearGapScoring()): give an alignment with the same score
+//as nwalign(), possibly a different co-optimal one, at a third of the
+//work.  Ties prefer a gap in seq2, then one in seq1, then a pair, as in
+//nwalign().  nwalignLinearGapCounts() gives the counts of the
+//nwalignLinearGap() alignment
+extern void nwalignLinearGap(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, AlignPair* result);
+extern void nwalignLinearGapCounts(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result);
+
+//k-mer anchored version of nwalign(): chains exact blocks of k-mers unique
+//in both sequences and runs the DP only between them, unless they cover
+//less than minCoverage of the shorter sequence.  The alignment is optimal
+//among those through the anchors, not necessarily overall; stats may be NULL
+extern void nwalignAnchored(NWAlignParams*, int k, double minCoverage, int *seq1, int len1, int *seq2, int len2,
+		AlignPair* result, NWAnchorStats *stats);
+
+//divide-and-conquer version of nwalign() in O(len2 * log(len1)) memory;
+//gives the same alignment and has no matrix_capacity limit
+extern void nwalignLinear(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, AlignPair* result);
+
+//banded version of nwalign(): starts margin diagonals around the length
+//difference and doubles the band until its optimum provably matches the
+//full matrix, so the alignment is the same; stats may be NULL
+extern void nwalignBanded(NWAlignParams*, int margin, int *seq1, int len1, int *seq2, int len2,
+		AlignPair* result, NWBandStats *stats);
+
+//Tells whether the PID of the nwalign() alignment reaches threshold, over
+//alignment-length or over non-gap columns if overNongap, without building
+//the alignment: the DP stops once a score bound rules the threshold out and
+//the traceback once the rest of the path cannot change the answer.
+//Returns PID_ABOVE (PID >= threshold) or PID_BELOW; stats may be NULL
+extern int nwalignPidClass(NWAlignParams*, int *seq1, int len1, int *seq2, int len2,
+		double threshold, bool overNongap, NWPidClassStats *stats);
+
+//grows params->simd to at least the given sizes (used by nwalign_simd.c)
+extern NWSimdWorkspace* reserveSimdWorkspace(NWAlignParams *params, long tbBytes, int numDiags, long rowBytes);
+//grows params->batch likewise (used by nwalign_batch.c)
+extern NWBatchWorkspace* reserveBatchWorkspace(NWAlignParams *params, long tbBytes, long rowBytes, int orderCount);
+//grows params->wfa to at least the given number of penalties and room for
+//moreOffsets offsets past offsets_used (used by nwalign_wfa.c)
+extern NWWfaWorkspace* reserveWfaWorkspace(NWAlignParams *params, int scores, long moreOffsets);
+//grows params->stats to at least rowBytes (used by nwalign_stats.c and
+//nwalign_simd.c)
+extern NWStatsWorkspace* reserveStatsWorkspace(NWAlignParams *params, long rowBytes);
+//grows params->anchor to sequences of seqCapacity and alignments of
+//alignCapacity (used by nwalign_anchor.c)
+extern NWAnchorWorkspace* reserveAnchorWorkspace(NWAlignParams *params, int seqCapacity, int alignCapacity);
+//grows params->linear likewise (used by nwalign_linear.c)
+extern NWLinearWorkspace* reserveLinearWorkspace(NWAlignParams *params, int rowCapacity, int depth, long blockBytes);
+//grows params->band likewise (used by nwalign_band.c)
+extern NWBandWorkspace* reserveBandWorkspace(NWAlignParams *params, long tbBytes, int rowCapacity);
+//lays params->dp out for a len1 x len2 pair: rowBytes of score rows, then
+//the traceback (used by nwalign_lingap.c)
+extern NWDpWorkspace* reserveDpWorkspace(NWAlignParams *params, long rowBytes, int len1, int len2);
+
 extern AlignPair* constructAlignPair(int len1, int len2);
 extern void nilAlignPair(AlignPair *alignPair);
 
 extern NWAlignParams* constructNWAlignParams(int match, int mismatch, int gapopen, int gapext, int seq_maxlen);
 extern void nilNWAlignParams(NWAlignParams *params);
 
+//the presets, then an entry with a NULL name
+extern const NWScoring nwScoringPresets[];
+//preset called name, NULL if none
+extern const NWScoring* findNWScoring(const char *name);
+//true if gaps cost the same per column wherever they start and a pair of
+//opposite gap columns never beats a mismatch, so that one matrix gives the
+//nwalign() score
+extern bool nwLinearGapScoring(int mismatch, int gapopen, int gapext);
+
+//true if every score of a len1 x len2 alignment fits the int16 kernel
+extern bool nwScoreFitsInt16(int match, int mismatch, int gapopen, int gapext, int len1, int len2);
+//true if every score of a len1 x len2 alignment fits the int32 kernels,
+//which have no overflow check of their own
+extern bool nwScoreFitsInt32(int match, int mismatch, int gapopen, int gapext, int len1, int len2);
+
 //defined as number of identities divded by number of non-gap aligned characters
 extern double computePidOverNongap(int *align1, int *align2, int len);
 extern double computePidOverAlignlen(int *align1, int *align2, int len);
+//counts of the alignment in pair
+extern void computePairCounts(AlignPair *pair, NWPairCounts *counts);
+//same values as computePidOver*() from the counts of an alignment
+extern double countsPidOverNongap(const NWPairCounts *counts);
+extern double countsPidOverAlignlen(const NWPairCounts *counts);
 
 #endif
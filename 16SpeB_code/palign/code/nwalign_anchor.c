@@ -0,0 +1,233 @@
+//Anchored version of nwalign() for pairs sharing long exact runs.
+//
+//k-mers occurring exactly once in each sequence are matched, matches on the
+//same diagonal at consecutive positions are merged into exact blocks, and
+//the colinear, non-overlapping chain of blocks covering the most bases is
+//kept.  Only the segments between consecutive blocks (and before the first
+//and after the last) are aligned with the affine DP; each segment starts
+//like a whole alignment, in dpm with score 0, which is exact because the
+//block before it ends on a match.  The segment alignments and the block
+//matches are stitched into one AlignPair whose score is the sum of the
+//pieces.
+//
+//The result is the best alignment through the chosen anchors, which is
+//usually but not necessarily the nwalign() alignment.  When the chain
+//covers too little of the shorter sequence the pair is aligned in full.
+
+#include "nwalign.h"
+
+//k-mers of at most 16 bases fit a 32-bit key
+static const int NW_ANCHOR_MAX_K = 16;
+
+typedef unsigned long long AnchorKmer;
+
+static
+int _cmp_kmer(const void *a, const void *b) {
+	AnchorKmer x = *(const AnchorKmer*) a;
+	AnchorKmer y = *(const AnchorKmer*) b;
+	return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+//(key << 32 | position) of every k-mer without GAP_CHAR, sorted; returns
+//how many there are
+static
+int _collect_kmers(int *seq, int len, int k, AnchorKmer *kmers) {
+	int count = 0;
+	unsigned int key = 0;
+	unsigned int mask = (k == NW_ANCHOR_MAX_K ? 0xFFFFFFFFu : (1u << (2 * k)) - 1);
+	int valid = 0; //length of the run without GAP_CHAR ending here
+	for(int i = 0; i < len; i++) {
+		if(seq[i] == GAP_CHAR) {
+			valid = 0;
+			continue;
+		}
+		key = ((key << 2) | (unsigned int) seq[i]) & mask;
+		valid++;
+		if(valid >= k) {
+			kmers[count++] = ((AnchorKmer) key << 32) | (unsigned int) (i - k + 1);
+		}
+	}
+	qsort(kmers, count, sizeof(AnchorKmer), _cmp_kmer);
+	return count;
+}
+
+//advances to the next key occurring once; returns false at the end
+static inline
+bool _next_unique(const AnchorKmer *kmers, int count, int &pos) {
+	while(pos < count) {
+		int end = pos + 1;
+		while(end < count && (kmers[end] >> 32) == (kmers[pos] >> 32)) {
+			end++;
+		}
+		if(end == pos + 1) {
+			return true;
+		}
+		pos = end;
+	}
+	return false;
+}
+
+//unique shared k-mers as blocks (i, j, len) merged along diagonals;
+//returns the number of blocks
+static
+int _find_blocks(NWAnchorWorkspace *ws, int len1, int n1, int n2, int k) {
+	int *blocks = ws->blocks;
+	int *match = ws->match; //seq2 position of each seq1 position's unique match, or -1
+	for(int i = 0; i < len1; i++) {
+		match[i] = -1;
+	}
+
+	int p1 = 0, p2 = 0;
+	while(_next_unique(ws->kmers1, n1, p1) && _next_unique(ws->kmers2, n2, p2)) {
+		AnchorKmer key1 = ws->kmers1[p1] >> 32;
+		AnchorKmer key2 = ws->kmers2[p2] >> 32;
+		if(key1 < key2) {
+			p1++;
+		}
+		else if(key2 < key1) {
+			p2++;
+		}
+		else {
+			match[ws->kmers1[p1] & 0xFFFFFFFFu] = (int) (ws->kmers2[p2] & 0xFFFFFFFFu);
+			p1++;
+			p2++;
+		}
+	}
+
+	//consecutive k-mers on one diagonal become one block
+	int count = 0;
+	for(int i = 0; i < len1; i++) {
+		if(match[i] < 0) {
+			continue;
+		}
+		if(count > 0) {
+			int *last = blocks + 3 * (count - 1);
+			if(match[i] - i == last[1] - last[0] && i <= last[0] + last[2] - k + 1) {
+				last[2] = i + k - last[0];
+				continue;
+			}
+		}
+		int *b = blocks + 3 * count;
+		b[0] = i;
+		b[1] = match[i];
+		b[2] = k;
+		count++;
+	}
+	return count;
+}
+
+//heaviest chain of blocks increasing and non-overlapping in both sequences
+//(blocks are sorted by i); writes it to ws->chain and returns its length
+static
+int _chain_blocks(NWAnchorWorkspace *ws, int count, long &covered) {
+	const int *blocks = ws->blocks;
+	long *best = ws->best;
+	int *prev = ws->prev;
+	int top = -1;
+	for(int b = 0; b < count; b++) {
+		best[b] = blocks[3*b + 2];
+		prev[b] = -1;
+		for(int a = 0; a < b; a++) {
+			if(blocks[3*a] + blocks[3*a + 2] <= blocks[3*b]
+					&& blocks[3*a + 1] + blocks[3*a + 2] <= blocks[3*b + 1]
+					&& best[a] + blocks[3*b + 2] > best[b]) {
+				best[b] = best[a] + blocks[3*b + 2];
+				prev[b] = a;
+			}
+		}
+		if(top < 0 || best[b] > best[top]) {
+			top = b;
+		}
+	}
+
+	covered = (top < 0 ? 0 : best[top]);
+	int n = 0;
+	for(int b = top; b >= 0; b = prev[b]) {
+		n++;
+	}
+	int pos = n;
+	for(int b = top; b >= 0; b = prev[b]) {
+		ws->chain[--pos] = b;
+	}
+	return n;
+}
+
+//aligns seq1[0..len1) with seq2[0..len2) and appends it to result
+static
+void _append_segment(NWAlignParams *params, NWAnchorWorkspace *ws, int *seq1, int len1, int *seq2, int len2,
+		AlignPair *result, double &cells) {
+	AlignPair *seg = ws->segment;
+	if(len1 < params->matrix_capacity && len2 < params->matrix_capacity) {
+		nwalign(params, seq1, len1, seq2, len2, seg);
+	}
+	else {
+		nwalignLinear(params, seq1, len1, seq2, len2, seg);
+	}
+	memcpy(result->align1 + result->len, seg->align1, sizeof(int) * seg->len);
+	memcpy(result->align2 + result->len, seg->align2, sizeof(int) * seg->len);
+	result->len += seg->len;
+	result->score += seg->score;
+	cells += (len1 + 1.0) * (len2 + 1.0);
+}
+
+void nwalignAnchored(NWAlignParams *params, int k, double minCoverage, int *seq1, int len1, int *seq2, int len2,
+		AlignPair* result, NWAnchorStats *stats) {
+	if(k > NW_ANCHOR_MAX_K) {
+		k = NW_ANCHOR_MAX_K;
+	}
+	int maxlen = (len1 > len2 ? len1 : len2);
+	NWAnchorWorkspace *ws = reserveAnchorWorkspace(params, maxlen + 1, len1 + len2);
+
+	int n1 = _collect_kmers(seq1, len1, k, ws->kmers1);
+	int n2 = _collect_kmers(seq2, len2, k, ws->kmers2);
+	int count = _find_blocks(ws, len1, n1, n2, k);
+	long covered = 0;
+	int chainLen = _chain_blocks(ws, count, covered);
+
+	int shorter = (len1 < len2 ? len1 : len2);
+	double fullCells = (len1 + 1.0) * (len2 + 1.0);
+	if(chainLen == 0 || covered < minCoverage * shorter) {
+		if(len1 < params->matrix_capacity && len2 < params->matrix_capacity) {
+			nwalign(params, seq1, len1, seq2, len2, result);
+		}
+		else {
+			nwalignLinear(params, seq1, len1, seq2, len2, result);
+		}
+		if(stats != NULL) {
+			stats->fallback++;
+			stats->cells += fullCells;
+			stats->fullCells += fullCells;
+		}
+		return;
+	}
+
+	result->len = 0;
+	result->score = 0;
+	double cells = 0;
+	int i = 0, j = 0;
+	for(int c = 0; c < chainLen; c++) {
+		const int *b = ws->blocks + 3 * ws->chain[c];
+		_append_segment(params, ws, seq1 + i, b[0] - i, seq2 + j, b[1] - j, result, cells);
+		for(int p = 0; p < b[2]; p++) {
+			result->align1[result->len] = seq1[b[0] + p];
+			result->align2[result->len] = seq2[b[1] + p];
+			result->len++;
+		}
+		result->score += b[2] * params->match;
+		i = b[0] + b[2];
+		j = b[1] + b[2];
+	}
+	_append_segment(params, ws, seq1 + i, len1 - i, seq2 + j, len2 - j, result, cells);
+
+	if(DEBUG1) {
+		fprintf(stderr, "anchored: %d blocks, %d chained, %ld bases, %.0lf of %.0lf cells\n",
+				count, chainLen, covered, cells, fullCells);
+	}
+
+	if(stats != NULL) {
+		stats->pairs++;
+		stats->anchored += covered;
+		stats->cells += cells;
+		stats->fullCells += fullCells;
+	}
+}
@@ -0,0 +1,231 @@
+//Banded version of nwalign() for similar sequences.
+//
+//Only diagonals k = j - i in [min(0,delta) - w, max(0,delta) + w] are
+//filled, where delta = len2 - len1 and w starts at the margin.  A path
+//that visits diagonal k has at least |k| + |delta - k| gap characters in
+//at least two runs, which caps its score; if the banded optimum beats that
+//cap strictly, every path scoring as well as the optimum lies in the band,
+//so the traceback (ties included) is the one of the full matrix.
+//Otherwise w is doubled, until the band covers the whole matrix.
+
+#include "nwalign.h"
+
+static inline
+int _imax(int a, int b) {
+	return (a > b ? a : b);
+}
+
+static inline
+int _imin(int a, int b) {
+	return (a < b ? a : b);
+}
+
+//Upper bound on the score of any alignment with at least gmin gap
+//characters (in at least two gap runs).
+static
+long _out_of_band_bound(NWAlignParams *params, int len1, int len2, int gmin) {
+	int pairScore = _imax(params->match, params->mismatch);
+	long best = LONG_MIN;
+	for(int g = gmin; g <= len1 + len2; g += 2) {
+		long aligned = (len1 + len2 - g) / 2;
+		if(aligned > _imin(len1, len2)) {
+			continue;
+		}
+		long gaps;
+		if(params->gapopen <= params->gapext) {
+			gaps = 2L * params->gapopen + (long) (g - 2) * params->gapext;
+		}
+		else {
+			gaps = (long) g * params->gapopen;
+		}
+		long bound = aligned * pairScore + gaps;
+		if(bound > best) {
+			best = bound;
+		}
+	}
+	return best;
+}
+
+//one pass with diagonals klo..khi; returns the best score at (len1, len2),
+//sets dirtyp to the starting direction of the traceback and adds the
+//number of cells filled to cells
+static
+int _fill_band(NWAlignParams *params, NWBandWorkspace *ws, int *seq1, int len1, int *seq2, int len2,
+		int klo, int khi, int &dirtyp, double &cells) {
+	const int match = params->match;
+	const int mismatch = params->mismatch;
+	const int gapopen = params->gapopen;
+	const int gapext = params->gapext;
+	const int width = khi - klo + 1;
+	const int rowcap = len2 + 2;
+
+	int *dpm_up = ws->rows;
+	int *Ix_up = ws->rows + rowcap;
+	int *Iy_up = ws->rows + 2 * rowcap;
+	int *dpm_cur = ws->rows + 3 * rowcap;
+	int *Ix_cur = ws->rows + 4 * rowcap;
+	int *Iy_cur = ws->rows + 5 * rowcap;
+
+	//row 0, plus a sentinel right of the band for row 1
+	int jhi = _imin(len2, khi);
+	dpm_up[0] = 0;
+	Ix_up[0] = NW_NEG_INF32;
+	Iy_up[0] = NW_NEG_INF32;
+	for(int j = 1; j <= jhi; j++) {
+		dpm_up[j] = NW_NEG_INF32;
+		Ix_up[j] = NW_NEG_INF32;
+		Iy_up[j] = gapopen + (j-1) * gapext;
+	}
+	dpm_up[jhi+1] = Ix_up[jhi+1] = Iy_up[jhi+1] = NW_NEG_INF32;
+	cells += jhi + 1;
+
+	for(int i = 1; i < len1 + 1; i++) {
+		const int c1 = seq1[i-1];
+		int jlo = _imax(0, i + klo);
+		jhi = _imin(len2, i + khi);
+		unsigned char *tb = ws->tb + (long) i * width;
+		const int off = i + klo; //column of the first band cell
+
+		if(jlo == 0) {
+			dpm_cur[0] = NW_NEG_INF32;
+			Ix_cur[0] = gapopen + (i-1) * gapext;
+			Iy_cur[0] = NW_NEG_INF32;
+			tb[0 - off] = DIR_ERR | (i == 1 ? 0 : TB_IX_EXT);
+			jlo = 1;
+		}
+		else {
+			dpm_cur[jlo-1] = Ix_cur[jlo-1] = Iy_cur[jlo-1] = NW_NEG_INF32;
+		}
+
+		for(int j = jlo; j <= jhi; j++) {
+			int s = (c1 == seq2[j-1] ? match : mismatch);
+			unsigned char cell;
+
+			int m_val = dpm_up[j-1] + s;
+			int ix_val = Ix_up[j-1] + s;
+			int iy_val = Iy_up[j-1] + s;
+			if(ix_val >= m_val && ix_val >= iy_val) {
+				dpm_cur[j] = ix_val;
+				cell = DIR_IX;
+			}
+			else if(iy_val >= m_val && iy_val >= ix_val) {
+				dpm_cur[j] = iy_val;
+				cell = DIR_IY;
+			}
+			else {
+				dpm_cur[j] = m_val;
+				cell = DIR_M;
+			}
+
+			m_val = dpm_up[j] + gapopen;
+			ix_val = Ix_up[j] + gapext;
+			if(ix_val >= m_val) {
+				Ix_cur[j] = ix_val;
+				cell |= TB_IX_EXT;
+			}
+			else {
+				Ix_cur[j] = m_val;
+			}
+
+			m_val = dpm_cur[j-1] + gapopen;
+			iy_val = Iy_cur[j-1] + gapext;
+			if(iy_val >= m_val) {
+				Iy_cur[j] = iy_val;
+				cell |= TB_IY_EXT;
+			}
+			else {
+				Iy_cur[j] = m_val;
+			}
+
+			tb[j - off] = cell;
+		}
+		cells += jhi - jlo + 1;
+		//the next row reads one column past this row's band
+		dpm_cur[jhi+1] = Ix_cur[jhi+1] = Iy_cur[jhi+1] = NW_NEG_INF32;
+
+		int *tmp;
+		tmp = dpm_up; dpm_up = dpm_cur; dpm_cur = tmp;
+		tmp = Ix_up; Ix_up = Ix_cur; Ix_cur = tmp;
+		tmp = Iy_up; Iy_up = Iy_cur; Iy_cur = tmp;
+	}
+
+	//starting direction/matrix, same order as traceback_align()
+	int m = dpm_up[len2], ix = Ix_up[len2], iy = Iy_up[len2];
+	if(ix >= iy && ix >= m) {
+		dirtyp = DIR_IX;
+		return ix;
+	}
+	else if(iy >= ix && iy >= m) {
+		dirtyp = DIR_IY;
+		return iy;
+	}
+	dirtyp = DIR_M;
+	return m;
+}
+
+//next direction when leaving cell (i,j) of the band in direction dirtyp;
+//row 0 is not stored, column 0 is
+struct BandNextDirection {
+	const unsigned char *tb;
+	int klo;
+	int width;
+	inline int operator()(int i, int j, int dirtyp) const {
+		if(i == 0) {
+			return (dirtyp == DIR_IY ? (j == 1 ? DIR_M : DIR_IY) : DIR_ERR);
+		}
+		return tbNextDirection(tb[(long) i * width + (j - i - klo)], dirtyp);
+	}
+};
+
+void nwalignBanded(NWAlignParams *params, int margin, int *seq1, int len1, int *seq2, int len2,
+		AlignPair* result, NWBandStats *stats) {
+	int delta = len2 - len1;
+	int w = _imax(margin, 1);
+	int passes = 0;
+	double cells = 0;
+
+	while(true) {
+		int klo = _imax(_imin(0, delta) - w, -len1);
+		int khi = _imin(_imax(0, delta) + w, len2);
+		int width = khi - klo + 1;
+		NWBandWorkspace *ws = reserveBandWorkspace(params, (long) (len1 + 1) * width, len2 + 2);
+
+		int dirtyp;
+		int score = _fill_band(params, ws, seq1, len1, seq2, len2, klo, khi, dirtyp, cells);
+		passes++;
+
+		//fewest gap characters of a path leaving the band on either side
+		bool isFull = (klo == -len1 && khi == len2);
+		bool isExact = isFull;
+		if(!isFull) {
+			int gmin = INT_MAX;
+			if(khi < len2) {
+				gmin = _imin(gmin, 2 * (khi + 1) - delta);
+			}
+			if(klo > -len1) {
+				gmin = _imin(gmin, delta - 2 * (klo - 1));
+			}
+			isExact = (score > _out_of_band_bound(params, len1, len2, gmin));
+		}
+
+		if(DEBUG1) {
+			fprintf(stderr, "band [%d,%d] score=%d exact=%d\n", klo, khi, score, (int) isExact);
+		}
+
+		if(isExact) {
+			BandNextDirection next = {ws->tb, klo, width};
+			tracebackAlign(next, seq1, len1, seq2, len2, dirtyp, result);
+			result->score = score;
+			if(stats != NULL) {
+				stats->pairs++;
+				stats->passes += passes;
+				stats->widened += (passes > 1 ? 1 : 0);
+				stats->full += (isFull ? 1 : 0);
+				stats->cells += cells;
+				stats->fullCells += (double) (len1 + 1) * (len2 + 1);
+			}
+			return;
+		}
+		w *= 2;
+	}
+}
@@ -0,0 +1,226 @@
+//Inter-sequence (SWIPE-style) version of nwalign(): one query against a
+//batch of targets, one target per SIMD lane.
+//
+//Every lane runs the row-major fill of _nwfill() on its own target, so the
+//vector loop has no dependency between lanes and needs no shuffles; targets
+//are stored transposed (position j of every lane next to each other) and
+//the query residue of row i is broadcast.  Targets are sorted by length and
+//batched in that order, so lanes of one batch differ little in length and
+//the cells computed past a short lane's end stay few.  Each lane keeps its
+//own packed traceback bytes (interleaved with the other lanes) and is traced
+//back on its own from (len1, len2 of the lane); comparisons and their order
+//are those of _nwfill(), so every alignment is the one of nwalign().
+//
+//This file is compiled once per instruction set (see nwalign_vec.h).
+
+#include "nwalign.h"
+#include "nwalign_vec.h"
+
+static inline
+int _imin(int a, int b) {
+	return (a < b ? a : b);
+}
+
+//batches whose traceback would exceed this many bytes are not batched
+static const long NW_BATCH_TB_BYTES = 1L << 28;
+
+//target residue of lanes past the end of their sequence
+static const int NW_BATCH_PAD = -1;
+
+//next direction when leaving cell (i,j) of lane in direction dirtyp;
+//the row-0 and column-0 rules are those set up by _nwfill()
+static inline
+int _next_direction(const unsigned char *tb, int lanes, long width, int lane, int i, int j, int dirtyp) {
+	if(i == 0) {
+		return (dirtyp == DIR_IY ? (j == 1 ? DIR_M : DIR_IY) : DIR_ERR);
+	}
+	if(j == 0) {
+		return (dirtyp == DIR_IX ? (i == 1 ? DIR_M : DIR_IX) : DIR_ERR);
+	}
+	return tbNextDirection(tb[((i-1) * width + (j-1)) * lanes + lane], dirtyp);
+}
+
+struct LaneNextDirection {
+	const unsigned char *tb;
+	int lanes;
+	long width;
+	int lane;
+	inline int operator()(int i, int j, int dirtyp) const {
+		return _next_direction(tb, lanes, width, lane, i, j, dirtyp);
+	}
+};
+
+//aligns seq1 against the count <= LANES targets idx[0..count-1], all no
+//longer than width
+template <typename T>
+static
+void _nwalign_lanes(NWAlignParams *params, int *seq1, int len1, int **seqs2, int *lens2,
+		const int *idx, int count, int width, T negInf, AlignPair **results, NWBatchStats *stats) {
+	typedef VecOps<T> V;
+	const int LANES = V::LANES;
+
+	//workspace: 6 score rows (M, Ix, Iy of the previous and the current
+	//row) and the transposed targets, each position a vector of lanes
+	long rowlen = (long) (width + 1) * LANES;
+	long tbBytes = (long) len1 * width * LANES + VBYTES;
+	NWBatchWorkspace *ws = reserveBatchWorkspace(params, tbBytes, sizeof(T) * (6 * rowlen + width * LANES), 0);
+
+	T *rows = (T*) ws->rows;
+	T *M_up = rows, *X_up = rows + rowlen, *Y_up = rows + 2 * rowlen;
+	T *M_cur = rows + 3 * rowlen, *X_cur = rows + 4 * rowlen, *Y_cur = rows + 5 * rowlen;
+	T *tt = rows + 6 * rowlen;
+	for(int j = 0; j < width; j++) {
+		for(int lane = 0; lane < LANES; lane++) {
+			int k = (lane < count ? idx[lane] : -1);
+			tt[j * LANES + lane] = (T) (k >= 0 && j < lens2[k] ? seqs2[k][j] : NW_BATCH_PAD);
+		}
+	}
+
+	const vec_t matchv = V::set1(params->match);
+	const vec_t mismatchv = V::set1(params->mismatch);
+	const vec_t openv = V::set1(params->gapopen);
+	const vec_t extv = V::set1(params->gapext);
+	const vec_t negv = V::set1(negInf);
+	const vec_t dirM = V::set1(DIR_M);
+	const vec_t dirIX = V::set1(DIR_IX);
+	const vec_t dirIY = V::set1(DIR_IY);
+	const vec_t bitIX = V::set1(TB_IX_EXT);
+	const vec_t bitIY = V::set1(TB_IY_EXT);
+
+	//initialize row 0
+	V_STORE(M_up, V::set1(0));
+	V_STORE(X_up, negv);
+	V_STORE(Y_up, negv);
+	for(int j = 1; j < width + 1; j++) {
+		V_STORE(M_up + j * LANES, negv);
+		V_STORE(X_up + j * LANES, negv);
+		V_STORE(Y_up + j * LANES, V::set1(params->gapopen + (j-1) * params->gapext));
+	}
+
+	for(int i = 1; i < len1 + 1; i++) {
+		const vec_t q = V::set1(seq1[i-1]);
+		unsigned char *tb = ws->tb + (long) (i-1) * width * LANES;
+
+		//column 0
+		vec_t m_left = negv;
+		vec_t y_left = negv;
+		V_STORE(M_cur, negv);
+		V_STORE(X_cur, V::set1(params->gapopen + (i-1) * params->gapext));
+		V_STORE(Y_cur, negv);
+
+		for(int j = 1; j < width + 1; j++) {
+			vec_t same = V::eq(q, V_LOAD(tt + (j-1) * LANES));
+			vec_t s = V_OR(V_AND(same, matchv), V_ANDNOT(same, mismatchv));
+
+			//Setting dpm
+			vec_t m_val = V::add(V_LOAD(M_up + (j-1) * LANES), s);
+			vec_t ix_val = V::add(V_LOAD(X_up + (j-1) * LANES), s);
+			vec_t iy_val = V::add(V_LOAD(Y_up + (j-1) * LANES), s);
+			vec_t isIX = V_AND(V::ge(ix_val, m_val), V::ge(ix_val, iy_val));
+			vec_t isIY = V_ANDNOT(isIX, V_AND(V::ge(iy_val, m_val), V::ge(iy_val, ix_val)));
+			vec_t m_cur = V::max(V::max(m_val, ix_val), iy_val);
+			vec_t tbv = V_OR(V_AND(isIX, dirIX),
+					V_OR(V_AND(isIY, dirIY), V_ANDNOT(V_OR(isIX, isIY), dirM)));
+
+			//Setting Ix from (i-1,j)
+			m_val = V::add(V_LOAD(M_up + j * LANES), openv);
+			ix_val = V::add(V_LOAD(X_up + j * LANES), extv);
+			V_STORE(X_cur + j * LANES, V::max(m_val, ix_val));
+			tbv = V_OR(tbv, V_AND(V::ge(ix_val, m_val), bitIX));
+
+			//Setting Iy from (i,j-1)
+			m_val = V::add(m_left, openv);
+			iy_val = V::add(y_left, extv);
+			y_left = V::max(m_val, iy_val);
+			tbv = V_OR(tbv, V_AND(V::ge(iy_val, m_val), bitIY));
+
+			V_STORE(M_cur + j * LANES, m_cur);
+			V_STORE(Y_cur + j * LANES, y_left);
+			m_left = m_cur;
+			V::storeBytes(tb + (long) (j-1) * LANES, tbv);
+		}
+
+		T *tmp;
+		tmp = M_up; M_up = M_cur; M_cur = tmp;
+		tmp = X_up; X_up = X_cur; X_cur = tmp;
+		tmp = Y_up; Y_up = Y_cur; Y_cur = tmp;
+	}
+
+	//each lane starts from its own last column, same order as traceback_align()
+	for(int lane = 0; lane < count; lane++) {
+		int k = idx[lane];
+		long cell = (long) lens2[k] * LANES + lane;
+		T m = M_up[cell], ix = X_up[cell], iy = Y_up[cell];
+		int dirtyp;
+		if(ix >= iy && ix >= m) {
+			dirtyp = DIR_IX;
+		}
+		else if(iy >= ix && iy >= m) {
+			dirtyp = DIR_IY;
+		}
+		else {
+			dirtyp = DIR_M;
+		}
+
+		if(DEBUG1) {
+			fprintf(stderr, "batch lane %d dpm_score=%d Ix_score=%d Iy_score=%d\n", lane, (int) m, (int) ix, (int) iy);
+		}
+
+		LaneNextDirection next = {ws->tb, LANES, width, lane};
+		tracebackAlign(next, seq1, len1, seqs2[k], lens2[k], dirtyp, results[k]);
+		results[k]->score = (m > ix ? (m > iy ? m : iy) : (ix > iy ? ix : iy));
+	}
+
+	if(stats != NULL) {
+		stats->batches++;
+		stats->pairs += count;
+		for(int lane = 0; lane < count; lane++) {
+			stats->cells += (double) (len1 + 1) * (lens2[idx[lane]] + 1);
+		}
+		stats->laneCells += (double) (len1 + 1) * (width + 1) * LANES;
+	}
+}
+
+void SIMD_NAME(nwalignBatch)(NWAlignParams *params, int *seq1, int len1, int **seqs2, int *lens2, int count,
+		AlignPair **results, NWBatchStats *stats) {
+	//length-bucketed order: shortest targets first
+	NWBatchWorkspace *ws = reserveBatchWorkspace(params, 0, 0, count);
+	int *order = ws->order;
+	for(int k = 0; k < count; k++) {
+		order[k] = k;
+	}
+	for(int k = 1; k < count; k++) {
+		int cur = order[k];
+		int pos = k;
+		while(pos > 0 && lens2[order[pos-1]] > lens2[cur]) {
+			order[pos] = order[pos-1];
+			pos--;
+		}
+		order[pos] = cur;
+	}
+
+	int k = 0;
+	while(k < count) {
+		//the lane count depends on whether the batch's scores fit int16
+		int width = lens2[order[_imin(k + VecOps<short>::LANES, count) - 1]];
+		bool fitsInt16 = nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, width);
+		int lanes = (fitsInt16 ? (int) VecOps<short>::LANES : (int) VecOps<int>::LANES);
+		int n = _imin(lanes, count - k);
+		width = lens2[order[k + n - 1]];
+
+		if((long) len1 * width * lanes > NW_BATCH_TB_BYTES || len1 == 0 || width == 0) {
+			//too big (or degenerate) to be worth a batch
+			for(int l = 0; l < n; l++) {
+				int t = order[k + l];
+				nwalignSimd(params, seq1, len1, seqs2[t], lens2[t], results[t]);
+			}
+		}
+		else if(fitsInt16) {
+			_nwalign_lanes<short>(params, seq1, len1, seqs2, lens2, order + k, n, width, NW_NEG_INF16, results, stats);
+		}
+		else {
+			_nwalign_lanes<int>(params, seq1, len1, seqs2, lens2, order + k, n, width, NW_NEG_INF32, results, stats);
+		}
+		k += n;
+	}
+}
@@ -0,0 +1,302 @@
+//Linear-space version of nwalign() for long sequences.
+//
+//Divide and conquer over rows in the spirit of Hirschberg / Myers-Miller,
+//but arranged so that the traceback is the very path traceback_align()
+//would follow: the traceback of rows (a,b] only needs the score row at a,
+//so solve(a,b) computes the row at mid = (a+b)/2, traces (mid,b] first to
+//learn where the path enters row mid, and then traces (a,mid].  Segments
+//small enough for the block buffer are recomputed with packed traceback
+//bytes and traced directly.  Only columns left of the path's exit column
+//are recomputed, since the path is monotone in both sequences.
+//
+//Memory is one score row per recursion level plus the block buffer,
+//i.e. O(len2 * log(len1)) instead of O(len1 * len2).
+
+#include "nwalign.h"
+
+//maximum number of traceback bytes recomputed at once
+static const long NW_LINEAR_BLOCK_CELLS = 1L << 22;
+
+//score rows are stored as dpm, Ix, Iy, each rowcap long
+static inline int* _dpm(int *row) { return row; }
+static inline int* _ix(int *row, int rowcap) { return row + rowcap; }
+static inline int* _iy(int *row, int rowcap) { return row + 2 * rowcap; }
+
+typedef struct {
+	NWAlignParams *params;
+	NWLinearWorkspace *ws;
+	int *seq1;
+	int *seq2;
+	int rowcap; //len2 + 1
+	AlignPair *result;
+	int align_pos;
+} LinearState;
+
+static
+void _init_row0(LinearState *st, int *row, int jmax) {
+	int *M = _dpm(row), *X = _ix(row, st->rowcap), *Y = _iy(row, st->rowcap);
+	M[0] = 0;
+	X[0] = NW_NEG_INF32;
+	Y[0] = NW_NEG_INF32;
+	for(int j = 1; j <= jmax; j++) {
+		M[j] = NW_NEG_INF32;
+		X[j] = NW_NEG_INF32;
+		Y[j] = st->params->gapopen + (j-1) * st->params->gapext;
+	}
+}
+
+//Computes row i (columns 0..jmax) from row i-1, same recurrence and tie
+//order as _nwfill(); writes the packed traceback bytes if tb is not NULL.
+static inline
+void _next_row(LinearState *st, int i, int jmax, int *up, int *cur, unsigned char *tb) {
+	const int rowcap = st->rowcap;
+	const int match = st->params->match;
+	const int mismatch = st->params->mismatch;
+	const int gapopen = st->params->gapopen;
+	const int gapext = st->params->gapext;
+	const int c1 = st->seq1[i-1];
+	const int *seq2 = st->seq2;
+
+	const int *dpm_up = _dpm(up), *Ix_up = _ix(up, rowcap), *Iy_up = _iy(up, rowcap);
+	int *dpm_cur = _dpm(cur), *Ix_cur = _ix(cur, rowcap), *Iy_cur = _iy(cur, rowcap);
+
+	dpm_cur[0] = NW_NEG_INF32;
+	Ix_cur[0] = gapopen + (i-1) * gapext;
+	Iy_cur[0] = NW_NEG_INF32;
+	if(tb != NULL) {
+		tb[0] = DIR_ERR | (i == 1 ? 0 : TB_IX_EXT);
+	}
+
+	for(int j = 1; j <= jmax; j++) {
+		int s = (c1 == seq2[j-1] ? match : mismatch);
+		unsigned char cell;
+
+		int m_val = dpm_up[j-1] + s;
+		int ix_val = Ix_up[j-1] + s;
+		int iy_val = Iy_up[j-1] + s;
+		if(ix_val >= m_val && ix_val >= iy_val) {
+			dpm_cur[j] = ix_val;
+			cell = DIR_IX;
+		}
+		else if(iy_val >= m_val && iy_val >= ix_val) {
+			dpm_cur[j] = iy_val;
+			cell = DIR_IY;
+		}
+		else {
+			dpm_cur[j] = m_val;
+			cell = DIR_M;
+		}
+
+		m_val = dpm_up[j] + gapopen;
+		ix_val = Ix_up[j] + gapext;
+		if(ix_val >= m_val) {
+			Ix_cur[j] = ix_val;
+			cell |= TB_IX_EXT;
+		}
+		else {
+			Ix_cur[j] = m_val;
+		}
+
+		m_val = dpm_cur[j-1] + gapopen;
+		iy_val = Iy_cur[j-1] + gapext;
+		if(iy_val >= m_val) {
+			Iy_cur[j] = iy_val;
+			cell |= TB_IY_EXT;
+		}
+		else {
+			Iy_cur[j] = m_val;
+		}
+
+		if(tb != NULL) {
+			tb[j] = cell;
+		}
+	}
+}
+
+static
+void _copy_row(LinearState *st, int *src, int *dst, int jmax) {
+	for(int k = 0; k < 3; k++) {
+		memcpy(dst + k * st->rowcap, src + k * st->rowcap, sizeof(int) * (jmax + 1));
+	}
+}
+
+//rows a+1..b from rowA; the row at b ends up in out (which may be rowA)
+static
+void _forward(LinearState *st, int a, int b, int jmax, int *rowA, int *out) {
+	int *up = rowA;
+	int *cur = st->ws->roll[0];
+	for(int i = a + 1; i <= b; i++) {
+		_next_row(st, i, jmax, up, cur, NULL);
+		up = cur;
+		cur = (cur == st->ws->roll[0] ? st->ws->roll[1] : st->ws->roll[0]);
+	}
+	if(up != out) {
+		_copy_row(st, up, out, jmax);
+	}
+}
+
+//starting direction/matrix at the final cell (i,j), same order as
+//traceback_align(); also records the alignment score
+static
+int _start_direction(LinearState *st, int *row, int j) {
+	int m = _dpm(row)[j];
+	int ix = _ix(row, st->rowcap)[j];
+	int iy = _iy(row, st->rowcap)[j];
+	st->result->score = (m > ix ? (m > iy ? m : iy) : (ix > iy ? ix : iy));
+
+	if(DEBUG1) {
+		fprintf(stderr, "linear dpm_score=%d Ix_score=%d Iy_score=%d\n", m, ix, iy);
+	}
+
+	if(ix >= iy && ix >= m) {
+		return DIR_IX;
+	}
+	else if(iy >= ix && iy >= m) {
+		return DIR_IY;
+	}
+	return DIR_M;
+}
+
+static
+void _emit(LinearState *st, int c1, int c2) {
+	if(DEBUG0) {
+		assert(st->align_pos < st->result->capacity);
+	}
+	st->result->align1[st->align_pos] = c1;
+	st->result->align2[st->align_pos] = c2;
+	st->align_pos++;
+}
+
+//Recomputes rows a+1..b with traceback bytes and traces from (b, j) until
+//the path reaches row a (or (0,0) when a == 0).  A dirtyp of DIR_ERR means
+//the path starts at the best of the three matrices at (b, j).
+static
+void _trace_block(LinearState *st, int a, int b, int *rowA, int &j, int &dirtyp) {
+	int jmax = j;
+	long stride = jmax + 1;
+	unsigned char *tb = st->ws->block;
+
+	int *up = rowA;
+	int *cur = st->ws->roll[0];
+	for(int i = a + 1; i <= b; i++) {
+		_next_row(st, i, jmax, up, cur, tb + (i - a - 1) * stride);
+		up = cur;
+		cur = (cur == st->ws->roll[0] ? st->ws->roll[1] : st->ws->roll[0]);
+	}
+	if(dirtyp == DIR_ERR) {
+		dirtyp = _start_direction(st, up, j);
+	}
+
+	int i = b;
+	while(i > a) {
+		int next;
+		if(j == 0) {
+			next = (dirtyp == DIR_IX ? (i == 1 ? DIR_M : DIR_IX) : DIR_ERR);
+		}
+		else {
+			next = tbNextDirection(tb[(i - a - 1) * stride + j], dirtyp);
+		}
+
+		if(dirtyp == DIR_IX) {
+			_emit(st, st->seq1[i-1], GAP_CHAR);
+			i--;
+		}
+		else if(dirtyp == DIR_IY) {
+			_emit(st, GAP_CHAR, st->seq2[j-1]);
+			j--;
+		}
+		else if(dirtyp == DIR_M) {
+			_emit(st, st->seq1[i-1], st->seq2[j-1]);
+			i--;
+			j--;
+		}
+		else {
+			if(DEBUG0) {
+				fprintf(stderr, "Error: DIR_ERR found at position (%d,%d)\n", i, j);
+			}
+			abort();
+		}
+		dirtyp = next;
+	}
+
+	//row 0 can only be left through Iy, as set up by _nwfill()
+	if(a == 0) {
+		while(j > 0) {
+			if(dirtyp != DIR_IY) {
+				if(DEBUG0) {
+					fprintf(stderr, "Error: DIR_ERR found at position (0,%d)\n", j);
+				}
+				abort();
+			}
+			_emit(st, GAP_CHAR, st->seq2[j-1]);
+			dirtyp = (j == 1 ? DIR_M : DIR_IY);
+			j--;
+		}
+	}
+}
+
+//Traces rows (a,b] given the score row at a (stack[level]) and the cell
+//(b, j) the path leaves with dirtyp; on return j and dirtyp describe where
+//the path enters row a.  If midReady, stack[level+1] already holds row
+//(a+b)/2.
+static
+void _solve(LinearState *st, int a, int b, int level, bool midReady, int &j, int &dirtyp) {
+	int *rowA = st->ws->stack[level];
+	if((long) (b - a) * (j + 1) <= NW_LINEAR_BLOCK_CELLS || b - a == 1) {
+		_trace_block(st, a, b, rowA, j, dirtyp);
+		return;
+	}
+
+	int mid = (a + b) / 2;
+	int *rowMid = st->ws->stack[level + 1];
+	if(!midReady) {
+		_forward(st, a, mid, j, rowA, rowMid);
+	}
+	_solve(st, mid, b, level + 1, false, j, dirtyp);
+	_solve(st, a, mid, level, false, j, dirtyp);
+}
+
+void nwalignLinear(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, AlignPair* result) {
+	int depth = 2;
+	for(int n = len1; n > 1; n = (n + 1) / 2) {
+		depth++;
+	}
+	NWLinearWorkspace *ws = reserveLinearWorkspace(params, len2 + 1, depth, NW_LINEAR_BLOCK_CELLS + len2 + 1);
+
+	LinearState st;
+	st.params = params;
+	st.ws = ws;
+	st.seq1 = seq1;
+	st.seq2 = seq2;
+	st.rowcap = len2 + 1;
+	st.result = result;
+	st.align_pos = 0;
+
+	int j = len2;
+	int dirtyp = DIR_ERR;
+	_init_row0(&st, ws->stack[0], len2);
+	if((long) len1 * (len2 + 1) <= NW_LINEAR_BLOCK_CELLS) {
+		_trace_block(&st, 0, len1, ws->stack[0], j, dirtyp);
+	}
+	else {
+		//forward pass for the final cell, keeping row len1/2 for the first split
+		int mid = len1 / 2;
+		_forward(&st, 0, mid, len2, ws->stack[0], ws->stack[1]);
+		_forward(&st, mid, len1, len2, ws->stack[1], ws->last);
+		dirtyp = _start_direction(&st, ws->last, len2);
+		_solve(&st, 0, len1, 0, true, j, dirtyp);
+	}
+
+	//reverse the alignment
+	int *align1 = result->align1;
+	int *align2 = result->align2;
+	for(int left = 0, right = st.align_pos-1; left < right; left++, right--) {
+		int temp = align1[left];
+		align1[left] = align1[right];
+		align1[right] = temp;
+		temp = align2[left];
+		align2[left] = align2[right];
+		align2[right] = temp;
+	}
+	result->len = st.align_pos;
+}
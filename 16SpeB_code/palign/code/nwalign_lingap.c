@@ -0,0 +1,114 @@
+//Single-matrix version of nwalign() for linear gap scoring.
+//
+//With gapopen == gapext a gap column costs the same wherever it is, so
+//H(i,j) = max(H(i-1,j-1) + s, H(i-1,j) + g, H(i,j-1) + g) replaces dpm, Ix
+//and Iy.  The traceback byte of a cell is the DirectionType of the move
+//into it (DIR_IX: a gap in seq2, DIR_IY: a gap in seq1, DIR_M: a pair).
+//One matrix may put opposite gap columns side by side, which nwalign()
+//cannot; nwLinearGapScoring() only admits scorings where that never beats
+//a mismatch, so the scores agree.
+
+#include "nwalign.h"
+#include "nwalign_scoring.h"
+
+template <typename ScoreT, typename Scoring>
+static void _lingap_fill(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, int &score) {
+	NWDpWorkspace *ws = reserveDpWorkspace(params, sizeof(ScoreT) * (len2 + 1), len1, len2);
+	ScoreT *row = (ScoreT*) ws->rows;
+	unsigned char *tb = ws->tb;
+	const long stride = ws->tb_stride;
+	const ScoreT match = Scoring::match(params);
+	const ScoreT mismatch = Scoring::mismatch(params);
+	const ScoreT gap = Scoring::gapext(params);
+
+	row[0] = 0;
+	tb[0] = DIR_ERR;
+	for(int j = 1; j < len2+1; j++) {
+		row[j] = row[j-1] + gap;
+		tb[j] = DIR_IY;
+	}
+
+	for(int i = 1; i < len1 + 1; i++) {
+		const int c1 = seq1[i-1];
+		unsigned char *tb_cur = tb + i * stride;
+		ScoreT diag = row[0];
+		row[0] = diag + gap;
+		tb_cur[0] = DIR_IX;
+		ScoreT left = row[0];
+
+		for(int j = 1; j < len2 + 1; j++) {
+			ScoreT s = (c1 == seq2[j-1] ? match : mismatch);
+			ScoreT up = row[j];
+
+			//same preference as dpm in _nwfill(): Ix, then Iy, then M
+			ScoreT m_val = diag + s;
+			ScoreT ix_val = up + gap;
+			ScoreT iy_val = left + gap;
+			ScoreT cur;
+			if(ix_val >= m_val && ix_val >= iy_val) {
+				cur = ix_val;
+				tb_cur[j] = DIR_IX;
+			}
+			else if(iy_val >= m_val) {
+				cur = iy_val;
+				tb_cur[j] = DIR_IY;
+			}
+			else {
+				cur = m_val;
+				tb_cur[j] = DIR_M;
+			}
+
+			row[j] = cur;
+			diag = up;
+			left = cur;
+		}
+	}
+
+	score = row[len2];
+}
+
+//The traceback byte of a cell is the move into it, so the direction after
+//leaving (i,j) is the byte of the cell that move reaches.
+struct LinGapNextDirection {
+	const unsigned char *tb;
+	long stride;
+	inline int operator()(int i, int j, int dirtyp) const {
+		int up = (dirtyp == DIR_IY ? 0 : 1);
+		int left = (dirtyp == DIR_IX ? 0 : 1);
+		return tb[(i - up) * stride + (j - left)];
+	}
+};
+
+//_lingap_fill() with the constants of the matlab preset folded in when the
+//run uses it
+template <typename ScoreT>
+static void _lingap_fill_scored(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, int &score) {
+	if(MatlabScoring::matches(params)) {
+		_lingap_fill<ScoreT, MatlabScoring>(params, seq1, len1, seq2, len2, score);
+	}
+	else {
+		_lingap_fill<ScoreT, ParamScoring>(params, seq1, len1, seq2, len2, score);
+	}
+}
+
+void nwalignLinearGap(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, AlignPair* result) {
+	if(DEBUG0) {
+		if(len1+1 > params->matrix_capacity || len2+1 > params->matrix_capacity) {
+			fprintf(stderr, "DP matrix out of range.\n");
+			abort();
+		}
+	}
+
+	if(nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2)) {
+		_lingap_fill_scored<short>(params, seq1, len1, seq2, len2, result->score);
+	}
+	else {
+		_lingap_fill_scored<int>(params, seq1, len1, seq2, len2, result->score);
+	}
+	LinGapNextDirection next = {params->dp->tb, params->dp->tb_stride};
+	tracebackAlign(next, seq1, len1, seq2, len2, next.tb[len1 * next.stride + len2], result);
+
+	if(DEBUG1) {
+		fprintf(stderr, "linear-gap score=%d len=%d\n", result->score, result->len);
+	}
+}
@@ -0,0 +1,35 @@
+//Scoring of the templated scalar kernels (nwalign.c, nwalign_stats.c,
+//nwalign_lingap.c).  A kernel instantiated with a FixedScoring has the
+//constants of a preset folded in; ParamScoring reads NWAlignParams and
+//serves every other scheme.  Each kernel picks its instantiation once per
+//pair with matches().
+
+#ifndef _NWALIGN_SCORING_H
+#define _NWALIGN_SCORING_H
+
+#include "nwalign.h"
+
+template <int MATCH, int MISMATCH, int GAPOPEN, int GAPEXT>
+struct FixedScoring {
+	static inline int match(const NWAlignParams*) { return MATCH; }
+	static inline int mismatch(const NWAlignParams*) { return MISMATCH; }
+	static inline int gapopen(const NWAlignParams*) { return GAPOPEN; }
+	static inline int gapext(const NWAlignParams*) { return GAPEXT; }
+	static inline bool matches(const NWAlignParams *params) {
+		return (params->match == MATCH && params->mismatch == MISMATCH
+				&& params->gapopen == GAPOPEN && params->gapext == GAPEXT);
+	}
+};
+
+struct ParamScoring {
+	static inline int match(const NWAlignParams *params) { return params->match; }
+	static inline int mismatch(const NWAlignParams *params) { return params->mismatch; }
+	static inline int gapopen(const NWAlignParams *params) { return params->gapopen; }
+	static inline int gapext(const NWAlignParams *params) { return params->gapext; }
+	static inline bool matches(const NWAlignParams*) { return true; }
+};
+
+typedef FixedScoring<NW_SCORING_BLASTN> BlastnScoring;
+typedef FixedScoring<NW_SCORING_MATLAB> MatlabScoring;
+
+#endif
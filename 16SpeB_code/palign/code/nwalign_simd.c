@@ -0,0 +1,434 @@
+//Anti-diagonal (wavefront) version of the Gotoh fill in nwalign().
+//
+//Cell (i,j) only depends on anti-diagonals i+j-1 and i+j-2, so all cells of
+//one anti-diagonal are computed together, one vector of lanes at a time.
+//Score arrays are indexed by i; seq2 is reversed so that seq2[j-1] is read
+//with increasing addresses as i grows along a diagonal.  The comparisons
+//and their order are those of _nwfill(), so the traceback reproduces the
+//scalar alignment exactly.
+//
+//This file is compiled once per instruction set (see Makefile) with either
+//SIMD_SSE41 or SIMD_AVX2 defined; nwalignSimd() picks one at runtime.
+//The same wavefront also carries the path counts of nwalignCounts() and
+//nwalignLinearGapCounts() (see nwalign_stats.c).
+
+#include "nwalign.h"
+#include "nwalign_vec.h"
+
+static inline
+int _imax(int a, int b) {
+	return (a > b ? a : b);
+}
+
+static inline
+int _imin(int a, int b) {
+	return (a < b ? a : b);
+}
+
+//next direction when leaving cell (i,j) in direction dirtyp;
+//the row-0 and column-0 rules are those set up by _nwfill()
+static inline
+int _next_direction(NWSimdWorkspace *ws, int len2, int i, int j, int dirtyp) {
+	if(i == 0) {
+		return (dirtyp == DIR_IY ? (j == 1 ? DIR_M : DIR_IY) : DIR_ERR);
+	}
+	if(j == 0) {
+		return (dirtyp == DIR_IX ? (i == 1 ? DIR_M : DIR_IX) : DIR_ERR);
+	}
+
+	int d = i + j;
+	int ilo = _imax(1, d - len2);
+	return tbNextDirection(ws->tb[ws->diag_offset[d] + (i - ilo)], dirtyp);
+}
+
+struct DiagNextDirection {
+	NWSimdWorkspace *ws;
+	int len2;
+	inline int operator()(int i, int j, int dirtyp) const {
+		return _next_direction(ws, len2, i, j, dirtyp);
+	}
+};
+
+template <typename T>
+static
+void _nwalign_diag(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, T negInf, AlignPair *result) {
+	typedef VecOps<T> V;
+	const int LANES = V::LANES;
+
+	//workspace: 9 score rows (M, Ix, Iy on three anti-diagonals) and both
+	//sequences as lane-typed arrays, all padded for the last partial vector
+	long rowlen = len1 + 1 + 2 * LANES;
+	long seqlen = _imax(len1, len2) + 2 * LANES;
+	long tbBytes = (long) len1 * len2 + VBYTES;
+	NWSimdWorkspace *ws = reserveSimdWorkspace(params, tbBytes, len1 + len2 + 1,
+			sizeof(T) * (9 * rowlen + 2 * seqlen));
+
+	T *rows = (T*) ws->rows;
+	T *M[3], *X[3], *Y[3];
+	for(int k = 0; k < 3; k++) {
+		M[k] = rows + (3*k + 0) * rowlen;
+		X[k] = rows + (3*k + 1) * rowlen;
+		Y[k] = rows + (3*k + 2) * rowlen;
+	}
+	T *s1 = rows + 9 * rowlen;
+	T *rev2 = s1 + seqlen;
+	memset(s1, 0, sizeof(T) * 2 * seqlen);
+	for(int i = 0; i < len1; i++) {
+		s1[i] = (T) seq1[i];
+	}
+	for(int k = 0; k < len2; k++) {
+		rev2[k] = (T) seq2[len2 - 1 - k];
+	}
+
+	const vec_t matchv = V::set1(params->match);
+	const vec_t mismatchv = V::set1(params->mismatch);
+	const vec_t openv = V::set1(params->gapopen);
+	const vec_t extv = V::set1(params->gapext);
+	const vec_t dirM = V::set1(DIR_M);
+	const vec_t dirIX = V::set1(DIR_IX);
+	const vec_t dirIY = V::set1(DIR_IY);
+	const vec_t bitIX = V::set1(TB_IX_EXT);
+	const vec_t bitIY = V::set1(TB_IY_EXT);
+
+	//anti-diagonal 0 holds only (0,0); it becomes "d-1" for d = 1
+	M[1][0] = 0;
+	X[1][0] = negInf;
+	Y[1][0] = negInf;
+
+	long off = 0;
+	for(int d = 1; d <= len1 + len2; d++) {
+		const T *m2 = M[0], *x2 = X[0], *y2 = Y[0]; //anti-diagonal d-2
+		const T *m1 = M[1], *x1 = X[1], *y1 = Y[1]; //anti-diagonal d-1
+		T *mc = M[2], *xc = X[2], *yc = Y[2];
+
+		int ilo = _imax(1, d - len2);
+		int ihi = _imin(len1, d - 1);
+		ws->diag_offset[d] = off;
+
+		for(int i = ilo; i <= ihi; i += LANES) {
+			vec_t same = V::eq(V_LOAD(s1 + i - 1), V_LOAD(rev2 + len2 - d + i));
+			vec_t s = V_OR(V_AND(same, matchv), V_ANDNOT(same, mismatchv));
+
+			//Setting dpm
+			vec_t m_val = V::add(V_LOAD(m2 + i - 1), s);
+			vec_t ix_val = V::add(V_LOAD(x2 + i - 1), s);
+			vec_t iy_val = V::add(V_LOAD(y2 + i - 1), s);
+			vec_t isIX = V_AND(V::ge(ix_val, m_val), V::ge(ix_val, iy_val));
+			vec_t isIY = V_ANDNOT(isIX, V_AND(V::ge(iy_val, m_val), V::ge(iy_val, ix_val)));
+			V_STORE(mc + i, V::max(V::max(m_val, ix_val), iy_val));
+			vec_t tb = V_OR(V_AND(isIX, dirIX),
+					V_OR(V_AND(isIY, dirIY), V_ANDNOT(V_OR(isIX, isIY), dirM)));
+
+			//Setting Ix from (i-1,j)
+			m_val = V::add(V_LOAD(m1 + i - 1), openv);
+			ix_val = V::add(V_LOAD(x1 + i - 1), extv);
+			V_STORE(xc + i, V::max(m_val, ix_val));
+			tb = V_OR(tb, V_AND(V::ge(ix_val, m_val), bitIX));
+
+			//Setting Iy from (i,j-1)
+			m_val = V::add(V_LOAD(m1 + i), openv);
+			iy_val = V::add(V_LOAD(y1 + i), extv);
+			V_STORE(yc + i, V::max(m_val, iy_val));
+			tb = V_OR(tb, V_AND(V::ge(iy_val, m_val), bitIY));
+
+			V::storeBytes(ws->tb + off + (i - ilo), tb);
+		}
+		if(ihi >= ilo) {
+			off += ihi - ilo + 1;
+		}
+
+		//boundary cells go in after the vector loop, which may spill past ihi
+		if(d <= len2) {
+			mc[0] = negInf;
+			xc[0] = negInf;
+			yc[0] = params->gapopen + (d-1) * params->gapext;
+		}
+		if(d <= len1) {
+			mc[d] = negInf;
+			xc[d] = params->gapopen + (d-1) * params->gapext;
+			yc[d] = negInf;
+		}
+
+		T *tmp;
+		tmp = M[0]; M[0] = M[1]; M[1] = M[2]; M[2] = tmp;
+		tmp = X[0]; X[0] = X[1]; X[1] = X[2]; X[2] = tmp;
+		tmp = Y[0]; Y[0] = Y[1]; Y[1] = Y[2]; Y[2] = tmp;
+	}
+
+	//starting direction/matrix, same order as traceback_align()
+	T m = M[1][len1], ix = X[1][len1], iy = Y[1][len1];
+	int dirtyp;
+	if(ix >= iy && ix >= m) {
+		dirtyp = DIR_IX;
+	}
+	else if(iy >= ix && iy >= m) {
+		dirtyp = DIR_IY;
+	}
+	else {
+		dirtyp = DIR_M;
+	}
+
+	result->score = _imax(_imax(m, ix), iy);
+
+	if(DEBUG1) {
+		fprintf(stderr, "simd dpm_score=%d Ix_score=%d Iy_score=%d\n", (int) m, (int) ix, (int) iy);
+	}
+
+	DiagNextDirection next = {ws, len2};
+	tracebackAlign(next, seq1, len1, seq2, len2, dirtyp, result);
+}
+
+//Path counts of nwalignCounts() along anti-diagonals, for ungapped
+//sequences: each cell's identities and paired columns are selected with
+//the same masks as its score, in lanes of the score type.
+template <typename T>
+static
+void _counts_diag(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, T negInf, NWPairCounts *result) {
+	typedef VecOps<T> V;
+	const int LANES = V::LANES;
+
+	//workspace: on three anti-diagonals, the scores of M, Ix and Iy and the
+	//identities and paired columns of their paths; then both sequences
+	long rowlen = len1 + 1 + 2 * LANES;
+	long seqlen = _imax(len1, len2) + 2 * LANES;
+	long bytes = sizeof(T) * (27 * rowlen + 2 * seqlen);
+	NWStatsWorkspace *ws = reserveStatsWorkspace(params, bytes);
+	memset(ws->rows, 0, bytes);
+
+	T *rows = (T*) ws->rows;
+	T *M[3], *X[3], *Y[3], *MI[3], *MP[3], *XI[3], *XP[3], *YI[3], *YP[3];
+	for(int k = 0; k < 3; k++) {
+		T *diag = rows + 9 * k * rowlen;
+		M[k] = diag;
+		X[k] = diag + rowlen;
+		Y[k] = diag + 2 * rowlen;
+		MI[k] = diag + 3 * rowlen;
+		MP[k] = diag + 4 * rowlen;
+		XI[k] = diag + 5 * rowlen;
+		XP[k] = diag + 6 * rowlen;
+		YI[k] = diag + 7 * rowlen;
+		YP[k] = diag + 8 * rowlen;
+	}
+	T *s1 = rows + 27 * rowlen;
+	T *rev2 = s1 + seqlen;
+	for(int i = 0; i < len1; i++) {
+		s1[i] = (T) seq1[i];
+	}
+	for(int k = 0; k < len2; k++) {
+		rev2[k] = (T) seq2[len2 - 1 - k];
+	}
+
+	const vec_t matchv = V::set1(params->match);
+	const vec_t mismatchv = V::set1(params->mismatch);
+	const vec_t openv = V::set1(params->gapopen);
+	const vec_t extv = V::set1(params->gapext);
+	const vec_t onev = V::set1(1);
+
+	//anti-diagonal 0 holds only (0,0), with empty counts
+	M[1][0] = 0;
+	X[1][0] = negInf;
+	Y[1][0] = negInf;
+
+	for(int d = 1; d <= len1 + len2; d++) {
+		int ilo = _imax(1, d - len2);
+		int ihi = _imin(len1, d - 1);
+
+		for(int i = ilo; i <= ihi; i += LANES) {
+			vec_t same = V::eq(V_LOAD(s1 + i - 1), V_LOAD(rev2 + len2 - d + i));
+			vec_t s = V_OR(V_AND(same, matchv), V_ANDNOT(same, mismatchv));
+
+			//Setting dpm
+			vec_t m_val = V::add(V_LOAD(M[0] + i - 1), s);
+			vec_t ix_val = V::add(V_LOAD(X[0] + i - 1), s);
+			vec_t iy_val = V::add(V_LOAD(Y[0] + i - 1), s);
+			vec_t isIX = V_AND(V::ge(ix_val, m_val), V::ge(ix_val, iy_val));
+			vec_t isIY = V_ANDNOT(isIX, V_AND(V::ge(iy_val, m_val), V::ge(iy_val, ix_val)));
+			vec_t isM = V_ANDNOT(V_OR(isIX, isIY), V::eq(s, s));
+			V_STORE(M[2] + i, V::max(V::max(m_val, ix_val), iy_val));
+			vec_t ident = V_OR(V_AND(isIX, V_LOAD(XI[0] + i - 1)),
+					V_OR(V_AND(isIY, V_LOAD(YI[0] + i - 1)), V_AND(isM, V_LOAD(MI[0] + i - 1))));
+			vec_t paired = V_OR(V_AND(isIX, V_LOAD(XP[0] + i - 1)),
+					V_OR(V_AND(isIY, V_LOAD(YP[0] + i - 1)), V_AND(isM, V_LOAD(MP[0] + i - 1))));
+			V_STORE(MI[2] + i, V::add(ident, V_AND(same, onev)));
+			V_STORE(MP[2] + i, V::add(paired, onev));
+
+			//Setting Ix from (i-1,j)
+			m_val = V::add(V_LOAD(M[1] + i - 1), openv);
+			ix_val = V::add(V_LOAD(X[1] + i - 1), extv);
+			vec_t extend = V::ge(ix_val, m_val);
+			V_STORE(X[2] + i, V::max(m_val, ix_val));
+			V_STORE(XI[2] + i, V_OR(V_AND(extend, V_LOAD(XI[1] + i - 1)), V_ANDNOT(extend, V_LOAD(MI[1] + i - 1))));
+			V_STORE(XP[2] + i, V_OR(V_AND(extend, V_LOAD(XP[1] + i - 1)), V_ANDNOT(extend, V_LOAD(MP[1] + i - 1))));
+
+			//Setting Iy from (i,j-1)
+			m_val = V::add(V_LOAD(M[1] + i), openv);
+			iy_val = V::add(V_LOAD(Y[1] + i), extv);
+			extend = V::ge(iy_val, m_val);
+			V_STORE(Y[2] + i, V::max(m_val, iy_val));
+			V_STORE(YI[2] + i, V_OR(V_AND(extend, V_LOAD(YI[1] + i)), V_ANDNOT(extend, V_LOAD(MI[1] + i))));
+			V_STORE(YP[2] + i, V_OR(V_AND(extend, V_LOAD(YP[1] + i)), V_ANDNOT(extend, V_LOAD(MP[1] + i))));
+		}
+
+		//boundary cells go in after the vector loop, which may spill past
+		//ihi; their paths are all gaps, so their counts are 0
+		if(d <= len2) {
+			M[2][0] = negInf;
+			X[2][0] = negInf;
+			Y[2][0] = params->gapopen + (d-1) * params->gapext;
+			MI[2][0] = MP[2][0] = XI[2][0] = XP[2][0] = YI[2][0] = YP[2][0] = 0;
+		}
+		if(d <= len1) {
+			M[2][d] = negInf;
+			X[2][d] = params->gapopen + (d-1) * params->gapext;
+			Y[2][d] = negInf;
+			MI[2][d] = MP[2][d] = XI[2][d] = XP[2][d] = YI[2][d] = YP[2][d] = 0;
+		}
+
+		T **all[9] = {M, X, Y, MI, MP, XI, XP, YI, YP};
+		for(int a = 0; a < 9; a++) {
+			T *tmp = all[a][0];
+			all[a][0] = all[a][1];
+			all[a][1] = all[a][2];
+			all[a][2] = tmp;
+		}
+	}
+
+	//the cell the traceback starts from, same order as traceback_align()
+	T m = M[1][len1], ix = X[1][len1], iy = Y[1][len1];
+	int identities, paired;
+	if(ix >= iy && ix >= m) {
+		result->score = ix;
+		identities = XI[1][len1];
+		paired = XP[1][len1];
+	}
+	else if(iy >= ix && iy >= m) {
+		result->score = iy;
+		identities = YI[1][len1];
+		paired = YP[1][len1];
+	}
+	else {
+		result->score = m;
+		identities = MI[1][len1];
+		paired = MP[1][len1];
+	}
+	result->identities = identities;
+	result->nongap = paired;
+	result->alignlen = len1 + len2 - paired;
+}
+
+//_counts_diag() over the single matrix of nwalignLinearGapCounts()
+template <typename T>
+static
+void _lingap_counts_diag(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result) {
+	typedef VecOps<T> V;
+	const int LANES = V::LANES;
+
+	//workspace: on three anti-diagonals, the scores and the identities and
+	//paired columns of their paths; then both sequences
+	long rowlen = len1 + 1 + 2 * LANES;
+	long seqlen = _imax(len1, len2) + 2 * LANES;
+	long bytes = sizeof(T) * (9 * rowlen + 2 * seqlen);
+	NWStatsWorkspace *ws = reserveStatsWorkspace(params, bytes);
+	memset(ws->rows, 0, bytes);
+
+	T *rows = (T*) ws->rows;
+	T *H[3], *HI[3], *HP[3];
+	for(int k = 0; k < 3; k++) {
+		H[k] = rows + 3 * k * rowlen;
+		HI[k] = H[k] + rowlen;
+		HP[k] = H[k] + 2 * rowlen;
+	}
+	T *s1 = rows + 9 * rowlen;
+	T *rev2 = s1 + seqlen;
+	for(int i = 0; i < len1; i++) {
+		s1[i] = (T) seq1[i];
+	}
+	for(int k = 0; k < len2; k++) {
+		rev2[k] = (T) seq2[len2 - 1 - k];
+	}
+
+	const vec_t matchv = V::set1(params->match);
+	const vec_t mismatchv = V::set1(params->mismatch);
+	const vec_t gapv = V::set1(params->gapext);
+	const vec_t onev = V::set1(1);
+
+	//anti-diagonal 0 holds only (0,0), with empty counts
+	H[1][0] = 0;
+
+	for(int d = 1; d <= len1 + len2; d++) {
+		int ilo = _imax(1, d - len2);
+		int ihi = _imin(len1, d - 1);
+
+		for(int i = ilo; i <= ihi; i += LANES) {
+			vec_t same = V::eq(V_LOAD(s1 + i - 1), V_LOAD(rev2 + len2 - d + i));
+			vec_t s = V_OR(V_AND(same, matchv), V_ANDNOT(same, mismatchv));
+
+			//same preference as nwalignLinearGap(): up, then left, then diagonal
+			vec_t m_val = V::add(V_LOAD(H[0] + i - 1), s);
+			vec_t ix_val = V::add(V_LOAD(H[1] + i - 1), gapv);
+			vec_t iy_val = V::add(V_LOAD(H[1] + i), gapv);
+			vec_t isIX = V_AND(V::ge(ix_val, m_val), V::ge(ix_val, iy_val));
+			vec_t isIY = V_ANDNOT(isIX, V::ge(iy_val, m_val));
+			vec_t isM = V_ANDNOT(V_OR(isIX, isIY), V::eq(s, s));
+			V_STORE(H[2] + i, V::max(V::max(m_val, ix_val), iy_val));
+			vec_t ident = V_OR(V_AND(isIX, V_LOAD(HI[1] + i - 1)),
+					V_OR(V_AND(isIY, V_LOAD(HI[1] + i)), V_AND(isM, V::add(V_LOAD(HI[0] + i - 1), V_AND(same, onev)))));
+			vec_t paired = V_OR(V_AND(isIX, V_LOAD(HP[1] + i - 1)),
+					V_OR(V_AND(isIY, V_LOAD(HP[1] + i)), V_AND(isM, V::add(V_LOAD(HP[0] + i - 1), onev))));
+			V_STORE(HI[2] + i, ident);
+			V_STORE(HP[2] + i, paired);
+		}
+
+		//boundary cells go in after the vector loop, which may spill past
+		//ihi; their paths are all gaps, so their counts are 0
+		if(d <= len2) {
+			H[2][0] = d * params->gapext;
+			HI[2][0] = HP[2][0] = 0;
+		}
+		if(d <= len1) {
+			H[2][d] = d * params->gapext;
+			HI[2][d] = HP[2][d] = 0;
+		}
+
+		T **all[3] = {H, HI, HP};
+		for(int a = 0; a < 3; a++) {
+			T *tmp = all[a][0];
+			all[a][0] = all[a][1];
+			all[a][1] = all[a][2];
+			all[a][2] = tmp;
+		}
+	}
+
+	result->score = H[1][len1];
+	result->identities = HI[1][len1];
+	result->nongap = HP[1][len1];
+	result->alignlen = len1 + len2 - result->nongap;
+}
+
+void SIMD_NAME(nwalignSimd)(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, AlignPair* result) {
+	if(nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2)) {
+		_nwalign_diag<short>(params, seq1, len1, seq2, len2, NW_NEG_INF16, result);
+	}
+	else {
+		_nwalign_diag<int>(params, seq1, len1, seq2, len2, NW_NEG_INF32, result);
+	}
+}
+
+void SIMD_NAME(nwalignCountsSimd)(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result) {
+	if(nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2)) {
+		_counts_diag<short>(params, seq1, len1, seq2, len2, NW_NEG_INF16, result);
+	}
+	else {
+		_counts_diag<int>(params, seq1, len1, seq2, len2, NW_NEG_INF32, result);
+	}
+}
+
+void SIMD_NAME(nwalignLinearGapCountsSimd)(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2,
+		NWPairCounts *result) {
+	if(nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2)) {
+		_lingap_counts_diag<short>(params, seq1, len1, seq2, len2, result);
+	}
+	else {
+		_lingap_counts_diag<int>(params, seq1, len1, seq2, len2, result);
+	}
+}
@@ -0,0 +1,302 @@
+//Traceback-free version of nwalign() for callers that only need the PIDs.
+//
+//The traceback of nwalign() leaves every cell of every matrix through one
+//fixed predecessor (the direction bits of its packed traceback byte), so
+//the path it walks back from (len1, len2) is also the path obtained by
+//following those predecessors forward.  Each cell therefore carries the
+//counts of the path ending in it, copied from the predecessor chosen with
+//the comparisons of _nwfill() and extended by one column; the counts at
+//the cell the traceback would start from are those of the nwalign()
+//alignment.  One row is kept and updated in place.
+//
+//Counts are packed in one integer so extending a path is a single
+//addition.  Ungapped sequences (all of them after removeGaps()) only need
+//the paired columns and the identities, 16 bits each: every paired column
+//is a non-gap column and the other columns are gaps.  Those pairs go to
+//the anti-diagonal kernel of nwalign_simd.c when the CPU has one, which
+//keeps the counts in lanes of the score type.  Otherwise sequences with
+//GAP_CHAR, or too long for 16 bits, get 64-bit counts carrying the
+//alignment length and the non-gap columns as well.
+//
+//nwalignLinearGapCounts() does the same over the single matrix of
+//nwalignLinearGap(), with its own anti-diagonal kernel.
+
+#include "nwalign.h"
+#include "nwalign_scoring.h"
+
+//narrow counts: identities << 16 | paired columns
+static const int NARROW_BITS = 16;
+static const unsigned int NARROW_MASK = (1u << NARROW_BITS) - 1;
+
+//wide counts: identities << 42 | nongap << 21 | alignlen
+static const int WIDE_BITS = 21;
+static const unsigned long long WIDE_MASK = (1ULL << WIDE_BITS) - 1;
+
+//what one column adds to the counts of a path
+template <typename CountT>
+struct ColumnCounts {
+	CountT gap;
+	CountT mismatch;
+	CountT identity;
+	CountT gapChar; //paired column with GAP_CHAR on either side
+};
+
+//one cell of the row, updated in place
+template <typename ScoreT, typename CountT>
+struct CountCell {
+	ScoreT m, x, y;
+	CountT cm, cx, cy;
+};
+
+//gapped: whether the sequences may hold GAP_CHAR
+template <typename ScoreT, typename CountT, bool gapped, typename Scoring>
+static CountT _count_fill(NWAlignParams *params, ScoreT negInf, const ColumnCounts<CountT> &add,
+		int *seq1, int len1, int *seq2, int len2, int &score) {
+	const ScoreT match = Scoring::match(params);
+	const ScoreT mismatch = Scoring::mismatch(params);
+	const ScoreT gapopen = Scoring::gapopen(params);
+	const ScoreT gapext = Scoring::gapext(params);
+	typedef CountCell<ScoreT, CountT> Cell;
+	NWStatsWorkspace *ws = reserveStatsWorkspace(params, sizeof(Cell) * (len2 + 1L));
+	Cell *row = (Cell*) ws->rows;
+
+	//row 0: only Iy, extending from (0,0)
+	row[0].m = 0;
+	row[0].x = row[0].y = negInf;
+	row[0].cm = row[0].cx = row[0].cy = 0;
+	for(int j = 1; j < len2+1; j++) {
+		row[j].m = row[j].x = negInf;
+		row[j].y = gapopen + (j-1) * gapext;
+		row[j].cm = row[j].cx = 0;
+		row[j].cy = row[j-1].cy + add.gap;
+	}
+
+	for(int i = 1; i < len1 + 1; i++) {
+		const int c1 = seq1[i-1];
+		Cell diag = row[0];
+
+		//column 0: only Ix, extending from (0,0)
+		row[0].m = row[0].y = negInf;
+		row[0].x = gapopen + (i-1) * gapext;
+		row[0].cm = row[0].cy = 0;
+		row[0].cx = diag.cx + add.gap;
+		Cell left = row[0];
+
+		for(int j = 1; j < len2 + 1; j++) {
+			const int c2 = seq2[j-1];
+			ScoreT s = (c1 == c2 ? match : mismatch);
+			CountT column = (c1 == c2 ? add.identity : add.mismatch);
+			if(gapped && (c1 == GAP_CHAR || c2 == GAP_CHAR)) {
+				column = add.gapChar;
+			}
+			Cell up = row[j];
+			Cell cur;
+
+			//Setting dpm, same order as _nwfill()
+			ScoreT m_val = diag.m + s;
+			ScoreT ix_val = diag.x + s;
+			ScoreT iy_val = diag.y + s;
+			bool fromIx = (ix_val >= m_val && ix_val >= iy_val);
+			bool fromIy = (!fromIx && iy_val >= m_val);
+			cur.m = (fromIx ? ix_val : (fromIy ? iy_val : m_val));
+			cur.cm = (fromIx ? diag.cx : (fromIy ? diag.cy : diag.cm)) + column;
+
+			//Setting Ix from (i-1,j)
+			m_val = up.m + gapopen;
+			ix_val = up.x + gapext;
+			bool extend = (ix_val >= m_val);
+			cur.x = (extend ? ix_val : m_val);
+			cur.cx = (extend ? up.cx : up.cm) + add.gap;
+
+			//Setting Iy from (i,j-1)
+			m_val = left.m + gapopen;
+			iy_val = left.y + gapext;
+			extend = (iy_val >= m_val);
+			cur.y = (extend ? iy_val : m_val);
+			cur.cy = (extend ? left.cy : left.cm) + add.gap;
+
+			row[j] = cur;
+			diag = up;
+			left = cur;
+		}
+	}
+
+	//the cell the traceback starts from, same order as traceback_align()
+	Cell last = row[len2];
+	if(last.x >= last.y && last.x >= last.m) {
+		score = last.x;
+		return last.cx;
+	}
+	else if(last.y >= last.x && last.y >= last.m) {
+		score = last.y;
+		return last.cy;
+	}
+	score = last.m;
+	return last.cm;
+}
+
+//one cell of the row of _lingap_count_fill()
+template <typename ScoreT, typename CountT>
+struct LinearGapCell {
+	ScoreT h;
+	CountT c;
+};
+
+//_count_fill() for linear gap scoring: one matrix, the moves and ties of
+//nwalignLinearGap()
+template <typename ScoreT, typename CountT, bool gapped, typename Scoring>
+static CountT _lingap_count_fill(NWAlignParams *params, const ColumnCounts<CountT> &add,
+		int *seq1, int len1, int *seq2, int len2, int &score) {
+	const ScoreT match = Scoring::match(params);
+	const ScoreT mismatch = Scoring::mismatch(params);
+	const ScoreT gap = Scoring::gapext(params);
+	typedef LinearGapCell<ScoreT, CountT> Cell;
+	NWStatsWorkspace *ws = reserveStatsWorkspace(params, sizeof(Cell) * (len2 + 1L));
+	Cell *row = (Cell*) ws->rows;
+
+	row[0].h = 0;
+	row[0].c = 0;
+	for(int j = 1; j < len2+1; j++) {
+		row[j].h = row[j-1].h + gap;
+		row[j].c = row[j-1].c + add.gap;
+	}
+
+	for(int i = 1; i < len1 + 1; i++) {
+		const int c1 = seq1[i-1];
+		Cell diag = row[0];
+		row[0].h = diag.h + gap;
+		row[0].c = diag.c + add.gap;
+		Cell left = row[0];
+
+		for(int j = 1; j < len2 + 1; j++) {
+			const int c2 = seq2[j-1];
+			ScoreT s = (c1 == c2 ? match : mismatch);
+			CountT column = (c1 == c2 ? add.identity : add.mismatch);
+			if(gapped && (c1 == GAP_CHAR || c2 == GAP_CHAR)) {
+				column = add.gapChar;
+			}
+			Cell up = row[j];
+
+			ScoreT m_val = diag.h + s;
+			ScoreT ix_val = up.h + gap;
+			ScoreT iy_val = left.h + gap;
+			Cell cur;
+			if(ix_val >= m_val && ix_val >= iy_val) {
+				cur.h = ix_val;
+				cur.c = up.c + add.gap;
+			}
+			else if(iy_val >= m_val) {
+				cur.h = iy_val;
+				cur.c = left.c + add.gap;
+			}
+			else {
+				cur.h = m_val;
+				cur.c = diag.c + column;
+			}
+
+			row[j] = cur;
+			diag = up;
+			left = cur;
+		}
+	}
+
+	score = row[len2].h;
+	return row[len2].c;
+}
+
+//the fill for the gap model of the run, with the constants of its preset
+//folded in
+template <typename ScoreT, typename CountT, bool gapped>
+static CountT _fill(NWAlignParams *params, bool linearGap, ScoreT negInf, const ColumnCounts<CountT> &add,
+		int *seq1, int len1, int *seq2, int len2, int &score) {
+	if(linearGap && MatlabScoring::matches(params)) {
+		return _lingap_count_fill<ScoreT, CountT, gapped, MatlabScoring>(params, add, seq1, len1, seq2, len2, score);
+	}
+	else if(linearGap) {
+		return _lingap_count_fill<ScoreT, CountT, gapped, ParamScoring>(params, add, seq1, len1, seq2, len2, score);
+	}
+	else if(BlastnScoring::matches(params)) {
+		return _count_fill<ScoreT, CountT, gapped, BlastnScoring>(params, negInf, add, seq1, len1, seq2, len2, score);
+	}
+	return _count_fill<ScoreT, CountT, gapped, ParamScoring>(params, negInf, add, seq1, len1, seq2, len2, score);
+}
+
+static
+bool _ungapped(int *seq, int len) {
+	for(int i = 0; i < len; i++) {
+		if(seq[i] == GAP_CHAR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename ScoreT>
+static void _counts(NWAlignParams *params, bool linearGap, ScoreT negInf,
+		int *seq1, int len1, int *seq2, int len2, NWPairCounts *result) {
+	int shorter = (len1 < len2 ? len1 : len2);
+	if(shorter <= (int) NARROW_MASK && _ungapped(seq1, len1) && _ungapped(seq2, len2)) {
+		const ColumnCounts<unsigned int> add = {0, 1, 1 | (1u << NARROW_BITS), 0};
+		unsigned int c = _fill<ScoreT, unsigned int, false>(params, linearGap, negInf, add,
+				seq1, len1, seq2, len2, result->score);
+		result->nongap = (int) (c & NARROW_MASK);
+		result->identities = (int) (c >> NARROW_BITS);
+		result->alignlen = len1 + len2 - result->nongap;
+	}
+	else {
+		const ColumnCounts<unsigned long long> add = {1, 1 | (1ULL << WIDE_BITS),
+				1 | (1ULL << WIDE_BITS) | (1ULL << (2 * WIDE_BITS)), 1};
+		unsigned long long c = _fill<ScoreT, unsigned long long, true>(params, linearGap, negInf, add,
+				seq1, len1, seq2, len2, result->score);
+		result->alignlen = (int) (c & WIDE_MASK);
+		result->nongap = (int) ((c >> WIDE_BITS) & WIDE_MASK);
+		result->identities = (int) (c >> (2 * WIDE_BITS));
+	}
+}
+
+//one definition per instruction set, see nwalign_simd.c
+extern void nwalignCountsSimd_sse41(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result);
+extern void nwalignCountsSimd_avx2(NWAlignParams*, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result);
+extern void nwalignLinearGapCountsSimd_sse41(NWAlignParams*, int *seq1, int len1, int *seq2, int len2,
+		NWPairCounts *result);
+extern void nwalignLinearGapCountsSimd_avx2(NWAlignParams*, int *seq1, int len1, int *seq2, int len2,
+		NWPairCounts *result);
+
+void nwalignCounts(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result) {
+	bool fitsInt16 = nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2);
+	bool vector = (len1 > 0 && len2 > 0 && _ungapped(seq1, len1) && _ungapped(seq2, len2));
+	if(vector && __builtin_cpu_supports("avx2")) {
+		nwalignCountsSimd_avx2(params, seq1, len1, seq2, len2, result);
+	}
+	else if(vector && __builtin_cpu_supports("sse4.1")) {
+		nwalignCountsSimd_sse41(params, seq1, len1, seq2, len2, result);
+	}
+	else if(fitsInt16) {
+		_counts<short>(params, false, NW_NEG_INF16, seq1, len1, seq2, len2, result);
+	}
+	else {
+		_counts<int>(params, false, NW_NEG_INF32, seq1, len1, seq2, len2, result);
+	}
+
+	if(DEBUG1) {
+		fprintf(stderr, "counts score=%d alignlen=%d identities=%d nongap=%d\n",
+				result->score, result->alignlen, result->identities, result->nongap);
+	}
+}
+
+void nwalignLinearGapCounts(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2, NWPairCounts *result) {
+	bool fitsInt16 = nwScoreFitsInt16(params->match, params->mismatch, params->gapopen, params->gapext, len1, len2);
+	bool vector = (len1 > 0 && len2 > 0 && _ungapped(seq1, len1) && _ungapped(seq2, len2));
+	if(vector && __builtin_cpu_supports("avx2")) {
+		nwalignLinearGapCountsSimd_avx2(params, seq1, len1, seq2, len2, result);
+	}
+	else if(vector && __builtin_cpu_supports("sse4.1")) {
+		nwalignLinearGapCountsSimd_sse41(params, seq1, len1, seq2, len2, result);
+	}
+	else if(fitsInt16) {
+		_counts<short>(params, true, NW_NEG_INF16, seq1, len1, seq2, len2, result);
+	}
+	else {
+		_counts<int>(params, true, NW_NEG_INF32, seq1, len1, seq2, len2, result);
+	}
+}
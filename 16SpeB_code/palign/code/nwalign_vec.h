@@ -0,0 +1,95 @@
+//Instruction-set layer shared by the SIMD kernels (nwalign_simd.c,
+//nwalign_batch.c): vec_t, unaligned load/store, bitwise ops and the lane
+//arithmetic of VecOps<T> for int16 and int32 scores.
+//
+//Including files are compiled once per instruction set (see Makefile) with
+//either SIMD_SSE41 or SIMD_AVX2 defined; SIMD_NAME() gives each build's
+//entry points their own suffix.
+
+#ifndef _NWALIGN_VEC_H
+#define _NWALIGN_VEC_H
+
+#if defined(SIMD_AVX2)
+
+#include <immintrin.h>
+#define SIMD_NAME(name) name##_avx2
+#define VBYTES 32
+typedef __m256i vec_t;
+
+#define V_LOAD(p) _mm256_loadu_si256((const vec_t*)(p))
+#define V_STORE(p, v) _mm256_storeu_si256((vec_t*)(p), (v))
+#define V_AND(a, b) _mm256_and_si256((a), (b))
+#define V_OR(a, b) _mm256_or_si256((a), (b))
+#define V_ANDNOT(a, b) _mm256_andnot_si256((a), (b))
+
+#else //SIMD_SSE41
+
+#include <smmintrin.h>
+#define SIMD_NAME(name) name##_sse41
+#define VBYTES 16
+typedef __m128i vec_t;
+
+#define V_LOAD(p) _mm_loadu_si128((const vec_t*)(p))
+#define V_STORE(p, v) _mm_storeu_si128((vec_t*)(p), (v))
+#define V_AND(a, b) _mm_and_si128((a), (b))
+#define V_OR(a, b) _mm_or_si128((a), (b))
+#define V_ANDNOT(a, b) _mm_andnot_si128((a), (b))
+
+#endif
+
+//lane arithmetic for int16 and int32 scores
+template <typename T> struct VecOps;
+
+template <> struct VecOps<short> {
+	enum { LANES = VBYTES / sizeof(short) };
+#if defined(SIMD_AVX2)
+	static inline vec_t set1(int x) { return _mm256_set1_epi16((short) x); }
+	static inline vec_t add(vec_t a, vec_t b) { return _mm256_add_epi16(a, b); }
+	static inline vec_t max(vec_t a, vec_t b) { return _mm256_max_epi16(a, b); }
+	static inline vec_t eq(vec_t a, vec_t b) { return _mm256_cmpeq_epi16(a, b); }
+	static inline void storeBytes(unsigned char *dst, vec_t v) {
+		vec_t p = _mm256_packus_epi16(v, v);
+		p = _mm256_permute4x64_epi64(p, 0xD8);
+		_mm_storeu_si128((__m128i*) dst, _mm256_castsi256_si128(p));
+	}
+#else
+	static inline vec_t set1(int x) { return _mm_set1_epi16((short) x); }
+	static inline vec_t add(vec_t a, vec_t b) { return _mm_add_epi16(a, b); }
+	static inline vec_t max(vec_t a, vec_t b) { return _mm_max_epi16(a, b); }
+	static inline vec_t eq(vec_t a, vec_t b) { return _mm_cmpeq_epi16(a, b); }
+	static inline void storeBytes(unsigned char *dst, vec_t v) {
+		_mm_storel_epi64((__m128i*) dst, _mm_packus_epi16(v, v));
+	}
+#endif
+	static inline vec_t ge(vec_t a, vec_t b) { return eq(max(a, b), a); }
+};
+
+template <> struct VecOps<int> {
+	enum { LANES = VBYTES / sizeof(int) };
+#if defined(SIMD_AVX2)
+	static inline vec_t set1(int x) { return _mm256_set1_epi32(x); }
+	static inline vec_t add(vec_t a, vec_t b) { return _mm256_add_epi32(a, b); }
+	static inline vec_t max(vec_t a, vec_t b) { return _mm256_max_epi32(a, b); }
+	static inline vec_t eq(vec_t a, vec_t b) { return _mm256_cmpeq_epi32(a, b); }
+	static inline void storeBytes(unsigned char *dst, vec_t v) {
+		vec_t p = _mm256_packus_epi32(v, v);
+		p = _mm256_packus_epi16(p, p);
+		p = _mm256_permutevar8x32_epi32(p, _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4));
+		_mm_storel_epi64((__m128i*) dst, _mm256_castsi256_si128(p));
+	}
+#else
+	static inline vec_t set1(int x) { return _mm_set1_epi32(x); }
+	static inline vec_t add(vec_t a, vec_t b) { return _mm_add_epi32(a, b); }
+	static inline vec_t max(vec_t a, vec_t b) { return _mm_max_epi32(a, b); }
+	static inline vec_t eq(vec_t a, vec_t b) { return _mm_cmpeq_epi32(a, b); }
+	static inline void storeBytes(unsigned char *dst, vec_t v) {
+		vec_t p = _mm_packus_epi32(v, v);
+		p = _mm_packus_epi16(p, p);
+		int bytes = _mm_cvtsi128_si32(p);
+		memcpy(dst, &bytes, sizeof(int));
+	}
+#endif
+	static inline vec_t ge(vec_t a, vec_t b) { return eq(max(a, b), a); }
+};
+
+#endif
@@ -0,0 +1,334 @@
+//Gap-affine wavefront alignment (WFA, Marco-Sola et al., Bioinformatics
+//2021) with the scores of nwalign(), for similar sequences.
+//
+//WFA minimizes a penalty instead of maximizing a score.  With identities I,
+//mismatches X and G gap characters in O runs, 2(I+X) + G = N = len1 + len2,
+//so every alignment satisfies
+//
+//    match*N - 2*score = 2(match-mismatch) X + 2(gapext-gapopen) O + (match-2 gapext) G
+//
+//i.e. a penalty of x = 2(match-mismatch) per mismatch and o + e*L per gap of
+//length L with o = 2(gapext-gapopen) and e = match - 2 gapext (6, 6 and 5
+//for the blastn scores), and score = (match*N - penalty) / 2.  The optimal
+//penalty s is found in O((len1+len2) s) time by growing, for s = 0, 1, ...,
+//the furthest-reaching point of every diagonal k = j - i with penalty s.
+//
+//nwalign()'s recurrences never put an Ix cell next to an Iy cell, while WFA
+//allows it; such a pair of gaps is never better than mismatches plus one
+//shorter gap when x <= 2e, which is required below.  Ties are broken as in
+//traceback_align() (Ix before Iy before mismatch, gap extension before
+//opening), but WFA walks co-optimal alignments in another order, so the
+//alignment may be a different one of the same score.
+//
+//When s grows so large that the wavefronts would cost more than the full
+//matrix, the pair goes to nwalign() (or nwalignLinear()) instead.
+
+#include "nwalign.h"
+
+//offset of a diagonal not reached with this penalty
+static const int WF_NONE = INT_MIN / 4;
+
+//wavefronts computed before giving up, relative to the DP cells of the pair
+static const double NW_WFA_BUDGET = 0.25;
+
+enum WfComponent { WF_M, WF_I, WF_D};
+
+typedef struct {
+	NWAlignParams *params;
+	NWWfaWorkspace *ws;
+	int *seq1; //pattern, i = h - k
+	int len1;
+	int *seq2; //text, j = h
+	int len2;
+	int x; //mismatch penalty
+	int oe; //gap open + extend
+	int e; //gap extend
+} WfaState;
+
+//offset of component c on diagonal k of the wavefront for penalty s
+static inline
+int _wf(const WfaState *st, int s, int c, int k) {
+	if(s < 0) {
+		return WF_NONE;
+	}
+	const NWWfaWorkspace *ws = st->ws;
+	long base = ws->base[s];
+	if(base < 0 || k < ws->lo[s] || k > ws->hi[s]) {
+		return WF_NONE;
+	}
+	int width = ws->hi[s] - ws->lo[s] + 1;
+	return ws->offsets[base + (long) c * width + (k - ws->lo[s])];
+}
+
+//offset h on diagonal k if it lies inside the matrix
+static inline
+int _valid(const WfaState *st, int k, int h) {
+	if(h < 0 || h > st->len2 || h - k < 0 || h - k > st->len1) {
+		return WF_NONE;
+	}
+	return h;
+}
+
+static inline
+int _imax(int a, int b) {
+	return (a > b ? a : b);
+}
+
+static inline
+int _imin(int a, int b) {
+	return (a < b ? a : b);
+}
+
+//Iy (insertion into seq1, consumes seq2) on diagonal k for penalty s
+static inline
+int _ins(const WfaState *st, int s, int k) {
+	int h = _imax(_wf(st, s - st->oe, WF_M, k-1), _wf(st, s - st->e, WF_I, k-1));
+	return (h == WF_NONE ? WF_NONE : _valid(st, k, h + 1));
+}
+
+//Ix (deletion from seq1) on diagonal k for penalty s
+static inline
+int _del(const WfaState *st, int s, int k) {
+	int h = _imax(_wf(st, s - st->oe, WF_M, k+1), _wf(st, s - st->e, WF_D, k+1));
+	return (h == WF_NONE ? WF_NONE : _valid(st, k, h));
+}
+
+//mismatch on diagonal k for penalty s
+static inline
+int _mis(const WfaState *st, int s, int k) {
+	int h = _wf(st, s - st->x, WF_M, k);
+	return (h == WF_NONE ? WF_NONE : _valid(st, k, h + 1));
+}
+
+//follows matches along diagonal k from offset h
+static inline
+int _extend(const WfaState *st, int k, int h) {
+	while(h < st->len2 && h - k < st->len1 && st->seq1[h - k] == st->seq2[h]) {
+		h++;
+	}
+	return h;
+}
+
+//Computes the wavefront for penalty s from those of s - x, s - o - e and
+//s - e; returns the number of diagonals it holds.
+static
+int _next_wavefront(WfaState *st, int s) {
+	st->ws = reserveWfaWorkspace(st->params, s + 1, 0);
+	int sources[3] = {s - st->x, s - st->oe, s - st->e};
+	int lo = INT_MAX, hi = INT_MIN;
+	for(int k = 0; k < 3; k++) {
+		int t = sources[k];
+		if(t >= 0 && st->ws->base[t] >= 0) {
+			lo = _imin(lo, st->ws->lo[t] - 1);
+			hi = _imax(hi, st->ws->hi[t] + 1);
+		}
+	}
+	lo = _imax(lo, -st->len1);
+	hi = _imin(hi, st->len2);
+	if(lo > hi) {
+		st->ws->base[s] = -1;
+		return 0;
+	}
+
+	int width = hi - lo + 1;
+	NWWfaWorkspace *ws = reserveWfaWorkspace(st->params, s + 1, 3L * width);
+	st->ws = ws;
+	long base = ws->offsets_used;
+	int *M = ws->offsets + base;
+	int *I = M + width;
+	int *D = I + width;
+	ws->offsets_used += 3L * width;
+	ws->lo[s] = lo;
+	ws->hi[s] = hi;
+	ws->base[s] = -1; //not readable while being computed
+
+	bool any = false;
+	for(int k = lo; k <= hi; k++) {
+		int ins = _ins(st, s, k);
+		int del = _del(st, s, k);
+		int h = _imax(_mis(st, s, k), _imax(ins, del));
+		I[k - lo] = ins;
+		D[k - lo] = del;
+		M[k - lo] = (h == WF_NONE ? WF_NONE : _extend(st, k, h));
+		any = any || (h != WF_NONE);
+	}
+
+	if(!any) {
+		ws->offsets_used = base;
+		return 0;
+	}
+	ws->base[s] = base;
+	return width;
+}
+
+static inline
+void _emit(AlignPair *result, int &align_pos, int c1, int c2) {
+	if(DEBUG0) {
+		assert(align_pos < result->capacity);
+	}
+	result->align1[align_pos] = c1;
+	result->align2[align_pos] = c2;
+	align_pos++;
+}
+
+//walks back from (len1, len2) with penalty s in M
+static
+void _traceback_wfa(const WfaState *st, int s, AlignPair *result) {
+	int *seq1 = st->seq1;
+	int *seq2 = st->seq2;
+	int align_pos = 0;
+	int k = st->len2 - st->len1;
+	int h = st->len2;
+	int state = WF_M;
+	const int total = s;
+	int penalty = 0;
+
+	while(true) {
+		if(state == WF_M) {
+			if(s == 0) {
+				//only matches along diagonal 0 are left
+				for(; h > 0; h--) {
+					_emit(result, align_pos, seq1[h - k - 1], seq2[h - 1]);
+				}
+				break;
+			}
+			int ins = _ins(st, s, k);
+			int del = _del(st, s, k);
+			int mis = _mis(st, s, k);
+			int from = _imax(mis, _imax(ins, del));
+			for(; h > from; h--) {
+				_emit(result, align_pos, seq1[h - k - 1], seq2[h - 1]);
+			}
+			if(del == from) {
+				state = WF_D;
+			}
+			else if(ins == from) {
+				state = WF_I;
+			}
+			else {
+				_emit(result, align_pos, seq1[h - k - 1], seq2[h - 1]);
+				h--;
+				s -= st->x;
+				penalty += st->x;
+			}
+		}
+		else if(state == WF_D) {
+			_emit(result, align_pos, seq1[h - k - 1], GAP_CHAR);
+			if(_wf(st, s - st->e, WF_D, k+1) == h) {
+				s -= st->e;
+				penalty += st->e;
+			}
+			else {
+				s -= st->oe;
+				penalty += st->oe;
+				state = WF_M;
+			}
+			k++;
+		}
+		else {
+			_emit(result, align_pos, GAP_CHAR, seq2[h - 1]);
+			if(_wf(st, s - st->e, WF_I, k-1) == h - 1) {
+				s -= st->e;
+				penalty += st->e;
+			}
+			else {
+				s -= st->oe;
+				penalty += st->oe;
+				state = WF_M;
+			}
+			k--;
+			h--;
+		}
+	}
+
+	if(DEBUG0) {
+		assert(s == 0 && k == 0 && penalty == total);
+	}
+
+	//reverse the alignment
+	int *align1 = result->align1;
+	int *align2 = result->align2;
+	for(int left = 0, right = align_pos-1; left < right; left++, right--) {
+		int temp = align1[left];
+		align1[left] = align1[right];
+		align1[right] = temp;
+		temp = align2[left];
+		align2[left] = align2[right];
+		align2[right] = temp;
+	}
+	result->len = align_pos;
+}
+
+void nwalignWfa(NWAlignParams *params, int *seq1, int len1, int *seq2, int len2,
+		AlignPair* result, NWWfaStats *stats) {
+	WfaState st;
+	st.params = params;
+	st.seq1 = seq1;
+	st.len1 = len1;
+	st.seq2 = seq2;
+	st.len2 = len2;
+	st.x = 2 * (params->match - params->mismatch);
+	st.e = params->match - 2 * params->gapext;
+	st.oe = 2 * (params->gapext - params->gapopen) + st.e;
+
+	bool applies = (st.x > 0 && st.e > 0 && st.oe >= st.e && st.x <= 2 * st.e);
+	double budget = NW_WFA_BUDGET * (len1 + 1.0) * (len2 + 1.0);
+	double offsets = 0;
+
+	int s = -1;
+	if(applies) {
+		st.ws = reserveWfaWorkspace(params, 1, 3);
+		st.ws->offsets_used = 0;
+
+		//penalty 0: matches along diagonal 0
+		st.ws->lo[0] = 0;
+		st.ws->hi[0] = 0;
+		st.ws->base[0] = 0;
+		st.ws->offsets[0] = _extend(&st, 0, 0);
+		st.ws->offsets[1] = WF_NONE;
+		st.ws->offsets[2] = WF_NONE;
+		st.ws->offsets_used = 3;
+
+		const int kEnd = len2 - len1;
+		int cur = 0;
+		while(true) {
+			if(_wf(&st, cur, WF_M, kEnd) >= len2) {
+				s = cur;
+				break;
+			}
+			if(offsets > budget) {
+				break;
+			}
+			cur++;
+			offsets += _next_wavefront(&st, cur);
+		}
+	}
+
+	if(s < 0) {
+		//too divergent (or scores WFA cannot express): full matrix instead
+		if(len1 < params->matrix_capacity && len2 < params->matrix_capacity) {
+			nwalign(params, seq1, len1, seq2, len2, result);
+		}
+		else {
+			nwalignLinear(params, seq1, len1, seq2, len2, result);
+		}
+		if(stats != NULL) {
+			stats->fallback++;
+		}
+		return;
+	}
+
+	_traceback_wfa(&st, s, result);
+	result->score = (params->match * (len1 + len2) - s) / 2;
+
+	if(DEBUG1) {
+		fprintf(stderr, "wfa penalty=%d score=%d offsets=%.0lf\n", s, result->score, offsets);
+	}
+
+	if(stats != NULL) {
+		stats->pairs++;
+		stats->penalty += s;
+		stats->offsets += offsets;
+		stats->cells += (len1 + 1.0) * (len2 + 1.0);
+	}
+}
@@ -0,0 +1,67 @@
+#include "pairrecord.h"
+
+using namespace std;
+
+void appendTsvColumns(TextBuffer *buf) {
+	appendText(buf, "seqind1\tseqind2\tid1\tid2\tpid_over_nongap\tpid_over_alignlen\t"
+			"alignlen\tidentities\tnongap\tscore\n");
+}
+
+//a FASTA header up to its first blank
+static
+void _append_header_id(TextBuffer *buf, const string &header) {
+	size_t end = header.find_first_of(" \t");
+	appendText(buf, header.data(), (end == string::npos ? header.size() : end));
+}
+
+void appendTsvRecord(TextBuffer *buf, int seqind1, int seqind2,
+		const string &header1, const string &header2, const NWPairCounts *counts) {
+	appendInt(buf, seqind1);
+	appendChar(buf, '\t');
+	appendInt(buf, seqind2);
+	appendChar(buf, '\t');
+	_append_header_id(buf, header1);
+	appendChar(buf, '\t');
+	_append_header_id(buf, header2);
+	appendChar(buf, '\t');
+	appendDouble(buf, countsPidOverNongap(counts));
+	appendChar(buf, '\t');
+	appendDouble(buf, countsPidOverAlignlen(counts));
+	appendChar(buf, '\t');
+	appendInt(buf, counts->alignlen);
+	appendChar(buf, '\t');
+	appendInt(buf, counts->identities);
+	appendChar(buf, '\t');
+	appendInt(buf, counts->nongap);
+	appendChar(buf, '\t');
+	appendInt(buf, counts->score);
+	appendChar(buf, '\n');
+}
+
+void appendBinHeader(TextBuffer *buf, int numseqs, const NWScoring *scoring) {
+	PairRecordHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PAIR_RECORD_MAGIC, sizeof(header.magic));
+	header.version = PAIR_RECORD_VERSION;
+	header.headerBytes = sizeof(PairRecordHeader);
+	header.recordBytes = sizeof(PairRecord);
+	header.numseqs = numseqs;
+	header.match = scoring->match;
+	header.mismatch = scoring->mismatch;
+	header.gapopen = scoring->gapopen;
+	header.gapext = scoring->gapext;
+	appendText(buf, (const char*) &header, sizeof(header));
+}
+
+void appendBinRecord(TextBuffer *buf, int seqind1, int seqind2, const NWPairCounts *counts) {
+	PairRecord record;
+	record.seqind1 = seqind1;
+	record.seqind2 = seqind2;
+	record.score = counts->score;
+	record.alignlen = counts->alignlen;
+	record.identities = counts->identities;
+	record.nongap = counts->nongap;
+	record.pidOverNongap = (float) countsPidOverNongap(counts);
+	record.pidOverAlignlen = (float) countsPidOverAlignlen(counts);
+	appendText(buf, (const char*) &record, sizeof(record));
+}
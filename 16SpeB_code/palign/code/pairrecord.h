@@ -0,0 +1,55 @@
+#ifndef _PAIRRECORD_H
+#define _PAIRRECORD_H
+
+#include "stdinc.h"
+#include "nwalign.h"
+#include "textout.h"
+
+#include <stdint.h>
+
+//One record per reported pair for -out-format, in reporting order.
+//
+//tsv: a line of column names, then per pair the sequence indices, the
+//FASTA header ids (up to the first blank), both PIDs as the text output
+//prints them and the counts they come from.
+//
+//bin: a PairRecordHeader, then fixed-width PairRecords up to the end of
+//the file, in the byte order of the machine that wrote them (the header
+//magic reads back wrong otherwise).  A consumer mmap()s the file and
+//takes (size - headerBytes) / recordBytes records after the header.
+
+#define PAIR_RECORD_MAGIC "PALIGNPR"
+#define PAIR_RECORD_VERSION 1
+
+typedef struct {
+	char magic[8]; //PAIR_RECORD_MAGIC, without its '\0'
+	int32_t version;
+	int32_t headerBytes;
+	int32_t recordBytes;
+	int32_t numseqs;
+	int32_t match;
+	int32_t mismatch;
+	int32_t gapopen;
+	int32_t gapext;
+} PairRecordHeader;
+
+typedef struct {
+	int32_t seqind1;
+	int32_t seqind2;
+	int32_t score;
+	int32_t alignlen;
+	int32_t identities;
+	int32_t nongap; //columns without a gap
+	float pidOverNongap; //identities / nongap, 0 without such columns
+	float pidOverAlignlen; //identities / alignlen
+} PairRecord;
+
+//the tsv column names line
+extern void appendTsvColumns(TextBuffer *buf);
+extern void appendTsvRecord(TextBuffer *buf, int seqind1, int seqind2,
+		const string &header1, const string &header2, const NWPairCounts *counts);
+
+extern void appendBinHeader(TextBuffer *buf, int numseqs, const NWScoring *scoring);
+extern void appendBinRecord(TextBuffer *buf, int seqind1, int seqind2, const NWPairCounts *counts);
+
+#endif
@@ -1,118 +1,2102 @@
 #include "stdinc.h"
 #include "Input.h"
 #include "nwalign.h"
+#include "editdist.h"
+#include "aligncache.h"
 #include "DisplayResults.h"
 #include "random.h"
+#include "tilesched.h"
+#include "stagequeue.h"
+#include "textout.h"
+#include "pairrecord.h"
+#include "pidsummary.h"
+#include "pidmatrix.h"
+#include "cigar.h"
+#include "shardmerge.h"
+
+#include <map>
+#include <set>
+#include <thread>
+#include <algorithm>
+#include <stdarg.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 using namespace std;
 
 enum PairType { ALL_PAIR, NEXT_PAIR, RAND_PAIR};
+enum KernelType { SCALAR_KERNEL, SIMD_KERNEL, LINEAR_KERNEL, BAND_KERNEL, BATCH_KERNEL, WFA_KERNEL, ANCHOR_KERNEL, STATS_KERNEL};
+enum OutFormat { TEXT_FORMAT, TSV_FORMAT, BIN_FORMAT};
+
+//sequences longer than this are aligned in linear space by default
+static const int DEFAULT_LINEAR_ABOVE = 5000;
+//diagonals on each side of the length difference in the first -band pass
+static const int DEFAULT_BAND_MARGIN = 32;
+//k-mer length and least coverage of the shorter sequence for -anchor
+static const int DEFAULT_ANCHOR_K = 16;
+static const double DEFAULT_ANCHOR_COVERAGE = 0.5;
+
+//per-run settings used by alignHelper()
+typedef struct {
+	bool printFsa;
+	bool quietOut;
+	KernelType kernel;
+	int linearAbove; //pairs with a longer sequence go to nwalignLinear()
+	int bandMargin;
+	int anchorK;
+	double anchorCoverage;
+	bool verify;
+	double pidThreshold; //classify pairs against this PID if >= 0
+	bool pidOverNongap; //threshold applies to PID over non-gap instead of alignment-length
+	bool exactPid; //with -pid-threshold, still align fully and report the PIDs
+	bool editDistance; //report the unit-cost edit distance instead of aligning
+	bool editPrefilter; //with -pid-threshold, reject pairs by edit distance before nwalign()
+	bool dedup; //collapse sequences of identical content
+	bool dedupStats; //print how many pairs dedup answered
+	const char *cacheFile; //on-disk result cache, NULL for none
+	bool cacheAlignments; //store alignments in it even when not displayed
+	bool linearGaps; //the scalar and stats kernels use one matrix (nwLinearGapScoring())
+	bool hugePages; //transparent huge pages for the DP workspace
+	int threads; //aligning threads, see alignPairsThreaded()
+	OutFormat outFormat; //pairs as text blocks or as pairrecord.h records
+	int pidHistogram; //bins of the PID histogram after the pairs, 0 for none
+	bool pidMatrix; //write the -all-pair PIDs as a pidmatrix.h matrix
+	PidMatrixFormat pidMatrixFormat;
+	bool cigar; //display alignments as a CIGAR string instead of the sequences
+} AlignOptions;
+
+//what the kernels of a pair did, added to the totals of its species when
+//the pair is reported
+typedef struct {
+	NWBandStats band;
+	NWWfaStats wfa;
+	NWAnchorStats anchor;
+	NWPidClassStats pidClass; //how -pid-threshold decided its pairs
+} KernelStats;
+
+//workspaces of one aligning thread
+typedef struct {
+	NWAlignParams *nwparams;
+	AlignPair *verifyPair; //NULL without -verify
+	EditDistParams *editParams; //bit-vector buffers of -edit-distance and -edit-prefilter
+	int seqCapacity; //longest sequence verifyPair and editParams take
+} AlignWorker;
+
+//Sequences of identical content share a class, numbered by first
+//occurrence.  A pair within one class is answered without DP (a sequence
+//aligns with itself without gaps) and every ordered pair of classes is
+//aligned once; later pairs of the same classes reuse what was reported.
+//Only pairs involving a class of several sequences are kept, since no
+//other pair can come back.
+typedef struct {
+	int value; //edit distance or PidClass in the modes reporting only that
+	NWPairCounts counts; //what the PIDs are computed from
+	unsigned char *columns; //DEDUP_* column types if alignments are displayed, else NULL
+	int len;
+} PairResult;
+
+enum DedupColumn { DEDUP_PAIRED, DEDUP_GAP2, DEDUP_GAP1};
+
+//alignment columns kept for reuse per FASTA file; pairs past it are aligned again
+static const long DEDUP_COLUMN_BYTES = 1L << 28;
+
+//the pairs of a run in reporting order
+typedef struct {
+	PairType mode;
+	int numseqs;
+	int numRandPairs;
+	unsigned int seed; //-rand-pair draws
+	long count; //pairs handed out
+	long limit; //-shard: pairs from here on are left to later shards
+	int i; //next -all-pair pair
+	int j;
+} PairStream;
+
+//One FASTA file and what has been reported for it.  -batch plans a few of
+//them ahead of the one being reported.
+typedef struct {
+	Input *input;
+	string fastaFilename;
+	string outFilename; //-batch output, empty otherwise
+	ostream *out; //cout, the outFilename file or staged
+	ostream *sink; //with the writer stage: where the text of staged goes
+	ostringstream *staged;
+	string recordFilename; //-out-format, empty otherwise
+	ofstream *records;
+	TextBuffer recordText; //records not written yet
+	long recordCount;
+	string matrixFilename; //-pid-matrix, empty otherwise
+	PidMatrix *pidMatrix;
+	long matrixPairs; //set when pidMatrix is closed
+	PairStream stream;
+	long pairsCount;
+	PidSummary pidSummary; //the reported PIDs, by -pid-metric
+
+	int *seqClass; //NULL with -no-dedup
+	int *classSize;
+	long numClasses;
+	map<long long, PairResult> pairResults;
+	set<long long> earlierClasses; //-shard: class pairs kept by the pairs of earlier shards
+	long dedupColumnBytes;
+	long dedupCopies; //pairs of identical sequences
+	long dedupReused; //pairs answered from pairResults
+
+	unsigned long long *seqHash; //alignCacheSeqHash() of every sequence, with -cache
+	long cacheHits;
+	long cacheAppended; //alignCache->appended before the first pair
+	long cacheAdded; //set by printRunSummary()
+	long cacheRecords;
+
+	long verifyFailures; //pairs where -verify found the kernel disagreeing with nwalign()
+	long verifySkipped; //pairs -verify had nothing to check against
+	KernelStats stats;
+	long editPrefiltered; //pairs -edit-prefilter answered without nwalign()
+	NWBatchStats batchStats; //work done by the -simd-batch kernel
+} SpeciesRun;
+
+//one pair to report and what computePair() found for it
+typedef struct {
+	SpeciesRun *run;
+	int seqind1; //-1: with -batch, run starts here
+	int seqind2;
+	AlignPair *pair; //the alignment, built or restored
+	bool computed; //computePair() has run
+	int value; //edit distance or PidClass in the modes reporting only that
+	bool prefiltered; //-edit-prefilter ruled the pair out
+	NWPairCounts counts; //STATS_KERNEL result
+	KernelStats stats;
+	bool verified; //-verify has checked the result
+	int verifyFailures;
+	bool verifySkipped; //too long for nwalign() and aligned by nwalignLinear() itself
+	string verifyErrors; //printed when the pair is reported
+} PairJob;
+
+//the thread reporting pairs
+static AlignWorker mainWorker;
+
+//full-matrix DP workspaces of the threads that used one
+static long dpWorkspaces = 0;
+static long dpWorkspaceBytes = 0;
+static long dpWorkspacePeak = 0; //most bytes one pair has used
+static long dpMatrixCapacity = 0;
+
+//-cache: results of earlier runs, keyed by sequence content
+static AlignCache *alignCache = NULL;
+static unsigned int cacheParams = 0;
+
+static
+void initPairJob(PairJob *job, SpeciesRun *run, int seqind1, int seqind2, AlignPair *pair) {
+	job->run = run;
+	job->seqind1 = seqind1;
+	job->seqind2 = seqind2;
+	job->pair = pair;
+	job->computed = false;
+	job->value = 0;
+	job->prefiltered = false;
+	memset(&job->counts, 0, sizeof(job->counts));
+	memset(&job->stats, 0, sizeof(job->stats));
+	job->verified = false;
+	job->verifyFailures = 0;
+	job->verifySkipped = false;
+	job->verifyErrors.clear();
+}
+
+static
+void initAlignWorker(AlignWorker *worker, const AlignOptions &opts, const NWScoring &scoring,
+		int matrixMaxlen, int seqMaxlen) {
+	worker->nwparams = constructNWAlignParams(scoring.match, scoring.mismatch, scoring.gapopen, scoring.gapext,
+			matrixMaxlen);
+	worker->nwparams->hugePages = opts.hugePages;
+	worker->verifyPair = (opts.verify ? constructAlignPair(seqMaxlen, seqMaxlen) : NULL);
+	worker->editParams = (opts.editDistance || opts.editPrefilter ? constructEditDistParams(seqMaxlen) : NULL);
+	worker->seqCapacity = seqMaxlen;
+}
+
+//grows the sequence buffers of worker to sequences of seqlen; -batch does
+//not know the longest sequence of every species up front
+static
+void fitAlignWorker(AlignWorker *worker, int seqlen) {
+	if(seqlen <= worker->seqCapacity) {
+		return;
+	}
+	if(worker->verifyPair != NULL) {
+		nilAlignPair(worker->verifyPair);
+		worker->verifyPair = constructAlignPair(seqlen, seqlen);
+	}
+	if(worker->editParams != NULL) {
+		nilEditDistParams(worker->editParams);
+		worker->editParams = constructEditDistParams(seqlen);
+	}
+	worker->seqCapacity = seqlen;
+}
+
+static
+void nilAlignWorker(AlignWorker *worker) {
+	nilNWAlignParams(worker->nwparams);
+	if(worker->verifyPair != NULL) {
+		nilAlignPair(worker->verifyPair);
+	}
+	if(worker->editParams != NULL) {
+		nilEditDistParams(worker->editParams);
+	}
+}
+
+static
+void addKernelStats(KernelStats *total, const KernelStats *stats) {
+	total->band.pairs += stats->band.pairs;
+	total->band.widened += stats->band.widened;
+	total->band.full += stats->band.full;
+	total->band.passes += stats->band.passes;
+	total->band.cells += stats->band.cells;
+	total->band.fullCells += stats->band.fullCells;
+
+	total->wfa.pairs += stats->wfa.pairs;
+	total->wfa.fallback += stats->wfa.fallback;
+	total->wfa.penalty += stats->wfa.penalty;
+	total->wfa.offsets += stats->wfa.offsets;
+	total->wfa.cells += stats->wfa.cells;
+
+	total->anchor.pairs += stats->anchor.pairs;
+	total->anchor.fallback += stats->anchor.fallback;
+	total->anchor.anchored += stats->anchor.anchored;
+	total->anchor.cells += stats->anchor.cells;
+	total->anchor.fullCells += stats->anchor.fullCells;
+
+	total->pidClass.pairs += stats->pidClass.pairs;
+	total->pidClass.above += stats->pidClass.above;
+	total->pidClass.decidedInDp += stats->pidClass.decidedInDp;
+	total->pidClass.rowsFilled += stats->pidClass.rowsFilled;
+	total->pidClass.rows += stats->pidClass.rows;
+	total->pidClass.traced += stats->pidClass.traced;
+	total->pidClass.tracebackSteps += stats->pidClass.tracebackSteps;
+}
+
+//adds the DP workspace of worker to the process totals
+static
+void addWorkerStats(const AlignWorker *worker) {
+	NWDpWorkspace *dp = worker->nwparams->dp;
+	if(dp != NULL) {
+		dpWorkspaces++;
+		dpWorkspaceBytes += dp->capacity;
+		dpWorkspacePeak = (dp->peak > dpWorkspacePeak ? dp->peak : dpWorkspacePeak);
+		dpMatrixCapacity = worker->nwparams->matrix_capacity;
+	}
+}
 
 static
 void printHelp() {
 	cout << "Pairwise global alignment" << endl << endl
-		<< "Usage: <program name> <seqset-FASTA> [OPTIONS]" << endl <<endl
+		<< "Usage: <program name> <seqset-FASTA> [OPTIONS]" << endl
+		<< "       <program name> -batch <DIR|LIST> [OPTIONS]" << endl
+		<< "       <program name> merge <shard output>..." << endl
+		<< "       <program name> decode-cigar <seqset-FASTA> <-cigar output>" << endl <<endl
 		<< "-s <UINT>" <<endl
-		<< "-quiet             Does not display alignment" <<endl
+		<< "-scoring <NAME>    Scoring preset: blastn (1,-2,-5,-2, default) or matlab (5,-4,-8,-8)" <<endl
+		<< "-match <INT>, -mismatch <INT>, -gapopen <INT>, -gapext <INT>" <<endl
+		<< "                   Override one value of the preset" <<endl
+		<< "-quiet             Does not display alignment (PIDs from a traceback-free kernel)" <<endl
 		<< "-print-fsa         Print FASTA in STDERR" <<endl
+		<< "-cigar             Display each alignment as a CIGAR string (=/X/I/D, the first sequence" <<endl
+		<< "                   as reference) instead of the original and gapped sequences" <<endl
+		<< "-traceback         Build alignments with the scalar kernel even with -quiet" <<endl
+		<< "-simd              Vectorized (SSE4.1/AVX2) alignment kernel" <<endl
+		<< "-linear-space      Divide-and-conquer kernel in linear memory" <<endl
+		<< "-linear-above <INT> Use -linear-space for sequences longer than this (default " << DEFAULT_LINEAR_ABOVE << ")" <<endl
+		<< "-simd-batch        With -all-pair, align each sequence against the later ones in SIMD lanes" <<endl
+		<< "-wfa               Wavefront kernel, same score (co-optimal alignment), fast on similar pairs" <<endl
+		<< "-anchor            Align only between unique shared k-mers (heuristic, near-optimal)" <<endl
+		<< "-anchor-k <INT>    k-mer length for -anchor, at most 16 (default " << DEFAULT_ANCHOR_K << ")" <<endl
+		<< "-anchor-min-coverage <FLOAT> Align in full below this anchor coverage (default " << DEFAULT_ANCHOR_COVERAGE << ")" <<endl
+		<< "-band              Banded kernel, widened until provably equal to full DP" <<endl
+		<< "-band-margin <INT> Initial band half-width for -band (default " << DEFAULT_BAND_MARGIN << ")" <<endl
+		<< "-verify            Check every alignment (with -wfa, -anchor: its score) against the scalar kernel" <<endl
+		<< "-pid-threshold <FLOAT> Only report whether each pair's PID is above/below this" <<endl
+		<< "-pid-metric <alignlen|nongap> PID used by -pid-threshold and the PID summary (default alignlen)" <<endl
+		<< "-pid-histogram <INT> After the PID summary of a species, the PID counts in this many bins" <<endl
+		<< "-exact-pid         With -pid-threshold, also align fully and report the PIDs" <<endl
+		<< "-edit-distance     Report unit-cost edit distance and identity from it, no alignment" <<endl
+		<< "-edit-prefilter    With -pid-threshold (alignlen), reject pairs by edit distance first" <<endl
+		<< "-no-dedup          Align identical sequences and repeated pairs of them again" <<endl
+		<< "-dedup-stats       Print how many sequences are distinct and how many pairs were reused" <<endl
+		<< "-cache <FILE>      Reuse and add to the alignment results stored in FILE" <<endl
+		<< "-cache-alignments  Also store alignments in the -cache file, not only their PIDs" <<endl
+		<< "-huge-pages        Ask for transparent huge pages for large DP workspaces" <<endl
+		<< "-threads <INT>     Align on this many threads, same output (default 1, not with -simd-batch);" <<endl
+		<< "                   the output is written, and -batch files read, on threads of their own" <<endl
 		<< endl
 		<< "-all-pair          All possible pairs (n-choose-2 pairs)" <<endl
 		<< "-next-pair         Every next pair (n/2 pairs)" <<endl
 		<< "-rand-pair <INT>   Sample specified number of pairs "<<endl
+		<< endl
+		<< "-batch <DIR|LIST>  In place of the FASTA file: every *.fsa of DIR, or every FASTA file" <<endl
+		<< "                   listed in LIST (- for one per line of STDIN, read as they come)," <<endl
+		<< "                   aligned by one process on one pool of -threads" <<endl
+		<< "-out-dir <DIR>     Write the -batch <FASTA name>.txt, the -out-format records and the" <<endl
+		<< "                   -pid-matrix files here (default: next to the FASTA file)" <<endl
+		<< "-out-format <tsv|bin> Write one record per pair (ids, PIDs, alignment length, identities," <<endl
+		<< "                   score) to <FASTA name>.tsv or .bin, next to the FASTA file or in -out-dir," <<endl
+		<< "                   instead of the pair blocks (text, the default); bin is laid out in pairrecord.h" <<endl
+		<< "-pid-matrix <f32|u16> With -all-pair, also write the PIDs (by -pid-metric) as a condensed" <<endl
+		<< "                   upper-triangular matrix to <FASTA name>.pidm (float, or uint16 fixed point)," <<endl
+		<< "                   laid out in pidmatrix.h, and the FASTA headers to <FASTA name>.ids" <<endl
+		<< "-rand-above <INT>  With -batch, -rand-pair only files of more sequences, -all-pair the others" <<endl
+		<< endl
+		<< "-shard <INT>/<N>   Only the given slice (from 0) of N slices of the pairs, of about equal cost (needs -s)" <<endl
+		<< "merge              Print the output of the whole run from the outputs of all N -shard runs" <<endl
+		<< "decode-cigar       Print the -print-fsa view of every pair of a -cigar output of seqset-FASTA" <<endl
 		<<endl;
 	exit(1);
 }
 
+//printf() into out, cout or a -batch output file
+static
+void printOut(ostream &out, const char *format, ...) {
+	char line[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	out<<line;
+}
+
+//assigns seqClass by hashing the content of every sequence
+static
+void classifySequences(SpeciesRun *run) {
+	Seqset *seqset = run->input->seqset;
+	int numseqs = seqset->numseqs;
+	int *seqClass = (int*) malloc(sizeof(int) * numseqs);
+	int *classSize = (int*) malloc(sizeof(int) * numseqs);
+	vector<int> firstOfClass;
+	map<unsigned long long, vector<int> > classesByHash;
+	int numClasses = 0;
+
+	for(int i = 0; i < numseqs; i++) {
+		int *seq = seqset->seqs[i];
+		int len = seqset->seqlen[i];
+		unsigned long long hash = alignCacheSeqHash(seq, len);
+
+		//empty sequences stay apart: their PIDs are not those of a copy
+		vector<int> &candidates = classesByHash[hash];
+		seqClass[i] = -1;
+		for(size_t k = 0; k < candidates.size() && len > 0; k++) {
+			int rep = firstOfClass[candidates[k]];
+			if(seqset->seqlen[rep] == len && memcmp(seqset->seqs[rep], seq, sizeof(int) * len) == 0) {
+				seqClass[i] = candidates[k];
+				break;
+			}
+		}
+		if(seqClass[i] < 0) {
+			seqClass[i] = numClasses++;
+			candidates.push_back(seqClass[i]);
+			firstOfClass.push_back(i);
+			classSize[seqClass[i]] = 0;
+		}
+		classSize[seqClass[i]]++;
+	}
+	run->seqClass = seqClass;
+	run->classSize = classSize;
+	run->numClasses = numClasses;
+}
+
+static
+bool isCopyPair(const SpeciesRun *run, int seqind1, int seqind2) {
+	return (run->seqClass != NULL && run->seqClass[seqind1] == run->seqClass[seqind2]);
+}
+
+//the ordered pair of classes of seqind1 and seqind2, as pairResults keys it
+static
+long long classPairKey(const SpeciesRun *run, int seqind1, int seqind2) {
+	return (long long) run->seqClass[seqind1] * run->numClasses + run->seqClass[seqind2];
+}
+
+//true if a result of the classes of seqind1 and seqind2 is kept once reported
+static
+bool keepsPairResult(const SpeciesRun *run, int seqind1, int seqind2) {
+	return (run->seqClass != NULL
+			&& (run->classSize[run->seqClass[seqind1]] > 1 || run->classSize[run->seqClass[seqind2]] > 1));
+}
+
+//what an earlier pair of the same classes reported, NULL if none
+static
+PairResult* findPairResult(SpeciesRun *run, int seqind1, int seqind2) {
+	if(run->seqClass == NULL) {
+		return NULL;
+	}
+	map<long long, PairResult>::iterator it = run->pairResults.find(classPairKey(run, seqind1, seqind2));
+	return (it == run->pairResults.end() ? NULL : &(it->second));
+}
+
+//keeps the result of a pair for later pairs of the same classes; pair
+//holds the alignment when it is displayed, NULL otherwise, and counts the
+//numbers of the PIDs, NULL in the modes reporting only value
+static
+void storePairResult(SpeciesRun *run, int seqind1, int seqind2, int value, AlignPair *pair,
+		const NWPairCounts *counts) {
+	if(!keepsPairResult(run, seqind1, seqind2)) {
+		return;
+	}
+	PairResult result;
+	result.value = value;
+	memset(&result.counts, 0, sizeof(result.counts));
+	if(counts != NULL) {
+		result.counts = *counts;
+	}
+	result.columns = NULL;
+	result.len = 0;
+	if(pair != NULL) {
+		if(run->dedupColumnBytes + pair->len > DEDUP_COLUMN_BYTES) {
+			return;
+		}
+		result.columns = (unsigned char*) malloc(pair->len);
+		for(int k = 0; k < pair->len; k++) {
+			result.columns[k] = (pair->align2[k] == GAP_CHAR ? DEDUP_GAP2
+					: (pair->align1[k] == GAP_CHAR ? DEDUP_GAP1 : DEDUP_PAIRED));
+		}
+		result.len = pair->len;
+		run->dedupColumnBytes += pair->len;
+	}
+	run->pairResults[classPairKey(run, seqind1, seqind2)] = result;
+}
+
+//rebuilds a kept alignment for another pair of the same classes
+static
+void restorePairResult(const PairResult *result, int *seq1, int *seq2, AlignPair *pair) {
+	int i = 0, j = 0;
+	for(int k = 0; k < result->len; k++) {
+		pair->align1[k] = (result->columns[k] == DEDUP_GAP1 ? GAP_CHAR : seq1[i++]);
+		pair->align2[k] = (result->columns[k] == DEDUP_GAP2 ? GAP_CHAR : seq2[j++]);
+	}
+	pair->len = result->len;
+	pair->score = result->counts.score;
+}
+
+static
+void initPairStream(PairStream *stream, PairType mode, int numseqs, int numRandPairs, unsigned int seed) {
+	stream->mode = mode;
+	stream->numseqs = numseqs;
+	stream->numRandPairs = numRandPairs;
+	stream->seed = seed;
+	stream->count = 0;
+	stream->limit = LONG_MAX;
+	stream->i = 0;
+	stream->j = 1;
+}
+
+//next pair into seqind1 and seqind2, false after the last one.  The k-th
+//-rand-pair pair is drawn from stream k of RandomAt(), so it depends on
+//nothing but the seed and k.
+static
+bool nextPair(PairStream *stream, int &seqind1, int &seqind2) {
+	int numseqs = stream->numseqs;
+	if(stream->count >= stream->limit) {
+		return false;
+	}
+	if(stream->mode == NEXT_PAIR) {
+		if(2 * stream->count >= numseqs) {
+			return false;
+		}
+		seqind1 = (int) (2 * stream->count);
+		seqind2 = seqind1 + 1;
+	}
+	else if(stream->mode == ALL_PAIR) {
+		while(stream->i < numseqs && stream->j >= numseqs) {
+			stream->i++;
+			stream->j = stream->i + 1;
+		}
+		if(stream->i >= numseqs) {
+			return false;
+		}
+		seqind1 = stream->i;
+		seqind2 = stream->j++;
+	}
+	else {
+		//fewer than two sequences have no pair to draw
+		if(stream->count >= stream->numRandPairs || numseqs < 2) {
+			return false;
+		}
+		unsigned long long draw = 0;
+		do {
+			seqind1 = (int) (RandomAt(stream->seed, stream->count, draw++) * numseqs);
+			seqind2 = (int) (RandomAt(stream->seed, stream->count, draw++) * numseqs);
+		}while(seqind1 == seqind2);
+	}
+	stream->count++;
+	return true;
+}
+
+//-shard: what the pairs of a run cost to cut it, DP cells and one for the
+//pair itself
+static
+double shardPairCost(const SpeciesRun *run, int seqind1, int seqind2) {
+	if(isCopyPair(run, seqind1, seqind2)) {
+		return 1;
+	}
+	return (double) (run->input->seqset->seqlen[seqind1] + 1) * (run->input->seqset->seqlen[seqind2] + 1) + 1;
+}
+
+//Restricts run to shard of numShards.  The pairs of its stream are cut
+//into numShards consecutive ranges of about the same cost, pair k going to
+//shard floor(cost before k * numShards / total cost), so every shard picks
+//its range alone and the shard outputs one after the other are the output
+//of the whole run.  The class pairs kept before the range are noted, since
+//the whole run answers their later pairs from the kept ones.
+static
+void initShard(SpeciesRun *run, int shard, int numShards) {
+	int seqind1, seqind2;
+	double total = 0;
+	PairStream stream = run->stream;
+	while(nextPair(&stream, seqind1, seqind2)) {
+		total += shardPairCost(run, seqind1, seqind2);
+	}
+
+	long first = -1;
+	long last = 0;
+	double cost = 0;
+	stream = run->stream;
+	while(nextPair(&stream, seqind1, seqind2)) {
+		int owner = (int) floor(cost * numShards / total);
+		if(owner > shard) {
+			break;
+		}
+		if(owner == shard && first < 0) {
+			first = last;
+		}
+		last++;
+		cost += shardPairCost(run, seqind1, seqind2);
+	}
+	if(first < 0) {
+		first = last;
+	}
+
+	for(long k = 0; k < first && nextPair(&run->stream, seqind1, seqind2); k++) {
+		if(!isCopyPair(run, seqind1, seqind2) && keepsPairResult(run, seqind1, seqind2)) {
+			run->earlierClasses.insert(classPairKey(run, seqind1, seqind2));
+		}
+	}
+	run->stream.limit = last;
+}
+
+//sets up run for the sequences of input, which it takes over
+static
+void initSpeciesRun(SpeciesRun *run, const AlignOptions &opts, Input *input,
+		PairType mode, int numRandPairs, unsigned int seed) {
+	int numseqs = input->seqset->numseqs;
+	run->input = input;
+	run->out = &cout;
+	run->sink = NULL;
+	run->staged = NULL;
+	run->records = NULL;
+	initTextBuffer(&run->recordText);
+	run->recordCount = 0;
+	run->pidMatrix = NULL;
+	run->matrixPairs = 0;
+	initPairStream(&run->stream, mode, numseqs, numRandPairs, seed);
+	run->pairsCount = 0;
+	initPidSummary(&run->pidSummary);
+
+	run->seqClass = NULL;
+	run->classSize = NULL;
+	run->numClasses = 0;
+	run->pairResults.clear();
+	run->earlierClasses.clear();
+	run->dedupColumnBytes = 0;
+	run->dedupCopies = 0;
+	run->dedupReused = 0;
+	if(opts.dedup) {
+		classifySequences(run);
+	}
+
+	run->seqHash = NULL;
+	if(alignCache != NULL) {
+		run->seqHash = (unsigned long long*) malloc(sizeof(unsigned long long) * numseqs);
+		for(int k = 0; k < numseqs; k++) {
+			run->seqHash[k] = alignCacheSeqHash(input->seqset->seqs[k], input->seqset->seqlen[k]);
+		}
+	}
+	run->cacheHits = 0;
+	run->cacheAppended = (alignCache != NULL ? alignCache->appended : 0);
+	run->cacheAdded = 0;
+	run->cacheRecords = 0;
+
+	run->verifyFailures = 0;
+	run->verifySkipped = 0;
+	memset(&run->stats, 0, sizeof(run->stats));
+	run->editPrefiltered = 0;
+	memset(&run->batchStats, 0, sizeof(run->batchStats));
+}
+
+static
+void freeSpeciesRun(SpeciesRun *run) {
+	for(map<long long, PairResult>::iterator it = run->pairResults.begin(); it != run->pairResults.end(); ++it) {
+		free(it->second.columns);
+	}
+	run->pairResults.clear();
+	free(run->seqClass);
+	free(run->classSize);
+	free(run->seqHash);
+	delete run->input;
+}
+
+static
+AlignCacheKey cacheKey(const SpeciesRun *run, int seqind1, int seqind2) {
+	AlignCacheKey key;
+	key.hash1 = run->seqHash[seqind1];
+	key.hash2 = run->seqHash[seqind2];
+	key.len1 = run->input->seqset->seqlen[seqind1];
+	key.len2 = run->input->seqset->seqlen[seqind2];
+	key.params = cacheParams;
+	return key;
+}
+
+//result of an earlier run for this pair, with its alignment if displayed
+static
+bool findCachedPair(const SpeciesRun *run, int seqind1, int seqind2, const AlignOptions &opts, AlignCacheEntry *entry) {
+	if(alignCache == NULL) {
+		return false;
+	}
+	AlignCacheKey key = cacheKey(run, seqind1, seqind2);
+	return lookupAlignCache(alignCache, &key, opts.printFsa || !opts.quietOut, entry);
+}
+
+//adds a newly computed alignment to the -cache file
+static
+void cachePair(const SpeciesRun *run, int seqind1, int seqind2, const AlignOptions &opts, AlignPair *pair) {
+	if(alignCache != NULL) {
+		AlignCacheKey key = cacheKey(run, seqind1, seqind2);
+		NWPairCounts counts;
+		computePairCounts(pair, &counts);
+		bool withAlignment = (opts.cacheAlignments || opts.printFsa || !opts.quietOut);
+		appendAlignCache(alignCache, &key, &counts, (withAlignment ? pair : NULL));
+	}
+}
+
+static
+void runKernel(const AlignOptions &opts, AlignWorker *worker, KernelStats *stats,
+		int *seq1, int seqlen1, int *seq2, int seqlen2, AlignPair *pair) {
+	NWAlignParams *nwparams = worker->nwparams;
+	if(opts.kernel == WFA_KERNEL) {
+		nwalignWfa(nwparams, seq1, seqlen1, seq2, seqlen2, pair, &stats->wfa);
+	}
+	else if(opts.kernel == ANCHOR_KERNEL) {
+		nwalignAnchored(nwparams, opts.anchorK, opts.anchorCoverage, seq1, seqlen1, seq2, seqlen2, pair, &stats->anchor);
+	}
+	else if(opts.kernel == LINEAR_KERNEL || seqlen1 > opts.linearAbove || seqlen2 > opts.linearAbove) {
+		nwalignLinear(nwparams, seq1, seqlen1, seq2, seqlen2, pair);
+	}
+	else if(opts.kernel == SIMD_KERNEL || opts.kernel == BATCH_KERNEL) {
+		nwalignSimd(nwparams, seq1, seqlen1, seq2, seqlen2, pair);
+	}
+	else if(opts.kernel == BAND_KERNEL) {
+		nwalignBanded(nwparams, opts.bandMargin, seq1, seqlen1, seq2, seqlen2, pair, &stats->band);
+	}
+	else if(opts.linearGaps) {
+		nwalignLinearGap(nwparams, seq1, seqlen1, seq2, seqlen2, pair);
+	}
+	else {
+		nwalign(nwparams, seq1, seqlen1, seq2, seqlen2, pair);
+	}
+}
+
+//true if -pid-threshold answers above/below without building alignments
+static
+bool classifiesOnly(const AlignOptions &opts) {
+	return (opts.pidThreshold >= 0 && !opts.exactPid && !opts.printFsa);
+}
+
+//true if alignHelper() classifies the pair with nwalignPidClass(), which
+//takes nwalign() sized pairs only
+static
+bool classifiesPair(const AlignOptions &opts, const NWAlignParams *nwparams, int seqlen1, int seqlen2) {
+	return (classifiesOnly(opts) && seqlen1 < nwparams->matrix_capacity && seqlen2 < nwparams->matrix_capacity);
+}
+
+//true if computePair() builds an alignment for the pair
+static
+bool computesAlignment(const AlignOptions &opts, const NWAlignParams *nwparams, int seqlen1, int seqlen2) {
+	return (!opts.editDistance && !classifiesPair(opts, nwparams, seqlen1, seqlen2) && opts.kernel != STATS_KERNEL);
+}
+
+//checks (with -verify) the alignment in job->pair against nwalign()
+static
+void verifyAlignment(PairJob *job, const AlignOptions &opts, AlignWorker *worker) {
+	Input *input = job->run->input;
+	int seqind1 = job->seqind1;
+	int seqind2 = job->seqind2;
+	int *seq1 = input->seqset->seqs[seqind1];
+	int *seq2 = input->seqset->seqs[seqind2];
+	int seqlen1 = input->seqset->seqlen[seqind1];
+	int seqlen2 = input->seqset->seqlen[seqind2];
+	NWAlignParams *nwparams = worker->nwparams;
+	AlignPair *pair = job->pair;
+	AlignPair *verifyPair = worker->verifyPair;
+	job->verified = true;
+	if(verifyPair == NULL) {
+		return;
+	}
+
+	//nwalign() is limited to matrix_capacity.  Longer pairs are checked
+	//against nwalignLinear(), which gives the same alignment, but that is
+	//what runKernel() aligns them with unless the kernel is -wfa or -anchor.
+	if(seqlen1 < nwparams->matrix_capacity && seqlen2 < nwparams->matrix_capacity) {
+		nwalign(nwparams, seq1, seqlen1, seq2, seqlen2, verifyPair);
+	}
+	else if(opts.kernel == WFA_KERNEL || opts.kernel == ANCHOR_KERNEL) {
+		nwalignLinear(nwparams, seq1, seqlen1, seq2, seqlen2, verifyPair);
+	}
+	else {
+		job->verifySkipped = true;
+		return;
+	}
+	ostringstream errors;
+	//-wfa and the linear-gap kernel may pick another alignment of the
+	//same score, -anchor may miss the optimum by going through a wrong
+	//anchor
+	if(opts.kernel == WFA_KERNEL || opts.kernel == ANCHOR_KERNEL
+			|| (opts.kernel == SCALAR_KERNEL && opts.linearGaps)) {
+		if(pair->score != verifyPair->score) {
+			errors<<"Error: score of "<<seqind1<<" and "<<seqind2<<" is "<<pair->score
+				<<", nwalign() has "<<verifyPair->score<<endl;
+			job->verifyFailures++;
+		}
+	}
+	else if(pair->len != verifyPair->len
+			|| memcmp(pair->align1, verifyPair->align1, sizeof(int) * pair->len) != 0
+			|| memcmp(pair->align2, verifyPair->align2, sizeof(int) * pair->len) != 0) {
+		errors<<"Error: alignment of "<<seqind1<<" and "<<seqind2<<" differs from nwalign()"<<endl;
+		job->verifyFailures++;
+	}
+	job->verifyErrors += errors.str();
+}
+
+//checks (with -verify) job->counts against the alignment they stand for
+static
+void verifyCounts(PairJob *job, const AlignOptions &opts, AlignWorker *worker) {
+	Input *input = job->run->input;
+	int seqind1 = job->seqind1;
+	int seqind2 = job->seqind2;
+	int *seq1 = input->seqset->seqs[seqind1];
+	int *seq2 = input->seqset->seqs[seqind2];
+	int seqlen1 = input->seqset->seqlen[seqind1];
+	int seqlen2 = input->seqset->seqlen[seqind2];
+	NWAlignParams *nwparams = worker->nwparams;
+	AlignPair *verifyPair = worker->verifyPair;
+	job->verified = true;
+	if(verifyPair == NULL) {
+		return;
+	}
+
+	//past matrix_capacity, nwalignLinear() gives the nwalign() alignment,
+	//but nothing gives the nwalignLinearGap() one
+	if(seqlen1 < nwparams->matrix_capacity && seqlen2 < nwparams->matrix_capacity) {
+		nwalign(nwparams, seq1, seqlen1, seq2, seqlen2, verifyPair);
+	}
+	else if(!opts.linearGaps) {
+		nwalignLinear(nwparams, seq1, seqlen1, seq2, seqlen2, verifyPair);
+	}
+	else {
+		job->verifySkipped = true;
+		return;
+	}
+	ostringstream errors;
+	NWPairCounts expected;
+	if(opts.linearGaps && job->counts.score != verifyPair->score) {
+		errors<<"Error: score of "<<seqind1<<" and "<<seqind2<<" is "<<job->counts.score
+			<<", nwalign() has "<<verifyPair->score<<endl;
+		job->verifyFailures++;
+	}
+	if(opts.linearGaps) {
+		nwalignLinearGap(nwparams, seq1, seqlen1, seq2, seqlen2, verifyPair);
+	}
+	computePairCounts(verifyPair, &expected);
+	if(memcmp(&job->counts, &expected, sizeof(expected)) != 0) {
+		errors<<"Error: counts of "<<seqind1<<" and "<<seqind2<<" differ from "
+			<<(opts.linearGaps ? "nwalignLinearGap()" : "nwalign()")<<endl;
+		job->verifyFailures++;
+	}
+	job->verifyErrors += errors.str();
+}
+
+//The kernel work of a pair that no copy, earlier pair of its classes or
+//cache entry answers.  Touches nothing but job and worker, so -threads
+//workers run it ahead of alignHelper().
+static
+void computePair(PairJob *job, const AlignOptions &opts, AlignWorker *worker) {
+	Input *input = job->run->input;
+	int *seq1 = input->seqset->seqs[job->seqind1];
+	int *seq2 = input->seqset->seqs[job->seqind2];
+	int seqlen1 = input->seqset->seqlen[job->seqind1];
+	int seqlen2 = input->seqset->seqlen[job->seqind2];
+	NWAlignParams *nwparams = worker->nwparams;
+	fitAlignWorker(worker, input->seqset->maxseqlen);
+
+	if(opts.editDistance) {
+		job->value = editDistance(worker->editParams, seq1, seqlen1, seq2, seqlen2);
+	}
+	else if(classifiesPair(opts, nwparams, seqlen1, seqlen2)) {
+		//the edit distance caps the PID over alignment-length of every alignment
+		if(opts.editPrefilter && !opts.pidOverNongap
+				&& editDistancePidBound(editDistance(worker->editParams, seq1, seqlen1, seq2, seqlen2),
+					seqlen1, seqlen2) < opts.pidThreshold) {
+			job->value = PID_BELOW;
+			job->prefiltered = true;
+		}
+		else {
+			job->value = nwalignPidClass(nwparams, seq1, seqlen1, seq2, seqlen2,
+					opts.pidThreshold, opts.pidOverNongap, &job->stats.pidClass);
+		}
+	}
+	else if(opts.kernel == STATS_KERNEL) {
+		//only the PIDs are displayed, so no alignment is built
+		if(opts.linearGaps) {
+			nwalignLinearGapCounts(nwparams, seq1, seqlen1, seq2, seqlen2, &job->counts);
+		}
+		else {
+			nwalignCounts(nwparams, seq1, seqlen1, seq2, seqlen2, &job->counts);
+		}
+		verifyCounts(job, opts, worker);
+	}
+	else {
+		runKernel(opts, worker, &job->stats, seq1, seqlen1, seq2, seqlen2, job->pair);
+		verifyAlignment(job, opts, worker);
+	}
+	job->computed = true;
+}
+
+//prints and counts what -verify found for job
+static
+void reportVerify(PairJob *job) {
+	cerr<<job->verifyErrors;
+	job->run->verifyFailures += job->verifyFailures;
+	job->run->verifySkipped += (job->verifySkipped ? 1 : 0);
+}
+
+//The text of the pair being reported is put together here and written
+//to the output at once; only the reporting thread formats.
+static TextBuffer reportText;
+
+//the first lines of every reported pair
+static
+void appendPairHeaders(TextBuffer *text, Input *input, int seqind1, int seqind2) {
+	appendChar(text, '>');
+	appendText(text, input->fastaHeaders[seqind1]);
+	appendText(text, "\n>");
+	appendText(text, input->fastaHeaders[seqind2]);
+	appendChar(text, '\n');
+}
+
+static
+void appendPidClass(TextBuffer *text, const AlignOptions &opts, bool above) {
+	appendText(text, "PID threshold ");
+	appendDouble(text, opts.pidThreshold);
+	appendText(text, (above ? ": above\n" : ": below\n"));
+}
+
+//the last lines of every reported pair
+static
+void appendPairEnd(TextBuffer *text) {
+	appendText(text, "\n===================================================================\n\n");
+}
+
+//-out-format records are written in blocks of about this size
+static const size_t RECORD_BLOCK_BYTES = 1 << 16;
+
+//the output file next to fastaFilename, or in outDir if not empty, named
+//after it with extension
+static
+string outputFilename(const string &outDir, const string &fastaFilename, const char *extension) {
+	size_t slash = fastaFilename.rfind('/');
+	size_t dot = fastaFilename.rfind('.');
+	string stem = (dot != string::npos && (slash == string::npos || dot > slash)
+			? fastaFilename.substr(0, dot) : fastaFilename);
+	if(!outDir.empty()) {
+		stem = outDir + "/" + (slash == string::npos ? stem : stem.substr(slash + 1));
+	}
+	return stem + extension;
+}
+
+//-out-format: opens the records of run, written by the reporting thread
+static
+void openPairRecords(const AlignOptions &opts, const NWScoring &scoring, const string &outDir, SpeciesRun *run) {
+	run->recordFilename = outputFilename(outDir, run->fastaFilename, (opts.outFormat == TSV_FORMAT ? ".tsv" : ".bin"));
+	run->records = new ofstream(run->recordFilename.c_str(), ios::binary);
+	if(!run->records->is_open()) {
+		cerr<<"Error: cannot write "<<run->recordFilename<<endl;
+		exit(1);
+	}
+	if(opts.outFormat == TSV_FORMAT) {
+		appendTsvColumns(&run->recordText);
+	}
+	else {
+		appendBinHeader(&run->recordText, run->input->seqset->numseqs, &scoring);
+	}
+}
+
+static
+void appendPairRecord(SpeciesRun *run, const AlignOptions &opts, int seqind1, int seqind2, const NWPairCounts *counts) {
+	if(opts.outFormat == TSV_FORMAT) {
+		appendTsvRecord(&run->recordText, seqind1, seqind2,
+				run->input->fastaHeaders[seqind1], run->input->fastaHeaders[seqind2], counts);
+	}
+	else {
+		appendBinRecord(&run->recordText, seqind1, seqind2, counts);
+	}
+	run->recordCount++;
+	if(run->recordText.len >= RECORD_BLOCK_BYTES) {
+		writeTextBuffer(&run->recordText, *run->records);
+	}
+}
+
+//-out-format: writes the records of run still buffered and closes them
+static
+void closePairRecords(SpeciesRun *run) {
+	if(run->records == NULL) {
+		return;
+	}
+	writeTextBuffer(&run->recordText, *run->records);
+	run->records->close();
+	if(run->records->fail()) {
+		cerr<<"Error: cannot write "<<run->recordFilename<<endl;
+		exit(1);
+	}
+	delete run->records;
+	run->records = NULL;
+	freeTextBuffer(&run->recordText);
+}
+
+//-pid-matrix: creates the matrix of run, filled by the reporting thread,
+//and its index: the FASTA headers, the one of sequence k on line k + 1
+static
+void openRunPidMatrix(const AlignOptions &opts, const NWScoring &scoring, const string &outDir, SpeciesRun *run) {
+	Input *input = run->input;
+	run->matrixFilename = outputFilename(outDir, run->fastaFilename, ".pidm");
+	run->pidMatrix = openPidMatrix(run->matrixFilename.c_str(), input->seqset->numseqs,
+			opts.pidMatrixFormat, opts.pidOverNongap, &scoring);
+	string idsFilename = outputFilename(outDir, run->fastaFilename, ".ids");
+	ofstream ids(idsFilename.c_str());
+	for(int k = 0; k < input->seqset->numseqs; k++) {
+		ids<<input->fastaHeaders[k]<<'\n';
+	}
+	ids.close();
+	if(ids.fail()) {
+		cerr<<"Error: cannot write "<<idsFilename<<endl;
+		exit(1);
+	}
+}
+
+//-pid-matrix: unmaps the matrix of run, keeping how many pairs it got
+static
+void closeRunPidMatrix(SpeciesRun *run) {
+	if(run->pidMatrix == NULL) {
+		return;
+	}
+	run->matrixPairs = run->pidMatrix->written;
+	closePidMatrix(run->pidMatrix);
+	run->pidMatrix = NULL;
+}
+
+//displays a pair; the alignment in pair is only read with -print-fsa or
+//without -quiet
+static
+void printPair(
+		SpeciesRun *run,
+		int seqind1, 
+		int seqind2, 
+		const AlignOptions &opts, 
+		AlignPair *pair, 
+		const NWPairCounts *counts
+		) {
+	Input *input = run->input;
+	TextBuffer *text = &reportText;
+	double pidOverNongap = countsPidOverNongap(counts);
+	double pidOverAlignlen = countsPidOverAlignlen(counts);
+	int *seq1 = input->seqset->seqs[seqind1];
+	int *seq2 = input->seqset->seqs[seqind2];
+
+	int seqlen1 = input->seqset->seqlen[seqind1];
+	int seqlen2 = input->seqset->seqlen[seqind2];
+
+	if(opts.printFsa) {
+		appendGappedFasta(text, input, seqind1, seqind2, pair, counts);
+		writeTextBuffer(text, cerr);
+	}
+	if(opts.pidThreshold >= 0) {
+		double pid = (opts.pidOverNongap ? pidOverNongap : pidOverAlignlen);
+		run->stats.pidClass.pairs++;
+		run->stats.pidClass.above += (pid >= opts.pidThreshold ? 1 : 0);
+	}
+	if(opts.pidThreshold < 0 || opts.exactPid) {
+		addPid(&run->pidSummary, counts->identities, (opts.pidOverNongap ? counts->nongap : counts->alignlen));
+		if(run->pidMatrix != NULL) {
+			setMatrixPid(run->pidMatrix, seqind1, seqind2, (opts.pidOverNongap ? pidOverNongap : pidOverAlignlen));
+		}
+	}
+	if(opts.outFormat != TEXT_FORMAT) {
+		appendPairRecord(run, opts, seqind1, seqind2, counts);
+		return;
+	}
+
+	appendPairHeaders(text, input, seqind1, seqind2);
+
+	if(!opts.quietOut && opts.cigar) {
+		appendText(text, "CIGAR: ");
+		appendCigar(text, pair->align1, pair->align2, pair->len);
+		appendText(text, "\n\n");
+	}
+	else if(!opts.quietOut) {
+		appendText(text, "Original:\n");
+		appendSeq(text, seq1, seqlen1);
+		appendSeq(text, seq2, seqlen2);
+		appendChar(text, '\n');
+
+		appendText(text, "Alignment:\n");
+		appendSeq(text, pair->align1, pair->len);
+		appendSeq(text, pair->align2, pair->len);
+		appendChar(text, '\n');
+	}
+
+	if(opts.pidThreshold < 0 || opts.exactPid) {
+		appendText(text, "PID over non-gap: ");
+		appendDouble(text, pidOverNongap);
+		appendText(text, "\nPID over alignment-length: ");
+		appendDouble(text, pidOverAlignlen);
+		appendChar(text, '\n');
+	}
+	if(opts.pidThreshold >= 0) {
+		double pid = (opts.pidOverNongap ? pidOverNongap : pidOverAlignlen);
+		appendPidClass(text, opts, pid >= opts.pidThreshold);
+	}
+	appendPairEnd(text);
+	writeTextBuffer(text, *run->out);
+}
+
+//checks (with -verify, unless computePair() did) and displays the
+//alignment in job->pair
+static
+void reportPair(const AlignOptions &opts, PairJob *job) {
+	SpeciesRun *run = job->run;
+	int seqind1 = job->seqind1;
+	int seqind2 = job->seqind2;
+	AlignPair *pair = job->pair;
+
+	if(!job->verified) {
+		fitAlignWorker(&mainWorker, run->input->seqset->maxseqlen);
+		verifyAlignment(job, opts, &mainWorker);
+	}
+	reportVerify(job);
+	NWPairCounts counts;
+	computePairCounts(pair, &counts);
+
+	if(!isCopyPair(run, seqind1, seqind2) && findPairResult(run, seqind1, seqind2) == NULL) {
+		storePairResult(run, seqind1, seqind2, 0, (opts.printFsa || !opts.quietOut ? pair : NULL), &counts);
+	}
+	printPair(run, seqind1, seqind2, opts, pair, &counts);
+}
+
+//-shard: the whole run answers the pair of job from a pair of its classes
+//in an earlier shard, so it is computed here without being counted and
+//kept, to be reported like the whole run reports it
+static
+void keepEarlierPair(const AlignOptions &opts, PairJob *job) {
+	SpeciesRun *run = job->run;
+	int seqind1 = job->seqind1;
+	int seqind2 = job->seqind2;
+	int seqlen1 = run->input->seqset->seqlen[seqind1];
+	int seqlen2 = run->input->seqset->seqlen[seqind2];
+	AlignPair *pair = job->pair;
+
+	if(!job->computed) {
+		computePair(job, opts, &mainWorker);
+	}
+	if(opts.editDistance || classifiesPair(opts, mainWorker.nwparams, seqlen1, seqlen2)) {
+		storePairResult(run, seqind1, seqind2, job->value, NULL, NULL);
+	}
+	else if(opts.kernel == STATS_KERNEL) {
+		storePairResult(run, seqind1, seqind2, 0, NULL, &job->counts);
+	}
+	else {
+		NWPairCounts counts;
+		computePairCounts(pair, &counts);
+		storePairResult(run, seqind1, seqind2, 0, (opts.printFsa || !opts.quietOut ? pair : NULL), &counts);
+	}
+	//the earlier shard counted and checked all of this
+	memset(&job->stats, 0, sizeof(job->stats));
+	job->verified = false;
+	job->verifyFailures = 0;
+	job->verifySkipped = false;
+	job->verifyErrors.clear();
+}
+
+//reports the pair of job, answering it from a copy, an earlier pair of the
+//same classes or the cache when it can and running computePair() on the
+//main thread unless a -threads worker already has
+static
+void alignHelper(const AlignOptions &opts, PairJob *job) {
+	SpeciesRun *run = job->run;
+	Input *input = run->input;
+	ostream &out = *run->out;
+	int seqind1 = job->seqind1;
+	int seqind2 = job->seqind2;
+	int *seq1 = input->seqset->seqs[seqind1];
+	int *seq2 = input->seqset->seqs[seqind2];
+
+	int seqlen1 = input->seqset->seqlen[seqind1];
+	int seqlen2 = input->seqset->seqlen[seqind2];
+
+	NWAlignParams *nwparams = mainWorker.nwparams;
+	AlignPair *pair = job->pair;
+
+	bool copies = isCopyPair(run, seqind1, seqind2);
+	PairResult *kept = findPairResult(run, seqind1, seqind2);
+	if(!copies && kept == NULL && !run->earlierClasses.empty() && run->earlierClasses.count(classPairKey(run, seqind1, seqind2)) > 0) {
+		keepEarlierPair(opts, job);
+		kept = findPairResult(run, seqind1, seqind2);
+	}
+	if(copies) {
+		run->dedupCopies++;
+	}
+	else if(kept != NULL) {
+		run->dedupReused++;
+	}
+
+	if(opts.editDistance) {
+		int dist;
+		if(copies) {
+			dist = 0;
+		}
+		else if(kept != NULL) {
+			dist = kept->value;
+		}
+		else {
+			if(!job->computed) {
+				computePair(job, opts, &mainWorker);
+			}
+			dist = job->value;
+			storePairResult(run, seqind1, seqind2, dist, NULL, NULL);
+		}
+
+		appendPairHeaders(&reportText, input, seqind1, seqind2);
+		appendText(&reportText, "Edit distance: ");
+		appendInt(&reportText, dist);
+		appendText(&reportText, "\nIdentity from edit distance: ");
+		appendDouble(&reportText, editDistancePidBound(dist, seqlen1, seqlen2));
+		appendChar(&reportText, '\n');
+		appendPairEnd(&reportText);
+		writeTextBuffer(&reportText, out);
+		return;
+	}
+
+	//threshold classification without an alignment, nwalign() sized pairs only
+	if(classifiesPair(opts, nwparams, seqlen1, seqlen2)) {
+		int cls = PID_BELOW;
+		AlignCacheEntry entry;
+		if(copies || kept != NULL) {
+			//a copy has PID 1 by either metric
+			cls = (copies ? (1.0 >= opts.pidThreshold ? PID_ABOVE : PID_BELOW) : kept->value);
+			run->stats.pidClass.pairs++;
+			run->stats.pidClass.above += (cls == PID_ABOVE ? 1 : 0);
+		}
+		else if(findCachedPair(run, seqind1, seqind2, opts, &entry)) {
+			double pid = (opts.pidOverNongap ? countsPidOverNongap(&entry.counts) : countsPidOverAlignlen(&entry.counts));
+			cls = (pid >= opts.pidThreshold ? PID_ABOVE : PID_BELOW);
+			run->cacheHits++;
+			run->stats.pidClass.pairs++;
+			run->stats.pidClass.above += (cls == PID_ABOVE ? 1 : 0);
+			storePairResult(run, seqind1, seqind2, cls, NULL, NULL);
+		}
+		else {
+			if(!job->computed) {
+				computePair(job, opts, &mainWorker);
+			}
+			cls = job->value;
+			if(job->prefiltered) {
+				run->editPrefiltered++;
+				run->stats.pidClass.pairs++;
+			}
+			storePairResult(run, seqind1, seqind2, cls, NULL, NULL);
+		}
+
+		appendPairHeaders(&reportText, input, seqind1, seqind2);
+		appendPidClass(&reportText, opts, cls == PID_ABOVE);
+		appendPairEnd(&reportText);
+		writeTextBuffer(&reportText, out);
+		return;
+	}
+
+	AlignCacheEntry entry;
+	if(copies) {
+		//a sequence aligns with itself without gaps
+		memcpy(pair->align1, seq1, sizeof(int) * seqlen1);
+		memcpy(pair->align2, seq2, sizeof(int) * seqlen2);
+		pair->len = seqlen1;
+		pair->score = seqlen1 * nwparams->match;
+	}
+	else if(kept != NULL && kept->columns == NULL) {
+		//nothing but the PIDs is displayed
+		printPair(run, seqind1, seqind2, opts, NULL, &kept->counts);
+		return;
+	}
+	else if(kept != NULL) {
+		restorePairResult(kept, seq1, seq2, pair);
+	}
+	else if(findCachedPair(run, seqind1, seqind2, opts, &entry)) {
+		run->cacheHits++;
+		if(opts.printFsa || !opts.quietOut) {
+			alignCacheRestore(&entry, seq1, seq2, pair);
+		}
+		else {
+			//nothing but the PIDs is displayed
+			storePairResult(run, seqind1, seqind2, 0, NULL, &entry.counts);
+			printPair(run, seqind1, seqind2, opts, NULL, &entry.counts);
+			return;
+		}
+	}
+	else {
+		if(!job->computed) {
+			computePair(job, opts, &mainWorker);
+		}
+		if(opts.kernel == STATS_KERNEL) {
+			if(alignCache != NULL) {
+				AlignCacheKey key = cacheKey(run, seqind1, seqind2);
+				appendAlignCache(alignCache, &key, &job->counts, NULL);
+			}
+			reportVerify(job);
+			storePairResult(run, seqind1, seqind2, 0, NULL, &job->counts);
+			printPair(run, seqind1, seqind2, opts, NULL, &job->counts);
+			return;
+		}
+		cachePair(run, seqind1, seqind2, opts, pair);
+	}
+	reportPair(opts, job);
+}
+
+//reports job and adds it to the totals of its species
+static
+void reportJob(const AlignOptions &opts, PairJob *job) {
+	alignHelper(opts, job);
+	addKernelStats(&job->run->stats, &job->stats);
+	job->run->pairsCount++;
+}
+
+//-all-pair with -simd-batch: sequence i against all later sequences at once,
+//then reported in the usual order; pairs too long for the batch kernel's
+//matrices go through runKernel() and copies or pairs of classes already
+//aligned through alignHelper()
+static
+void alignAllPairsBatched(const AlignOptions &opts, SpeciesRun *run, AlignPair **pairs) {
+	Input *input = run->input;
+	NWAlignParams *nwparams = mainWorker.nwparams;
+	int numseqs = input->seqset->numseqs;
+	int **seqs2 = (int**) malloc(sizeof(int*) * numseqs);
+	int *lens2 = (int*) malloc(sizeof(int) * numseqs);
+	AlignPair **results = (AlignPair**) malloc(sizeof(AlignPair*) * numseqs);
+	bool *aligned = (bool*) malloc(sizeof(bool) * numseqs);
+	//row whose batch last took a target of each class
+	int *classRow = (int*) malloc(sizeof(int) * numseqs);
+	for(int c = 0; c < numseqs; c++) {
+		classRow[c] = -1;
+	}
+	for(int i = 0; i < numseqs; i++) {
+		int *seq1 = input->seqset->seqs[i];
+		int seqlen1 = input->seqset->seqlen[i];
+		bool fits1 = (seqlen1 < nwparams->matrix_capacity);
+
+		int count = 0;
+		for(int j = i+1; j < numseqs; j++) {
+			int *seq2 = input->seqset->seqs[j];
+			int seqlen2 = input->seqset->seqlen[j];
+			aligned[j] = false;
+			if(run->seqClass != NULL) {
+				if(isCopyPair(run, i, j) || findPairResult(run, i, j) != NULL || classRow[run->seqClass[j]] == i) {
+					continue;
+				}
+				classRow[run->seqClass[j]] = i;
+			}
+			AlignCacheEntry entry;
+			if(findCachedPair(run, i, j, opts, &entry)) {
+				continue;
+			}
+			aligned[j] = true;
+			if(fits1 && seqlen2 < nwparams->matrix_capacity) {
+				seqs2[count] = seq2;
+				lens2[count] = seqlen2;
+				results[count] = pairs[j];
+				count++;
+			}
+			else {
+				runKernel(opts, &mainWorker, &run->stats, seq1, seqlen1, seq2, seqlen2, pairs[j]);
+			}
+		}
+		nwalignBatch(nwparams, seq1, seqlen1, seqs2, lens2, count, results, &run->batchStats);
+
+		for(int j = i+1; j < numseqs; j++) {
+			PairJob job;
+			initPairJob(&job, run, i, j, pairs[j]);
+			if(aligned[j]) {
+				cachePair(run, i, j, opts, pairs[j]);
+				reportPair(opts, &job);
+				run->pairsCount++;
+			}
+			else {
+				reportJob(opts, &job);
+			}
+		}
+	}
+
+	free(seqs2);
+	free(lens2);
+	free(results);
+	free(aligned);
+	free(classRow);
+}
+
+//-threads hands pairs out in tiles of about TILE_CELLS DP cells or
+//TILE_PAIRS pairs, whichever comes first, and keeps up to TILES_PER_THREAD
+//tiles per thread planned but not reported yet
+static const double TILE_CELLS = 16.0 * 1024 * 1024;
+static const int TILE_PAIRS = 1024;
+static const int TILES_PER_THREAD = 4;
+
+typedef struct {
+	vector<PairJob> jobs;
+	vector<char> planned; //computePair() is to run on a worker
+} PairTile;
+
+//what the -threads workers share
+typedef struct {
+	const AlignOptions *opts;
+	vector<PairTile> *ring; //tile t is at t % size()
+	TileScheduler *sched;
+} TileContext;
+
+//-batch: the FASTA files one process aligns, one after the other
+typedef struct {
+	vector<string> fastaFiles;
+	bool streamed; //-batch -: fastaFiles are left empty, the reader stage takes them from cin
+	StageQueue *reader; //the files read ahead, while alignPairsThreaded() runs
+	string outDir; //empty: each output next to its FASTA file
+	PairType pairMode;
+	int numRandPairs;
+	int randAbove; //-rand-pair only for more sequences than this, -1 for pairMode everywhere
+	unsigned int seed;
+	NWScoring scoring;
+	size_t loaded; //files planned so far
+	int reported; //files reported so far
+	long pairsCount;
+} SpeciesBatch;
+
+//where alignPairsThreaded() plans its pairs from
+typedef struct {
+	SpeciesRun *run; //being planned, NULL before the first -batch file
+	SpeciesBatch *batch; //NULL for a single FASTA file
+	set<long long> plannedClasses; //class pairs of run planned so far
+} PairSource;
+
+//alignPairsThreaded() runs in stages: with -batch a reader parses the
+//FASTA files, the aligners plan, compute and format the tiles, and a
+//writer writes the formatted output.  Each stage runs up to this far
+//ahead of the next one.
+static const int READ_AHEAD_FILES = 2;
+static const int WRITE_AHEAD_CHUNKS = 64;
+
+//a -batch file parsed by the reader stage
+typedef struct {
+	string fastaFilename;
+	Input *input;
+} ReadSpecies;
+
+//output formatted for the writer stage
+typedef struct {
+	ostream *dest;
+	string text;
+	bool close; //dest is a -batch output file, deleted after text
+} OutputChunk;
+
+//how full the stage queues ran, over the whole process
+static StageQueueStats readerQueueStats;
+static StageQueueStats writerQueueStats;
+
+static
+void addStageQueueStats(StageQueueStats *total, const StageQueue *queue) {
+	StageQueueStats stats;
+	getStageQueueStats(queue, &stats);
+	total->capacity = stats.capacity;
+	total->pushes += stats.pushes;
+	total->fullWaits += stats.fullWaits;
+	total->emptyWaits += stats.emptyWaits;
+	total->maxDepth = max(total->maxDepth, stats.maxDepth);
+	total->depthSum += stats.depthSum;
+}
+
+//a line of a -batch list, without surrounding blanks
+static
+string trimListLine(const string &line) {
+	size_t first = line.find_first_not_of(" \t\r");
+	return (first == string::npos ? string() : line.substr(first, line.find_last_not_of(" \t\r") - first + 1));
+}
+
+//The reader stage: parses the -batch files in order, the names read from
+//cin as they come with -batch -.  Waits while READ_AHEAD_FILES files are
+//parsed and not planned yet.
+static
+void readSpecies(SpeciesBatch *batch) {
+	string line;
+	for(size_t f = 0; ; f++) {
+		string fastaFilename;
+		if(batch->streamed) {
+			while(fastaFilename.empty() && getline(cin, line)) {
+				fastaFilename = trimListLine(line);
+			}
+		}
+		else if(f < batch->fastaFiles.size()) {
+			fastaFilename = batch->fastaFiles[f];
+		}
+		if(fastaFilename.empty()) {
+			break;
+		}
+		ReadSpecies *species = new ReadSpecies;
+		species->fastaFilename = fastaFilename;
+		species->input = new Input(fastaFilename);
+		pushStage(batch->reader, species);
+	}
+	closeStageQueue(batch->reader);
+}
+
+//The writer stage: writes the chunks in the order they were formatted.
+//Waits while none is formatted.
+static
+void writeOutput(StageQueue *writer) {
+	void *item;
+	while(popStage(writer, &item)) {
+		OutputChunk *chunk = (OutputChunk*) item;
+		chunk->dest->write(chunk->text.data(), chunk->text.size());
+		if(chunk->close) {
+			delete chunk->dest;
+		}
+		delete chunk;
+	}
+	cout.flush();
+}
+
+//hands text for dest to the writer stage, waiting while WRITE_AHEAD_CHUNKS
+//chunks are not written yet
+static
+void passOutput(StageQueue *writer, ostream *dest, const string &text, bool close) {
+	if(text.empty() && !close) {
+		return;
+	}
+	OutputChunk *chunk = new OutputChunk;
+	chunk->dest = dest;
+	chunk->text = text;
+	chunk->close = close;
+	pushStage(writer, chunk);
+}
+
+//from now on, what is printed for run is staged for the writer stage to
+//write to sink
+static
+void stageRunOutput(SpeciesRun *run, ostream *sink) {
+	run->sink = sink;
+	run->staged = new ostringstream;
+	run->out = run->staged;
+}
+
+//passes what was staged for run so far to the writer stage
+static
+void passRunOutput(StageQueue *writer, SpeciesRun *run, bool close) {
+	passOutput(writer, run->sink, run->staged->str(), close);
+	run->staged->str("");
+}
+
+//once the writer stage is done, run prints to its sink again
+static
+void unstageRunOutput(SpeciesRun *run) {
+	run->out = run->sink;
+	delete run->staged;
+	run->sink = NULL;
+	run->staged = NULL;
+}
+
+//the file -batch writes the output of fastaFilename to
+static
+string batchOutputFilename(const SpeciesBatch *batch, const string &fastaFilename) {
+	return outputFilename(batch->outDir, fastaFilename, ".txt");
+}
+
+//The int32 kernels do not check for overflow, so the scoring must keep
+//every pair of the longest sequences of fastaFilename in range.
+static
+void checkScoreRange(const NWScoring &scoring, const Input *input, const string &fastaFilename) {
+	int maxlen = input->seqset->maxseqlen;
+	if(!nwScoreFitsInt32(scoring.match, scoring.mismatch, scoring.gapopen, scoring.gapext, maxlen, maxlen)) {
+		cerr<<"Error: the scores of "<<fastaFilename<<" overflow int with this scoring; use smaller scores."<<endl;
+		exit(1);
+	}
+}
+
+//takes the next -batch file from the reader stage into source->run, false
+//after the last one
+static
+bool loadNextSpecies(PairSource *source, const AlignOptions &opts) {
+	SpeciesBatch *batch = source->batch;
+	void *item;
+	if(batch == NULL || !popStage(batch->reader, &item)) {
+		return false;
+	}
+	ReadSpecies *species = (ReadSpecies*) item;
+	string fastaFilename = species->fastaFilename;
+	Input *input = species->input;
+	delete species;
+	batch->loaded++;
+	int numseqs = input->seqset->numseqs;
+	PairType mode = batch->pairMode;
+	if(batch->randAbove >= 0) {
+		mode = (numseqs > batch->randAbove ? RAND_PAIR : ALL_PAIR);
+	}
+	if(mode == NEXT_PAIR && numseqs % 2 != 0) {
+		cerr<<"Error: "<<fastaFilename<<" should have even number of sequences in -next-pair mode."<<endl;
+		exit(1);
+	}
+	checkScoreRange(batch->scoring, input, fastaFilename);
+
+	SpeciesRun *run = new SpeciesRun;
+	initSpeciesRun(run, opts, input, mode, batch->numRandPairs, batch->seed);
+	run->fastaFilename = fastaFilename;
+	run->outFilename = batchOutputFilename(batch, fastaFilename);
+	source->run = run;
+	source->plannedClasses.clear();
+	return true;
+}
+
+//Fills tile with the next pairs of source.  A pair is planned for a worker
+//when alignHelper() would compute it: not copies, not a later pair of
+//classes planned before and not in the cache.  With -batch, every file
+//starts with a job of seqind1 -1 so that files without pairs are reported
+//too.  Returns false if source had no pair left.
+static
+bool planTile(PairTile *tile, const AlignOptions &opts, PairSource *source) {
+	tile->jobs.clear();
+	tile->planned.clear();
+	double cells = 0;
+	int seqind1, seqind2;
+	while(cells < TILE_CELLS && (int) tile->jobs.size() < TILE_PAIRS) {
+		SpeciesRun *run = source->run;
+		if(run == NULL || !nextPair(&run->stream, seqind1, seqind2)) {
+			if(!loadNextSpecies(source, opts)) {
+				break;
+			}
+			tile->jobs.push_back(PairJob());
+			initPairJob(&tile->jobs.back(), source->run, -1, -1, NULL);
+			tile->planned.push_back(false);
+			continue;
+		}
+		int seqlen1 = run->input->seqset->seqlen[seqind1];
+		int seqlen2 = run->input->seqset->seqlen[seqind2];
+		bool plan = !isCopyPair(run, seqind1, seqind2);
+		if(plan && keepsPairResult(run, seqind1, seqind2)) {
+			plan = source->plannedClasses.insert(classPairKey(run, seqind1, seqind2)).second;
+		}
+		AlignCacheEntry entry;
+		if(plan && !opts.editDistance && findCachedPair(run, seqind1, seqind2, opts, &entry)) {
+			plan = false;
+		}
+
+		tile->jobs.push_back(PairJob());
+		initPairJob(&tile->jobs.back(), run, seqind1, seqind2, NULL);
+		if(plan && computesAlignment(opts, mainWorker.nwparams, seqlen1, seqlen2)) {
+			tile->jobs.back().pair = constructAlignPair(seqlen1, seqlen2);
+		}
+		tile->planned.push_back(plan);
+		cells += (plan ? (double) (seqlen1 + 1) * (seqlen2 + 1) : 0);
+	}
+	return !tile->jobs.empty();
+}
+
+static
+void runTile(PairTile *tile, const AlignOptions &opts, AlignWorker *worker) {
+	for(size_t k = 0; k < tile->jobs.size(); k++) {
+		if(tile->planned[k]) {
+			computePair(&tile->jobs[k], opts, worker);
+		}
+	}
+}
+
+static
+void tileWorker(TileContext *ctx, AlignWorker *worker, int index) {
+	long tile;
+	while(takeTile(ctx->sched, index, &tile, true)) {
+		runTile(&(*ctx->ring)[tile % ctx->ring->size()], *ctx->opts, worker);
+		finishTile(ctx->sched, tile);
+	}
+}
+
+//the FASTA files of -batch: the *.fsa files of a directory in name order,
+//or the files listed one per line in a file
+static
+void listBatchFiles(const string &path, vector<string> &fastaFiles) {
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0) {
+		cerr<<"Error: cannot open "<<path<<endl;
+		exit(1);
+	}
+	if(S_ISDIR(st.st_mode)) {
+		DIR *dir = opendir(path.c_str());
+		if(dir == NULL) {
+			cerr<<"Error: cannot open "<<path<<endl;
+			exit(1);
+		}
+		struct dirent *entry;
+		while((entry = readdir(dir)) != NULL) {
+			string name(entry->d_name);
+			if(name.size() > 4 && name.compare(name.size() - 4, 4, ".fsa") == 0) {
+				fastaFiles.push_back(path + "/" + name);
+			}
+		}
+		closedir(dir);
+		sort(fastaFiles.begin(), fastaFiles.end());
+	}
+	else {
+		ifstream list(path.c_str());
+		string line;
+		while(getline(list, line)) {
+			if(!trimListLine(line).empty()) {
+				fastaFiles.push_back(trimListLine(line));
+			}
+		}
+	}
+}
+
+//the lines before the pairs of run
 static
-void alignHelper(
-		int seqind1, 
-		int seqind2, 
-		bool printFsa, 
-		bool quietOut, 
-		AlignPair *pair, 
-		NWAlignParams *nwparams, 
-		Input *input
-		) {
-	int *seq1 = input->seqset->seqs[seqind1];
-	int *seq2 = input->seqset->seqs[seqind2];
+void printRunHeader(const AlignOptions &opts, const NWScoring &scoring, SpeciesRun *run) {
+	ostream &out = *run->out;
+	out<< "Random seed: " << run->stream.seed << endl;
+	out<< "Number of sequences: "<<run->input->seqset->numseqs <<endl;
+	out<<"match "<<scoring.match<<endl;
+	out<<"mismatch "<<scoring.mismatch<<endl;
+	out<<"gapopen "<<scoring.gapopen<<endl;
+	out<<"gapext "<<scoring.gapext<<endl;
+	if(opts.linearGaps && (opts.kernel == SCALAR_KERNEL || opts.kernel == STATS_KERNEL)) {
+		out<<"Linear gap scoring: single-matrix kernel"<<endl;
+	}
+	if(opts.kernel == SIMD_KERNEL) {
+		out<<"SIMD kernel "<<nwalignSimdName()<<endl;
+	}
+	else if(opts.kernel == BATCH_KERNEL) {
+		out<<"SIMD kernel "<<nwalignSimdName()<<", "<<nwalignBatchLanes()<<" targets per batch"<<endl;
+	}
+	out<<endl;
+}
 
-	int seqlen1 = input->seqset->seqlen[seqind1];
-	int seqlen2 = input->seqset->seqlen[seqind2];
+//the quantiles the driver scripts take of the PIDs of a species
+static const double PID_QUANTILES[] = {0.0, 0.05, 0.5, 0.95, 1.0};
+static const int NUM_PID_QUANTILES = sizeof(PID_QUANTILES) / sizeof(PID_QUANTILES[0]);
+
+//the distribution of the PIDs of run, and its -pid-histogram
+static
+void printPidSummary(const AlignOptions &opts, const SpeciesRun *run) {
+	ostream &out = *run->out;
+	const PidSummary *summary = &run->pidSummary;
+	double values[NUM_PID_QUANTILES];
+	pidQuantiles(summary, PID_QUANTILES, NUM_PID_QUANTILES, values);
+	printOut(out, "PID summary %s (min, 5%%, median, 95%%, max): (%.5lf, %.5lf, %.5lf, %.5lf, %.5lf) of %ld pairs%s\n",
+			(opts.pidOverNongap ? "over non-gap" : "over alignment-length"),
+			values[0], values[1], values[2], values[3], values[4], summary->count,
+			(summary->exact ? "" : " (sketch, to 0.00001)"));
+	if(opts.pidHistogram > 0) {
+		vector<long> counts(opts.pidHistogram);
+		pidHistogram(summary, opts.pidHistogram, &counts[0]);
+		for(int bin = 0; bin < opts.pidHistogram; bin++) {
+			printOut(out, "PID histogram: [%.5lf, %.5lf%c %ld\n", (double) bin / opts.pidHistogram,
+					(double) (bin + 1) / opts.pidHistogram, (bin + 1 < opts.pidHistogram ? ')' : ']'), counts[bin]);
+		}
+	}
+}
 
-	nwalign(nwparams, seq1, seqlen1, seq2, seqlen2, pair);
-	double pidOverNongap = computePidOverNongap(pair->align1, pair->align2, pair->len);
-	double pidOverAlignlen = computePidOverAlignlen(pair->align1, pair->align2, pair->len);
+//the lines after the pairs of run
+static
+void printRunSummary(const AlignOptions &opts, SpeciesRun *run) {
+	ostream &out = *run->out;
+	const KernelStats &stats = run->stats;
+	if(alignCache != NULL) {
+		run->cacheAdded = alignCache->appended - run->cacheAppended;
+		run->cacheRecords = alignCache->records;
+	}
+	out<<"Number of pairs aligned: "<<run->pairsCount<<endl;
+	if(!run->recordFilename.empty()) {
+		out<<"Pair records: "<<run->recordCount<<" written to "<<run->recordFilename<<endl;
+	}
+	if(!run->matrixFilename.empty()) {
+		int numseqs = run->stream.numseqs;
+		printOut(out, "PID matrix: %ld of %ld pairs written to %s\n", run->matrixPairs,
+				(long) numseqs * (numseqs - 1) / 2, run->matrixFilename.c_str());
+	}
+	if(run->pidSummary.count > 0) {
+		printPidSummary(opts, run);
+	}
+	if(opts.dedup && opts.dedupStats) {
+		printOut(out, "Distinct sequences: %ld of %d (%ld pairs of copies, %ld pairs reused from earlier ones)\n",
+				run->numClasses, run->stream.numseqs, run->dedupCopies, run->dedupReused);
+	}
+	if(opts.cacheFile != NULL) {
+		printOut(out, "Alignment cache: %ld pairs read, %ld added (%ld records before this run)\n",
+				run->cacheHits, run->cacheAdded, run->cacheRecords);
+	}
+	if(opts.verify) {
+		out<<"Number of pairs failing -verify: "<<run->verifyFailures<<endl;
+		if(run->verifySkipped > 0) {
+			out<<"Number of pairs not verified (longer than -linear-above, aligned by nwalignLinear()): "
+				<<run->verifySkipped<<endl;
+		}
+	}
+	if(opts.kernel == BAND_KERNEL) {
+		printOut(out, "Banded pairs: %ld (%ld widened, %ld full matrix, %.2lf passes per pair)\n",
+				stats.band.pairs, stats.band.widened, stats.band.full,
+				(stats.band.pairs > 0 ? (double) stats.band.passes / stats.band.pairs : 0.0));
+		printOut(out, "Banded DP cells: %.0lf of %.0lf (%.2lf%%)\n", stats.band.cells, stats.band.fullCells,
+				(stats.band.fullCells > 0 ? 100.0 * stats.band.cells / stats.band.fullCells : 0.0));
+	}
+	if(opts.kernel == WFA_KERNEL) {
+		printOut(out, "Wavefront pairs: %ld (%ld too divergent, aligned by nwalign()), mean penalty %.1lf\n",
+				stats.wfa.pairs, stats.wfa.fallback, (stats.wfa.pairs > 0 ? stats.wfa.penalty / stats.wfa.pairs : 0.0));
+		printOut(out, "Wavefront offsets: %.0lf for %.0lf DP cells (%.2lf%%)\n", stats.wfa.offsets, stats.wfa.cells,
+				(stats.wfa.cells > 0 ? 100.0 * stats.wfa.offsets / stats.wfa.cells : 0.0));
+	}
+	if(opts.kernel == ANCHOR_KERNEL) {
+		printOut(out, "Anchored pairs: %ld (%ld with low coverage, aligned in full), %.1lf anchored bases per pair\n",
+				stats.anchor.pairs, stats.anchor.fallback,
+				(stats.anchor.pairs > 0 ? stats.anchor.anchored / stats.anchor.pairs : 0.0));
+		printOut(out, "Anchored DP cells: %.0lf of %.0lf (%.2lf%% skipped)\n", stats.anchor.cells, stats.anchor.fullCells,
+				(stats.anchor.fullCells > 0 ? 100.0 - 100.0 * stats.anchor.cells / stats.anchor.fullCells : 0.0));
+	}
+	if(opts.kernel == BATCH_KERNEL) {
+		printOut(out, "Batched pairs: %ld in %ld batches (%.2lf%% of lane cells used)\n",
+				run->batchStats.pairs, run->batchStats.batches,
+				(run->batchStats.laneCells > 0 ? 100.0 * run->batchStats.cells / run->batchStats.laneCells : 0.0));
+	}
+	if(opts.pidThreshold >= 0) {
+		printOut(out, "PID threshold %g (%s): %ld above, %ld below\n", opts.pidThreshold,
+				(opts.pidOverNongap ? "over non-gap" : "over alignment-length"),
+				stats.pidClass.above, stats.pidClass.pairs - stats.pidClass.above);
+		if(opts.editPrefilter) {
+			printOut(out, "Edit-distance prefilter: %ld pairs below without nwalign()\n", run->editPrefiltered);
+		}
+		if(stats.pidClass.rows > 0) {
+			printOut(out, "PID threshold early exits: %ld in DP, %.2lf%% of DP rows filled, %.1lf traceback steps per traced pair\n",
+					stats.pidClass.decidedInDp, 100.0 * stats.pidClass.rowsFilled / stats.pidClass.rows,
+					stats.pidClass.tracebackSteps / (stats.pidClass.traced > 0 ? stats.pidClass.traced : 1));
+		}
+	}
+}
 
-	//display
-	if(printFsa) {
-		cerr<<">"<<input->fastaHeaders[seqind1]
-			<<"; PID1-over-non-gap="<<pidOverNongap<<"; PID1-over-alignlen="<<pidOverAlignlen<<endl;
-		Results::displaySeq(cerr, pair->align1, pair->len);
-		cerr<<">"<<input->fastaHeaders[seqind2]
-			<<"; PID2-over-non-gap="<<pidOverNongap<<"; PID2-over-alignlen="<<pidOverAlignlen<<endl;
-		Results::displaySeq(cerr, pair->align2, pair->len);
-		cerr<<endl;
+//-batch: opens the output of run before its first pair is reported
+static
+void beginSpecies(const AlignOptions &opts, SpeciesBatch *batch, SpeciesRun *run, AlignPair **pair) {
+	ofstream *file = new ofstream(run->outFilename.c_str());
+	if(!file->is_open()) {
+		cerr<<"Error: cannot write "<<run->outFilename<<endl;
+		exit(1);
+	}
+	stageRunOutput(run, file);
+	if(opts.outFormat != TEXT_FORMAT) {
+		openPairRecords(opts, batch->scoring, batch->outDir, run);
 	}
+	if(opts.pidMatrix) {
+		openRunPidMatrix(opts, batch->scoring, batch->outDir, run);
+	}
+	run->cacheAppended = (alignCache != NULL ? alignCache->appended : 0);
+	int seqMaxlen = run->input->seqset->maxseqlen;
+	if((*pair)->capacity < 2 * seqMaxlen) {
+		nilAlignPair(*pair);
+		*pair = constructAlignPair(seqMaxlen, seqMaxlen);
+	}
+	printRunHeader(opts, batch->scoring, run);
+}
 
-	cout<<">"<<input->fastaHeaders[seqind1]<<endl;
-	cout<<">"<<input->fastaHeaders[seqind2]<<endl;
+//-batch: has the writer stage close the output of run after its last pair
+//and frees run
+static
+void finishSpecies(const AlignOptions &opts, SpeciesBatch *batch, SpeciesRun *run, StageQueue *writer) {
+	closePairRecords(run);
+	closeRunPidMatrix(run);
+	printRunSummary(opts, run);
+	passRunOutput(writer, run, true);
+	delete run->staged;
+	ostringstream done;
+	done<<run->fastaFilename<<": "<<run->input->seqset->numseqs<<" sequences, "
+		<<run->pairsCount<<" pairs, written to "<<run->outFilename<<endl;
+	passOutput(writer, &cout, done.str(), false);
+	batch->reported++;
+	batch->pairsCount += run->pairsCount;
+	freeSpeciesRun(run);
+	delete run;
+}
 
-	if(!quietOut) {
-		cout<<"Original:"<<endl;
-		Results::displaySeq(cout, seq1, seqlen1);
-		Results::displaySeq(cout, seq2, seqlen2);
-		cout<<endl;
+//Runs the pairs of source on opts.threads threads: this one plans tiles in
+//reporting order, the workers compute them and this one reports them in
+//order, computing tiles itself while the next one to report is not done.
+//The reader stage parses the -batch files ahead of the planning and the
+//writer stage writes what the reporting formatted.  The output is the
+//single-threaded output.  pair holds the alignments not planned for a
+//worker; -batch grows it for every file.
+static
+void alignPairsThreaded(const AlignOptions &opts, const NWScoring &scoring, int matrixMaxlen, int seqMaxlen,
+		PairSource *source, AlignPair **pair) {
+	int numWorkers = opts.threads - 1;
+	vector<AlignWorker> workers(numWorkers);
+	for(int w = 0; w < numWorkers; w++) {
+		initAlignWorker(&workers[w], opts, scoring, matrixMaxlen, seqMaxlen);
+	}
+	vector<PairTile> ring(TILES_PER_THREAD * opts.threads);
+	TileScheduler *sched = constructTileScheduler(numWorkers);
+	TileContext ctx = {&opts, &ring, sched};
+	vector<thread> threads;
+	for(int w = 0; w < numWorkers; w++) {
+		threads.push_back(thread(tileWorker, &ctx, &workers[w], w));
+	}
+	SpeciesBatch *batch = source->batch;
+	thread reader;
+	if(batch != NULL) {
+		batch->reader = constructStageQueue(READ_AHEAD_FILES);
+		reader = thread(readSpecies, batch);
+	}
+	StageQueue *writerQueue = constructStageQueue(WRITE_AHEAD_CHUNKS);
+	thread writer(writeOutput, writerQueue);
 
-		cout<<"Alignment:"<<endl;
-		Results::displaySeq(cout, pair->align1, pair->len);
-		Results::displaySeq(cout, pair->align2, pair->len);
-		cout<<endl;
+	SpeciesRun *reporting = NULL; //file being reported
+	if(batch == NULL) {
+		reporting = source->run;
+		stageRunOutput(reporting, reporting->out);
 	}
+	long planned = 0;
+	long reported = 0;
+	bool more = true;
+	while(true) {
+		while(more && planned - reported < (long) ring.size()) {
+			more = planTile(&ring[planned % ring.size()], opts, source);
+			if(more) {
+				pushTile(sched, planned++);
+			}
+		}
+		if(reported == planned) {
+			break;
+		}
 
-	cout<<"PID over non-gap: "<< pidOverNongap <<endl;
-	cout<<"PID over alignment-length: "<< pidOverAlignlen<<endl;
-	cout<<endl;
+		while(!waitTile(sched, reported, false)) {
+			long tile;
+			if(!takeTile(sched, -1, &tile, false)) {
+				waitTile(sched, reported, true);
+				break;
+			}
+			runTile(&ring[tile % ring.size()], opts, &mainWorker);
+			finishTile(sched, tile);
+		}
 
-	cout<<"==================================================================="<<endl;
-	cout<<endl;
+		PairTile *tile = &ring[reported % ring.size()];
+		for(size_t k = 0; k < tile->jobs.size(); k++) {
+			PairJob *job = &tile->jobs[k];
+			if(job->seqind1 < 0) {
+				if(reporting != NULL) {
+					finishSpecies(opts, batch, reporting, writerQueue);
+				}
+				reporting = job->run;
+				beginSpecies(opts, batch, reporting, pair);
+				continue;
+			}
+			AlignPair *own = job->pair;
+			if(job->pair == NULL) {
+				job->pair = *pair;
+			}
+			reportJob(opts, job);
+			if(own != NULL) {
+				nilAlignPair(own);
+			}
+		}
+		if(reporting != NULL) {
+			passRunOutput(writerQueue, reporting, false);
+		}
+		reported++;
+	}
+	if(batch != NULL && reporting != NULL) {
+		finishSpecies(opts, batch, reporting, writerQueue);
+	}
 
+	closeStageQueue(writerQueue);
+	writer.join();
+	addStageQueueStats(&writerQueueStats, writerQueue);
+	nilStageQueue(writerQueue);
+	if(batch == NULL) {
+		unstageRunOutput(source->run);
+	}
+	if(batch != NULL) {
+		reader.join();
+		addStageQueueStats(&readerQueueStats, batch->reader);
+		nilStageQueue(batch->reader);
+		batch->reader = NULL;
+	}
 
+	closeTileScheduler(sched);
+	for(int w = 0; w < numWorkers; w++) {
+		threads[w].join();
+		addWorkerStats(&workers[w]);
+		nilAlignWorker(&workers[w]);
+	}
+	nilTileScheduler(sched);
 }
 
-int main(int argc, char** argv) {
-	if(DEBUG0) {
-		string str = "WARNING: running under DEBUG mode\n\n";
-		cout<<str;
-		cerr<<str;
+//the lines after the pairs of the whole process
+static
+void printProcessSummary(const AlignOptions &opts, double elapsed) {
+	if(dpWorkspaces > 0) {
+		//against a matrix_capacity square of separately allocated rows.  With
+		//-threads it depends on which worker took which pair, so it goes to
+		//stderr like the stage queue lines.
+		double squareBytes = (double) dpMatrixCapacity * (dpMatrixCapacity + sizeof(char*))
+			+ 6.0 * dpMatrixCapacity * (sizeof(int) + sizeof(short));
+		fprintf(stderr, "DP workspace: %.2lf MB allocated, %.2lf MB for the largest pair%s (capacity-squared layout: %.2lf MB)\n",
+				dpWorkspaceBytes / 1048576.0, dpWorkspacePeak / 1048576.0,
+				(opts.hugePages ? ", huge pages requested" : ""), dpWorkspaces * squareBytes / 1048576.0);
 	}
-	if(DEBUG1) {
-		string str = "WARNING: running under VERBOSE mode\n\n";
-		cout<<str;
-		cerr<<str;
+	//queue depths after every push; a waiting pop means the stage after
+	//was starved, a waiting push that it held the stage before back.  They
+	//go to stderr, keeping stdout the same with and without the stages.
+	if(readerQueueStats.pushes > 0) {
+		fprintf(stderr, "Reader stage queue: %ld files, %.2lf queued on average, at most %d of %d; "
+				"planning waited %ld times, reading %ld times\n",
+				readerQueueStats.pushes, readerQueueStats.depthSum / readerQueueStats.pushes,
+				readerQueueStats.maxDepth, readerQueueStats.capacity,
+				readerQueueStats.emptyWaits, readerQueueStats.fullWaits);
 	}
-	printf("Compiled on " __DATE__ " " __TIME__ "\n");
-	printf("\n");
-	printf("ChangeLog\n");
-	printf("\n");
-	for(int i = 0; i < argc; i++) {
-		cout<<argv[i]<<" ";
+	if(writerQueueStats.pushes > 0) {
+		fprintf(stderr, "Writer stage queue: %ld chunks, %.2lf queued on average, at most %d of %d; "
+				"writing waited %ld times, reporting %ld times\n",
+				writerQueueStats.pushes, writerQueueStats.depthSum / writerQueueStats.pushes,
+				writerQueueStats.maxDepth, writerQueueStats.capacity,
+				writerQueueStats.emptyWaits, writerQueueStats.fullWaits);
 	}
-	cout<<endl<<endl;
+	printf("Total elapsed CPU time (in seconds): %.2lf\n",elapsed );
+}
 
-	if(argc == 1) {
+//the numbers printRunSummary() and printProcessSummary() show for run
+static
+vector<ShardCounter> shardCounters(SpeciesRun *run, double *elapsed) {
+	KernelStats *stats = &run->stats;
+	ShardCounter counters[] = {
+		{"pairs", &run->pairsCount, NULL, SUM_SHARDS},
+		{"classes", &run->numClasses, NULL, LARGEST_SHARD},
+		{"copies", &run->dedupCopies, NULL, SUM_SHARDS},
+		{"reused", &run->dedupReused, NULL, SUM_SHARDS},
+		{"cacheHits", &run->cacheHits, NULL, SUM_SHARDS},
+		{"cacheAdded", &run->cacheAdded, NULL, SUM_SHARDS},
+		{"cacheRecords", &run->cacheRecords, NULL, SMALLEST_SHARD},
+		{"verifyFailures", &run->verifyFailures, NULL, SUM_SHARDS},
+		{"verifySkipped", &run->verifySkipped, NULL, SUM_SHARDS},
+		{"editPrefiltered", &run->editPrefiltered, NULL, SUM_SHARDS},
+		{"band.pairs", &stats->band.pairs, NULL, SUM_SHARDS},
+		{"band.widened", &stats->band.widened, NULL, SUM_SHARDS},
+		{"band.full", &stats->band.full, NULL, SUM_SHARDS},
+		{"band.passes", &stats->band.passes, NULL, SUM_SHARDS},
+		{"band.cells", NULL, &stats->band.cells, SUM_SHARDS},
+		{"band.fullCells", NULL, &stats->band.fullCells, SUM_SHARDS},
+		{"wfa.pairs", &stats->wfa.pairs, NULL, SUM_SHARDS},
+		{"wfa.fallback", &stats->wfa.fallback, NULL, SUM_SHARDS},
+		{"wfa.penalty", NULL, &stats->wfa.penalty, SUM_SHARDS},
+		{"wfa.offsets", NULL, &stats->wfa.offsets, SUM_SHARDS},
+		{"wfa.cells", NULL, &stats->wfa.cells, SUM_SHARDS},
+		{"anchor.pairs", &stats->anchor.pairs, NULL, SUM_SHARDS},
+		{"anchor.fallback", &stats->anchor.fallback, NULL, SUM_SHARDS},
+		{"anchor.anchored", NULL, &stats->anchor.anchored, SUM_SHARDS},
+		{"anchor.cells", NULL, &stats->anchor.cells, SUM_SHARDS},
+		{"anchor.fullCells", NULL, &stats->anchor.fullCells, SUM_SHARDS},
+		{"pidClass.pairs", &stats->pidClass.pairs, NULL, SUM_SHARDS},
+		{"pidClass.above", &stats->pidClass.above, NULL, SUM_SHARDS},
+		{"pidClass.decidedInDp", &stats->pidClass.decidedInDp, NULL, SUM_SHARDS},
+		{"pidClass.rowsFilled", NULL, &stats->pidClass.rowsFilled, SUM_SHARDS},
+		{"pidClass.rows", NULL, &stats->pidClass.rows, SUM_SHARDS},
+		{"pidClass.traced", &stats->pidClass.traced, NULL, SUM_SHARDS},
+		{"pidClass.tracebackSteps", NULL, &stats->pidClass.tracebackSteps, SUM_SHARDS},
+		{"dp.workspaces", &dpWorkspaces, NULL, LARGEST_SHARD},
+		{"dp.bytes", &dpWorkspaceBytes, NULL, LARGEST_SHARD},
+		{"dp.peak", &dpWorkspacePeak, NULL, LARGEST_SHARD},
+		{"dp.capacity", &dpMatrixCapacity, NULL, LARGEST_SHARD},
+		{"cpuSeconds", NULL, elapsed, SUM_SHARDS},
+	};
+	return vector<ShardCounter>(counters, counters + sizeof(counters) / sizeof(counters[0]));
+}
+
+//the last line of a -shard run, read by merge
+static
+void printRunShardCounters(SpeciesRun *run, int shard, int numShards, double elapsed) {
+	printShardCounters(shardCounters(run, &elapsed), &run->pidSummary, shard, numShards);
+}
+
+//what the command line of a run asks for
+typedef struct {
+	bool batchMode;
+	string fastaFilename; //with -batch, the directory or list of FASTA files
+	string outDir;
+	int randAbove;
+	PairType pairMode;
+	int numRandPairs;
+	unsigned int randomSeed;
+	NWScoring scoring;
+	AlignOptions opts;
+	int shard; //-shard shard/numShards
+	int numShards;
+} RunArguments;
+
+//sets args from argv, printing the help and exiting if it makes no sense
+static
+void parseArguments(int argc, char **argv, RunArguments *args) {
+	AlignOptions &opts = args->opts;
+	NWScoring &scoring = args->scoring;
+	PairType &pairMode = args->pairMode;
+	int &numRandPairs = args->numRandPairs;
+	unsigned int &randomSeed = args->randomSeed;
+	int &randAbove = args->randAbove;
+
+	//argv[1] FASTA file, or -batch and argv[2] the directory or list of them
+	bool batchMode = !strcmp(argv[1], "-batch");
+	if(batchMode && argc < 3) {
 		printHelp();
 	}
+	args->batchMode = batchMode;
+	args->fastaFilename = argv[batchMode ? 2 : 1];
+	args->outDir.clear();
+	args->shard = 0;
+	args->numShards = 1;
+	randAbove = -1;
+	pairMode = NEXT_PAIR;
+	opts.quietOut = false;
+	opts.printFsa = false;
+	opts.verify = false;
+	opts.kernel = SCALAR_KERNEL;
+	opts.linearAbove = DEFAULT_LINEAR_ABOVE;
+	opts.bandMargin = DEFAULT_BAND_MARGIN;
+	opts.anchorK = DEFAULT_ANCHOR_K;
+	opts.anchorCoverage = DEFAULT_ANCHOR_COVERAGE;
+	opts.pidThreshold = -1;
+	opts.pidOverNongap = false;
+	opts.exactPid = false;
+	opts.editDistance = false;
+	opts.editPrefilter = false;
+	opts.dedup = true;
+	opts.dedupStats = false;
+	opts.cacheFile = NULL;
+	opts.cacheAlignments = false;
+	opts.hugePages = false;
+	opts.threads = 1;
+	opts.outFormat = TEXT_FORMAT;
+	opts.pidHistogram = 0;
+	opts.pidMatrix = false;
+	opts.pidMatrixFormat = PID_MATRIX_F32;
+	opts.cigar = false;
+	bool forceTraceback = false;
+	scoring = *findNWScoring("blastn");
+	numRandPairs = 0;
+	randomSeed = (unsigned int)time(NULL);
+	bool seedGiven = false;
 
-	//set variables from argv
-	//argv[1] FASTA file
-	string fastaFilename(argv[1]);
-	PairType pairMode = NEXT_PAIR;
-	bool quietOut = false;
-	bool printFsa = false;
-	int numRandPairs = 0;
-    unsigned int randomSeed = (unsigned int)time(NULL);
-
-	int i = 2;
+	int i = (batchMode ? 3 : 2);
 	while(i < argc) {
 		if (!strcmp(argv[i],"-all-pair")) {
 			pairMode = ALL_PAIR;
@@ -130,12 +2114,183 @@ int main(int argc, char** argv) {
 			i++;
 			int err = sscanf(argv[i], "%d", &(randomSeed));
 			if(err<1) printHelp();
+			seedGiven = true;
+		}
+		else if (!strcmp(argv[i],"-scoring")) {
+			i++;
+			if(i >= argc || findNWScoring(argv[i]) == NULL) printHelp();
+			scoring = *findNWScoring(argv[i]);
+		}
+		else if (!strcmp(argv[i],"-match")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(scoring.match));
+			if(err<1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-mismatch")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(scoring.mismatch));
+			if(err<1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-gapopen")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(scoring.gapopen));
+			if(err<1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-gapext")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(scoring.gapext));
+			if(err<1) printHelp();
 		}
 		else if (!strcmp(argv[i],"-quiet")) {
-			quietOut = true;
+			opts.quietOut = true;
 		}
 		else if (!strcmp(argv[i],"-print-fsa")) {
-			printFsa = true;
+			opts.printFsa = true;
+		}
+		else if (!strcmp(argv[i],"-cigar")) {
+			opts.cigar = true;
+		}
+		else if (!strcmp(argv[i],"-simd")) {
+			opts.kernel = SIMD_KERNEL;
+		}
+		else if (!strcmp(argv[i],"-linear-space")) {
+			opts.kernel = LINEAR_KERNEL;
+		}
+		else if (!strcmp(argv[i],"-linear-above")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(opts.linearAbove));
+			if(err<1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-simd-batch")) {
+			opts.kernel = BATCH_KERNEL;
+		}
+		else if (!strcmp(argv[i],"-wfa")) {
+			opts.kernel = WFA_KERNEL;
+		}
+		else if (!strcmp(argv[i],"-anchor")) {
+			opts.kernel = ANCHOR_KERNEL;
+		}
+		else if (!strcmp(argv[i],"-anchor-k")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(opts.anchorK));
+			if(err<1 || opts.anchorK < 1 || opts.anchorK > 16) printHelp();
+		}
+		else if (!strcmp(argv[i],"-anchor-min-coverage")) {
+			i++;
+			int err = sscanf(argv[i], "%lf", &(opts.anchorCoverage));
+			if(err<1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-band")) {
+			opts.kernel = BAND_KERNEL;
+		}
+		else if (!strcmp(argv[i],"-band-margin")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(opts.bandMargin));
+			if(err<1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-verify")) {
+			opts.verify = true;
+		}
+		else if (!strcmp(argv[i],"-pid-threshold")) {
+			i++;
+			int err = sscanf(argv[i], "%lf", &(opts.pidThreshold));
+			if(err<1 || opts.pidThreshold < 0) printHelp();
+		}
+		else if (!strcmp(argv[i],"-pid-metric")) {
+			i++;
+			if(!strcmp(argv[i],"nongap")) {
+				opts.pidOverNongap = true;
+			}
+			else if(!strcmp(argv[i],"alignlen")) {
+				opts.pidOverNongap = false;
+			}
+			else {
+				printHelp();
+			}
+		}
+		else if (!strcmp(argv[i],"-pid-histogram")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(opts.pidHistogram));
+			if(err<1 || opts.pidHistogram < 1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-exact-pid")) {
+			opts.exactPid = true;
+		}
+		else if (!strcmp(argv[i],"-edit-distance")) {
+			opts.editDistance = true;
+		}
+		else if (!strcmp(argv[i],"-edit-prefilter")) {
+			opts.editPrefilter = true;
+		}
+		else if (!strcmp(argv[i],"-traceback")) {
+			forceTraceback = true;
+		}
+		else if (!strcmp(argv[i],"-no-dedup")) {
+			opts.dedup = false;
+		}
+		else if (!strcmp(argv[i],"-dedup-stats")) {
+			opts.dedupStats = true;
+		}
+		else if (!strcmp(argv[i],"-cache")) {
+			i++;
+			if(i >= argc) printHelp();
+			opts.cacheFile = argv[i];
+		}
+		else if (!strcmp(argv[i],"-cache-alignments")) {
+			opts.cacheAlignments = true;
+		}
+		else if (!strcmp(argv[i],"-huge-pages")) {
+			opts.hugePages = true;
+		}
+		else if (!strcmp(argv[i],"-threads")) {
+			i++;
+			int err = sscanf(argv[i], "%d", &(opts.threads));
+			if(err<1 || opts.threads < 1) printHelp();
+		}
+		else if (!strcmp(argv[i],"-out-format")) {
+			i++;
+			if(i >= argc) printHelp();
+			if(!strcmp(argv[i], "tsv")) {
+				opts.outFormat = TSV_FORMAT;
+			}
+			else if(!strcmp(argv[i], "bin")) {
+				opts.outFormat = BIN_FORMAT;
+			}
+			else if(!strcmp(argv[i], "text")) {
+				opts.outFormat = TEXT_FORMAT;
+			}
+			else {
+				printHelp();
+			}
+		}
+		else if (!strcmp(argv[i],"-pid-matrix")) {
+			i++;
+			if(i >= argc) printHelp();
+			if(!strcmp(argv[i], "f32")) {
+				opts.pidMatrixFormat = PID_MATRIX_F32;
+			}
+			else if(!strcmp(argv[i], "u16")) {
+				opts.pidMatrixFormat = PID_MATRIX_U16;
+			}
+			else {
+				printHelp();
+			}
+			opts.pidMatrix = true;
+		}
+		else if (!strcmp(argv[i],"-out-dir")) {
+			i++;
+			if(i >= argc) printHelp();
+			args->outDir = argv[i];
+		}
+		else if (!strcmp(argv[i],"-rand-above") && batchMode) {
+			i++;
+			int err = sscanf(argv[i], "%d", &randAbove);
+			if(err<1 || randAbove < 0) printHelp();
+		}
+		else if (!strcmp(argv[i],"-shard")) {
+			i++;
+			int err = sscanf(argv[i], "%d/%d", &(args->shard), &(args->numShards));
+			if(err<2 || args->shard < 0 || args->shard >= args->numShards) printHelp();
 		}
 		else {
 			printf("Unknown command: %s\n", argv[i]);
@@ -144,76 +2299,274 @@ int main(int argc, char** argv) {
 		i++;
 	}
 
-	clock_t startClock = clock();
-    sRandom(randomSeed);
+	//identities must pay and gaps must cost for the kernels' bounds to hold
+	if(scoring.match <= 0 || scoring.mismatch >= scoring.match || scoring.gapopen > 0 || scoring.gapext > 0) {
+		cerr<<"Error: scoring needs match > 0, mismatch < match and gap scores <= 0."<<endl;
+		exit(1);
+	}
+	opts.linearGaps = nwLinearGapScoring(scoring.mismatch, scoring.gapopen, scoring.gapext);
+
+	if(opts.outFormat != TEXT_FORMAT) {
+		//a record holds the PIDs and their counts, not an alignment
+		if(opts.editDistance || classifiesOnly(opts)) {
+			cerr<<"Error: -out-format needs the PIDs, so neither -edit-distance nor -pid-threshold without -exact-pid."<<endl;
+			exit(1);
+		}
+		if(args->numShards > 1) {
+			cerr<<"Error: -out-format does not go with -shard."<<endl;
+			exit(1);
+		}
+		opts.quietOut = true;
+	}
+	if(opts.cigar && (opts.quietOut || opts.editDistance || classifiesOnly(opts))) {
+		cerr<<"Error: -cigar displays alignments, so neither -quiet, -out-format, -edit-distance nor -pid-threshold without -exact-pid."<<endl;
+		exit(1);
+	}
+	if(opts.pidMatrix) {
+		if(pairMode != ALL_PAIR || opts.editDistance || classifiesOnly(opts)) {
+			cerr<<"Error: -pid-matrix needs -all-pair and the PIDs, so neither -edit-distance nor -pid-threshold without -exact-pid."<<endl;
+			exit(1);
+		}
+		if(args->numShards > 1) {
+			cerr<<"Error: -pid-matrix does not go with -shard."<<endl;
+			exit(1);
+		}
+	}
+	if(!args->outDir.empty() && !batchMode && opts.outFormat == TEXT_FORMAT && !opts.pidMatrix) {
+		cerr<<"Error: -out-dir needs -batch, -out-format or -pid-matrix."<<endl;
+		exit(1);
+	}
 
-	Input *input = new Input(fastaFilename);
-	int seq_maxlen = input->seqset->maxseqlen;
-    cout<< "Random seed: " << randomSeed << endl;
-    cout<< "Number of sequences: "<<input->seqset->numseqs <<endl;
+	//nothing but PIDs is displayed: the default kernel needs no alignment
+	if(opts.kernel == SCALAR_KERNEL && opts.quietOut && !opts.printFsa && !forceTraceback) {
+		opts.kernel = STATS_KERNEL;
+	}
 
-	if(pairMode == NEXT_PAIR && input->seqset->numseqs % 2 != 0) {
-		cerr<<"Error: FASTA file should have even number of sequences in -next-pair mode."<<endl;
+	if(randAbove >= 0 && pairMode != RAND_PAIR) {
+		cerr<<"Error: -rand-above needs -rand-pair <INT>."<<endl;
+		exit(1);
+	}
+	if(args->numShards > 1 && (batchMode || opts.kernel == BATCH_KERNEL)) {
+		cerr<<"Error: -shard goes with neither -batch nor -simd-batch."<<endl;
+		exit(1);
+	}
+	//every shard has to draw the same pairs and print the same header
+	if(args->numShards > 1 && !seedGiven) {
+		cerr<<"Error: -shard needs -s <INT>."<<endl;
 		exit(1);
 	}
- 
-    //matlab has 5,-4,-8, 
-    //blastn has 1, -2, -5, -2
-    int match = 1;
-    int mismatch = -2;
-    int gapopen = -5;
-    int gapext = -2;
-	cout<<"match "<<match<<endl;
-	cout<<"mismatch "<<mismatch<<endl;
-	cout<<"gapopen "<<gapopen<<endl;
-	cout<<"gapext "<<gapext<<endl;
-	cout<<endl;
+}
+
+//Prints the output of a whole run from the stdout of all its -shard runs,
+//given in any order: the header of the first shard without -shard, the
+//pairs of every shard in shard order and the summary of the counters the
+//shards ended with.
+static
+void mergeShards(int numFiles, char **filenames) {
+	ShardOutputs outputs;
+	readShardOutputs(numFiles, filenames, &outputs);
+	vector<char*> argPointers;
+	for(size_t w = 0; w < outputs.argWords.size(); w++) {
+		argPointers.push_back(&outputs.argWords[w][0]);
+	}
+	RunArguments args;
+	parseArguments((int) argPointers.size(), &argPointers[0], &args);
+	printShardPairs(&outputs);
+
+	SpeciesRun run;
+	double elapsed = 0;
+	memset(&run.batchStats, 0, sizeof(run.batchStats));
+	mergeShardCounters(&outputs, shardCounters(&run, &elapsed), &run.pidSummary);
+	run.out = &cout;
+	run.stream.numseqs = (int) shardHeaderValue(&outputs, "Number of sequences:");
+	printRunSummary(args.opts, &run);
+	printProcessSummary(args.opts, elapsed);
+}
+
+int main(int argc, char** argv) {
+	if(DEBUG0) {
+		string str = "WARNING: running under DEBUG mode\n\n";
+		cout<<str;
+		cerr<<str;
+	}
+	if(DEBUG1) {
+		string str = "WARNING: running under VERBOSE mode\n\n";
+		cout<<str;
+		cerr<<str;
+	}
+	if(argc > 1 && !strcmp(argv[1], "merge")) {
+		//the banner is that of the shards
+		mergeShards(argc - 2, argv + 2);
+		return 0;
+	}
+	if(argc > 1 && !strcmp(argv[1], "decode-cigar")) {
+		if(argc != 4) {
+			printHelp();
+		}
+		decodeCigars(argv[2], argv[3]);
+		return 0;
+	}
+	printf("Compiled on " __DATE__ " " __TIME__ "\n");
+	printf("\n");
+	printf("ChangeLog\n");
+	printf("\n");
+	for(int i = 0; i < argc; i++) {
+		cout<<argv[i]<<" ";
+	}
+	cout<<endl<<endl;
+
+	if(argc == 1) {
+		printHelp();
+	}
+
+	RunArguments args;
+	parseArguments(argc, argv, &args);
+	AlignOptions &opts = args.opts;
+	NWScoring &scoring = args.scoring;
+	PairType pairMode = args.pairMode;
+	int numRandPairs = args.numRandPairs;
+	unsigned int randomSeed = args.randomSeed;
+	bool batchMode = args.batchMode;
+
+	if(batchMode && opts.kernel == BATCH_KERNEL) {
+		//the batch kernel takes its targets from one file at a time
+		cout<<"-simd-batch aligns pair by pair with -batch"<<endl<<endl;
+		opts.kernel = SIMD_KERNEL;
+	}
 
-	NWAlignParams* nwparams = constructNWAlignParams(match, mismatch, gapopen, gapext, seq_maxlen);
-	AlignPair *pair = constructAlignPair(seq_maxlen, seq_maxlen);
+	clock_t startClock = clock();
+    sRandom(randomSeed);
 
-	int pairsCount = 0;
+	if(opts.cacheFile != NULL) {
+		alignCache = openAlignCache(opts.cacheFile);
+		//kernels giving nwalign()'s alignment share results, the others
+		//(and each -anchor setting) have their own
+		unsigned int kernelTag = 0;
+		if(opts.kernel == WFA_KERNEL) {
+			kernelTag = 1;
+		}
+		else if(opts.kernel == ANCHOR_KERNEL) {
+			kernelTag = 2 | (opts.anchorK << 8) | ((unsigned int) (opts.anchorCoverage * 1000) << 16);
+		}
+		else if(opts.linearGaps && (opts.kernel == SCALAR_KERNEL || opts.kernel == STATS_KERNEL)) {
+			kernelTag = 3;
+		}
+		cacheParams = alignCacheParams(scoring.match, scoring.mismatch, scoring.gapopen, scoring.gapext, kernelTag);
+	}
 
-	if(pairMode == NEXT_PAIR) {
-		for(int i = 0; i < input->seqset->numseqs; i+=2) {
-			int seqind1 = i;
-			int seqind2 = i+1;
-			alignHelper(seqind1, seqind2, printFsa, quietOut, pair, nwparams, input);
-			pairsCount++;
+	if(batchMode) {
+		SpeciesBatch batch;
+		batch.streamed = (args.fastaFilename == "-");
+		if(!batch.streamed) {
+			listBatchFiles(args.fastaFilename, batch.fastaFiles);
+		}
+		batch.reader = NULL;
+		batch.outDir = args.outDir;
+		batch.pairMode = pairMode;
+		batch.numRandPairs = numRandPairs;
+		batch.randAbove = args.randAbove;
+		batch.seed = randomSeed;
+		batch.scoring = scoring;
+		batch.loaded = 0;
+		batch.reported = 0;
+		batch.pairsCount = 0;
+		if(batch.streamed) {
+			cout<<"FASTA files: listed on standard input"<<endl<<endl;
+		}
+		else {
+			cout<<"FASTA files: "<<batch.fastaFiles.size()<<endl<<endl;
 		}
+
+		//the longest sequences are only known file by file: the full matrices
+		//stop at -linear-above and the rest grows on demand
+		AlignPair *pair = constructAlignPair(0, 0);
+		initAlignWorker(&mainWorker, opts, scoring, opts.linearAbove, 0);
+		PairSource source;
+		source.run = NULL;
+		source.batch = &batch;
+		alignPairsThreaded(opts, scoring, opts.linearAbove, 0, &source, &pair);
+		nilAlignPair(pair);
+
+		cout<<endl;
+		cout<<"Number of files aligned: "<<batch.reported<<endl;
+		cout<<"Number of pairs aligned: "<<batch.pairsCount<<endl;
 	}
-	else if(pairMode == ALL_PAIR) {
-		for(int i = 0; i < input->seqset->numseqs; i++) {
-			for(int j = i+1; j < input->seqset->numseqs; j++) {
-				int seqind1 = i;
-				int seqind2 = j;
-				alignHelper(seqind1, seqind2, printFsa, quietOut, pair, nwparams, input);
-				pairsCount++;
+	SpeciesRun run;
+	if(batchMode) {
+		run.input = NULL;
+	}
+	else {
+		Input *input = new Input(args.fastaFilename);
+		int seq_maxlen = input->seqset->maxseqlen;
+		if(pairMode == NEXT_PAIR && input->seqset->numseqs % 2 != 0) {
+			cerr<<"Error: FASTA file should have even number of sequences in -next-pair mode."<<endl;
+			exit(1);
+		}
+		checkScoreRange(scoring, input, args.fastaFilename);
+		initSpeciesRun(&run, opts, input, pairMode, numRandPairs, randomSeed);
+		run.fastaFilename = args.fastaFilename;
+		if(args.numShards > 1) {
+			initShard(&run, args.shard, args.numShards);
+		}
+		if(opts.outFormat != TEXT_FORMAT) {
+			openPairRecords(opts, scoring, args.outDir, &run);
+		}
+		if(opts.pidMatrix) {
+			openRunPidMatrix(opts, scoring, args.outDir, &run);
+		}
+		printRunHeader(opts, scoring, &run);
+
+		//longer pairs go to nwalignLinear(), so the full matrices stop there
+		int matrix_maxlen = (seq_maxlen < opts.linearAbove ? seq_maxlen : opts.linearAbove);
+		initAlignWorker(&mainWorker, opts, scoring, matrix_maxlen, seq_maxlen);
+		AlignPair *pair = constructAlignPair(seq_maxlen, seq_maxlen);
+
+		if(pairMode == ALL_PAIR && opts.kernel == BATCH_KERNEL && !classifiesOnly(opts) && !opts.editDistance) {
+			//one alignment buffer per later sequence, so results can be reported in order
+			AlignPair **pairs = (AlignPair**) malloc(sizeof(AlignPair*) * input->seqset->numseqs);
+			for(int j = 0; j < input->seqset->numseqs; j++) {
+				pairs[j] = constructAlignPair(seq_maxlen, seq_maxlen);
 			}
+			alignAllPairsBatched(opts, &run, pairs);
+			for(int j = 0; j < input->seqset->numseqs; j++) {
+				nilAlignPair(pairs[j]);
+			}
+			free(pairs);
 		}
-	}
-	else if(pairMode == RAND_PAIR) {
-		for(int i = 0; i < numRandPairs; i++) {
+		else if(opts.threads > 1) {
+			PairSource source;
+			source.run = &run;
+			source.batch = NULL;
+			alignPairsThreaded(opts, scoring, matrix_maxlen, seq_maxlen, &source, &pair);
+		}
+		else {
 			int seqind1;
 			int seqind2;
-			do {
-				seqind1 = (int) (Random() * input->seqset->numseqs);
-				seqind2 = (int) (Random() * input->seqset->numseqs);
-			}while(seqind1 == seqind2);
-			alignHelper(seqind1, seqind2, printFsa, quietOut, pair, nwparams, input);
-			pairsCount++;
+			PairJob job;
+			while(nextPair(&run.stream, seqind1, seqind2)) {
+				initPairJob(&job, &run, seqind1, seqind2, pair);
+				reportJob(opts, &job);
+			}
 		}
+		closePairRecords(&run);
+		closeRunPidMatrix(&run);
+		printRunSummary(opts, &run);
+		nilAlignPair(pair);
 	}
-	else {
-		cerr<<"Invalid pairMode"<<endl;
-		exit(1);
-	}
+	addWorkerStats(&mainWorker);
 
-	cout<<"Number of pairs aligned: "<<pairsCount<<endl;
 	double elapsed = ((double) ( clock() - startClock )) / CLOCKS_PER_SEC;
-	printf("Total elapsed CPU time (in seconds): %.2lf\n",elapsed );
+	printProcessSummary(opts, elapsed);
+	if(args.numShards > 1) {
+		printRunShardCounters(&run, args.shard, args.numShards, elapsed);
+	}
 
-	nilAlignPair(pair);
-	nilNWAlignParams(nwparams);
-	delete input;
+	if(!batchMode) {
+		freeSpeciesRun(&run);
+	}
+	if(alignCache != NULL) {
+		closeAlignCache(alignCache);
+	}
+	nilAlignWorker(&mainWorker);
+	freeTextBuffer(&reportText);
 }
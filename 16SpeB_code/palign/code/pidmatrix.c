@@ -0,0 +1,74 @@
+#include "pidmatrix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static
+void _die(const char *what, const char *filename) {
+	fprintf(stderr, "Error: %s PID matrix %s: %s\n", what, filename, strerror(errno));
+	exit(1);
+}
+
+PidMatrix* openPidMatrix(const char *filename, int numseqs, PidMatrixFormat format,
+		bool overNongap, const NWScoring *scoring) {
+	PidMatrixHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PID_MATRIX_MAGIC, sizeof(header.magic));
+	header.version = PID_MATRIX_VERSION;
+	header.headerBytes = sizeof(PidMatrixHeader);
+	header.elementBytes = (format == PID_MATRIX_U16 ? sizeof(uint16_t) : sizeof(float));
+	header.format = format;
+	header.overNongap = (overNongap ? 1 : 0);
+	header.numseqs = numseqs;
+	header.numPairs = (numseqs > 1 ? (int64_t) numseqs * (numseqs - 1) / 2 : 0);
+	header.match = scoring->match;
+	header.mismatch = scoring->mismatch;
+	header.gapopen = scoring->gapopen;
+	header.gapext = scoring->gapext;
+
+	PidMatrix *matrix = (PidMatrix*) malloc(sizeof(PidMatrix));
+	matrix->numseqs = numseqs;
+	matrix->format = format;
+	matrix->written = 0;
+	matrix->mapLen = header.headerBytes + header.numPairs * header.elementBytes;
+	matrix->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(matrix->fd < 0) {
+		_die("cannot create", filename);
+	}
+	//the elements are holes in the file until their pairs are set
+	if(ftruncate(matrix->fd, matrix->mapLen) != 0) {
+		_die("cannot size", filename);
+	}
+	matrix->map = (char*) mmap(NULL, matrix->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, matrix->fd, 0);
+	if(matrix->map == MAP_FAILED) {
+		_die("cannot map", filename);
+	}
+	memcpy(matrix->map, &header, sizeof(header));
+	return matrix;
+}
+
+void closePidMatrix(PidMatrix *matrix) {
+	munmap(matrix->map, matrix->mapLen);
+	close(matrix->fd);
+	free(matrix);
+}
+
+void setMatrixPid(PidMatrix *matrix, int seqind1, int seqind2, double pid) {
+	if(seqind1 > seqind2) {
+		swap(seqind1, seqind2);
+	}
+	if(DEBUG0) {
+		assert(seqind1 >= 0 && seqind1 < seqind2 && seqind2 < matrix->numseqs);
+	}
+	long index = pidMatrixIndex(matrix->numseqs, seqind1, seqind2);
+	char *elements = matrix->map + sizeof(PidMatrixHeader);
+	if(matrix->format == PID_MATRIX_U16) {
+		((uint16_t*) elements)[index] = (uint16_t) (pid * PID_MATRIX_U16_SCALE + 0.5);
+	}
+	else {
+		((float*) elements)[index] = (float) pid;
+	}
+	matrix->written++;
+}
@@ -0,0 +1,64 @@
+#ifndef _PIDMATRIX_H
+#define _PIDMATRIX_H
+
+#include "stdinc.h"
+#include "nwalign.h"
+
+#include <stdint.h>
+
+//The PIDs of every pair of an -all-pair run as a condensed upper-triangular
+//matrix: a PidMatrixHeader, then one element per pair i < j in the order
+//(0,1), (0,2), ..., (0,n-1), (1,2), ..., (n-2,n-1), at pidMatrixIndex(), in
+//the byte order of the machine that wrote it.  An element is a float, or
+//with PID_MATRIX_U16 the PID times PID_MATRIX_U16_SCALE rounded to a
+//uint16_t.  The file is sized for all the pairs when opened and filled in
+//place through a shared writable mapping, so a consumer can mmap() it and
+//read any pair without parsing.  The diagonal (PID 1) is not stored.
+
+#define PID_MATRIX_MAGIC "PALIGNPM"
+#define PID_MATRIX_VERSION 1
+
+enum PidMatrixFormat { PID_MATRIX_F32, PID_MATRIX_U16};
+
+static const double PID_MATRIX_U16_SCALE = 65535.0;
+
+typedef struct {
+	char magic[8]; //PID_MATRIX_MAGIC, without its '\0'
+	int32_t version;
+	int32_t headerBytes; //the elements begin here
+	int32_t elementBytes;
+	int32_t format; //PidMatrixFormat
+	int32_t overNongap; //1: PIDs over non-gap, 0: over alignment-length
+	int32_t numseqs;
+	int64_t numPairs; //numseqs * (numseqs - 1) / 2 elements
+	int32_t match;
+	int32_t mismatch;
+	int32_t gapopen;
+	int32_t gapext;
+	char reserved[8];
+} PidMatrixHeader;
+
+typedef struct {
+	int fd;
+	char *map;
+	size_t mapLen;
+	int numseqs;
+	PidMatrixFormat format;
+	long written; //pairs set
+} PidMatrix;
+
+//element of the pair seqind1 < seqind2
+static inline
+long pidMatrixIndex(int numseqs, int seqind1, int seqind2) {
+	return (long) seqind1 * (2L * numseqs - seqind1 - 1) / 2 + (seqind2 - seqind1 - 1);
+}
+
+//creates filename sized for numseqs sequences; exits on I/O errors
+extern PidMatrix* openPidMatrix(const char *filename, int numseqs, PidMatrixFormat format,
+		bool overNongap, const NWScoring *scoring);
+extern void closePidMatrix(PidMatrix *matrix);
+
+//the PID of the pair of seqind1 and seqind2, in either order
+extern void setMatrixPid(PidMatrix *matrix, int seqind1, int seqind2, double pid);
+
+#endif
@@ -0,0 +1,194 @@
+#include "pidsummary.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void initPidSummary(PidSummary *summary) {
+	summary->count = 0;
+	summary->exact = true;
+	summary->ratios.clear();
+	summary->bins.clear();
+}
+
+static
+unsigned long long _ratio_key(int numerator, int denominator) {
+	if(denominator <= 0) {
+		numerator = 0;
+		denominator = 1;
+	}
+	return ((unsigned long long) numerator << 32) | (unsigned int) denominator;
+}
+
+static
+double _ratio_value(unsigned long long key) {
+	return ((double) (key >> 32)) / (double) (key & 0xffffffffULL);
+}
+
+static
+int _sketch_bin(double pid) {
+	int bin = (int) floor(pid * PID_SKETCH_BINS + 0.5);
+	return (bin < 0 ? 0 : (bin > PID_SKETCH_BINS ? PID_SKETCH_BINS : bin));
+}
+
+//folds the ratios into the sketch
+static
+void _to_sketch(PidSummary *summary) {
+	summary->bins.assign(PID_SKETCH_BINS + 1, 0);
+	for(unordered_map<unsigned long long, long>::const_iterator it = summary->ratios.begin(); it != summary->ratios.end(); ++it) {
+		summary->bins[_sketch_bin(_ratio_value(it->first))] += it->second;
+	}
+	summary->ratios.clear();
+	summary->exact = false;
+}
+
+static
+void _add_ratio(PidSummary *summary, unsigned long long key, long count) {
+	if(summary->exact) {
+		summary->ratios[key] += count;
+		if((int) summary->ratios.size() > PID_EXACT_RATIOS) {
+			_to_sketch(summary);
+		}
+	}
+	else {
+		summary->bins[_sketch_bin(_ratio_value(key))] += count;
+	}
+	summary->count += count;
+}
+
+void addPid(PidSummary *summary, int numerator, int denominator) {
+	_add_ratio(summary, _ratio_key(numerator, denominator), 1);
+}
+
+void mergePidSummary(PidSummary *total, const PidSummary *more) {
+	if(more->exact) {
+		for(unordered_map<unsigned long long, long>::const_iterator it = more->ratios.begin(); it != more->ratios.end(); ++it) {
+			_add_ratio(total, it->first, it->second);
+		}
+		return;
+	}
+	if(total->exact) {
+		_to_sketch(total);
+	}
+	for(int bin = 0; bin <= PID_SKETCH_BINS; bin++) {
+		total->bins[bin] += more->bins[bin];
+	}
+	total->count += more->count;
+}
+
+//the distinct PIDs in ascending order with their counts
+static
+void _sorted_values(const PidSummary *summary, vector< pair<double, long> > &values) {
+	values.clear();
+	if(summary->exact) {
+		values.reserve(summary->ratios.size());
+		for(unordered_map<unsigned long long, long>::const_iterator it = summary->ratios.begin(); it != summary->ratios.end(); ++it) {
+			values.push_back(make_pair(_ratio_value(it->first), it->second));
+		}
+		sort(values.begin(), values.end());
+	}
+	else {
+		for(int bin = 0; bin <= PID_SKETCH_BINS; bin++) {
+			if(summary->bins[bin] > 0) {
+				values.push_back(make_pair((double) bin / PID_SKETCH_BINS, summary->bins[bin]));
+			}
+		}
+	}
+}
+
+void pidQuantiles(const PidSummary *summary, const double *q, int numq, double *values) {
+	vector< pair<double, long> > sorted;
+	_sorted_values(summary, sorted);
+	//walks the PIDs in order once: k is the rank of the first PID of sorted[v]
+	size_t v = 0;
+	long k = 0;
+	for(int i = 0; i < numq; i++) {
+		double position = (summary->count - 1) * q[i];
+		long integral = (long) floor(position);
+		double fraction = position - integral;
+		while(k + sorted[v].second <= integral) {
+			k += sorted[v].second;
+			v++;
+		}
+		double value = sorted[v].first;
+		if(integral + 1 < summary->count) {
+			double next = (integral + 1 < k + sorted[v].second ? value : sorted[v + 1].first);
+			value = value + fraction * (next - value);
+		}
+		values[i] = value;
+	}
+}
+
+void pidHistogram(const PidSummary *summary, int numBins, long *counts) {
+	vector< pair<double, long> > sorted;
+	_sorted_values(summary, sorted);
+	memset(counts, 0, sizeof(long) * numBins);
+	for(size_t v = 0; v < sorted.size(); v++) {
+		int bin = (int) (sorted[v].first * numBins);
+		counts[bin < numBins ? bin : numBins - 1] += sorted[v].second;
+	}
+}
+
+//exact:<numerator>/<denominator>x<count>,... or sketch:<bin>x<count>,...
+string formatPidSummary(const PidSummary *summary) {
+	ostringstream text;
+	if(summary->exact) {
+		text<<"exact:";
+		vector<unsigned long long> keys;
+		for(unordered_map<unsigned long long, long>::const_iterator it = summary->ratios.begin(); it != summary->ratios.end(); ++it) {
+			keys.push_back(it->first);
+		}
+		sort(keys.begin(), keys.end());
+		for(size_t k = 0; k < keys.size(); k++) {
+			text<<(k > 0 ? "," : "")<<(keys[k] >> 32)<<"/"<<(keys[k] & 0xffffffffULL)
+				<<"x"<<summary->ratios.find(keys[k])->second;
+		}
+	}
+	else {
+		text<<"sketch:";
+		bool first = true;
+		for(int bin = 0; bin <= PID_SKETCH_BINS; bin++) {
+			if(summary->bins[bin] > 0) {
+				text<<(first ? "" : ",")<<bin<<"x"<<summary->bins[bin];
+				first = false;
+			}
+		}
+	}
+	return text.str();
+}
+
+bool parsePidSummary(const string &text, PidSummary *summary) {
+	initPidSummary(summary);
+	bool exact = (text.compare(0, 6, "exact:") == 0);
+	if(!exact && text.compare(0, 7, "sketch:") != 0) {
+		return false;
+	}
+	if(!exact) {
+		_to_sketch(summary);
+	}
+	const char *next = text.c_str() + (exact ? 6 : 7);
+	while(*next != '\0') {
+		unsigned int numerator, denominator = 1;
+		long count;
+		int read = 0;
+		if(exact ? sscanf(next, "%u/%ux%ld%n", &numerator, &denominator, &count, &read) < 3
+				: sscanf(next, "%ux%ld%n", &numerator, &count, &read) < 2) {
+			return false;
+		}
+		if(exact) {
+			_add_ratio(summary, ((unsigned long long) numerator << 32) | denominator, count);
+		}
+		else if(numerator <= (unsigned int) PID_SKETCH_BINS) {
+			summary->bins[numerator] += count;
+			summary->count += count;
+		}
+		else {
+			return false;
+		}
+		next += read;
+		if(*next == ',') {
+			next++;
+		}
+	}
+	return true;
+}
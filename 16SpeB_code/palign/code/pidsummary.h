@@ -0,0 +1,43 @@
+#ifndef _PIDSUMMARY_H
+#define _PIDSUMMARY_H
+
+#include "stdinc.h"
+
+#include <unordered_map>
+
+//The distribution of the PIDs of a run, kept as the pairs are reported.
+//A PID is identities over a length, so while they take few enough
+//distinct ratios every ratio is counted and the quantiles are exact.
+//Past PID_EXACT_RATIOS ratios (huge -rand-pair runs) the counts fold into
+//a sketch of PID_SKETCH_BINS + 1 bins, each PID rounded to the nearest
+//1 / PID_SKETCH_BINS.  Both forms merge by adding counts, so shards
+//summarize like the whole run.
+
+static const int PID_EXACT_RATIOS = 1 << 18;
+static const int PID_SKETCH_BINS = 100000;
+
+typedef struct {
+	long count;
+	bool exact;
+	unordered_map<unsigned long long, long> ratios; //numerator << 32 | denominator -> PIDs, while exact
+	vector<long> bins; //once not exact
+} PidSummary;
+
+extern void initPidSummary(PidSummary *summary);
+//numerator / denominator, 0 for a denominator of 0
+extern void addPid(PidSummary *summary, int numerator, int denominator);
+extern void mergePidSummary(PidSummary *total, const PidSummary *more);
+
+//The quantiles q[k] (ascending, in [0, 1]) into values[k], interpolated
+//between the PIDs around (count - 1) * q[k] as compute_empirical_quantile()
+//of MyMath.pm does.  count must be > 0.
+extern void pidQuantiles(const PidSummary *summary, const double *q, int numq, double *values);
+//counts of the PIDs in numBins bins of equal width over [0, 1], the last
+//one closed
+extern void pidHistogram(const PidSummary *summary, int numBins, long *counts);
+
+//a form without blanks that parsePidSummary() reads back
+extern string formatPidSummary(const PidSummary *summary);
+extern bool parsePidSummary(const string &text, PidSummary *summary);
+
+#endif
@@ -7,5 +7,24 @@
 inline void sRandom(unsigned long seed) { init_genrand(seed);} 
 inline double Random() { return genrand_real2(); }
 
+//SplitMix64 output function
+inline unsigned long long randomMix(unsigned long long x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+//Counter-based draws: the draw numbered counter of stream is a pure
+//function of (seed, stream, counter), so draws can be made in any order
+//and on any thread.  Each (seed, stream) keys its own Weyl sequence.
+inline unsigned long long randomBitsAt(unsigned long seed, unsigned long long stream, unsigned long long counter) {
+	unsigned long long key = randomMix(randomMix(seed) ^ (stream * 0xD1B54A32D192ED03ULL));
+	return randomMix(key + (counter + 1) * 0x9E3779B97F4A7C15ULL);
+}
+//on [0,1) with 53-bit resolution
+inline double RandomAt(unsigned long seed, unsigned long long stream, unsigned long long counter) {
+	return (randomBitsAt(seed, stream, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
 #endif
 
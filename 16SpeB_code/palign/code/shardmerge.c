@@ -0,0 +1,194 @@
+#include "shardmerge.h"
+
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+void printShardCounters(const vector<ShardCounter> &counters, const PidSummary *pids, int shard, int numShards) {
+	printf("Shard counters: shard=%d/%d", shard, numShards);
+	for(size_t k = 0; k < counters.size(); k++) {
+		if(counters[k].count != NULL) {
+			printf(" %s=%ld", counters[k].name, *counters[k].count);
+		}
+		else {
+			printf(" %s=%.17g", counters[k].name, *counters[k].amount);
+		}
+	}
+	printf(" pids=%s\n", formatPidSummary(pids).c_str());
+}
+
+//splits a line of a -shard output into its words
+static
+vector<string> _split_words(const string &line) {
+	vector<string> words;
+	istringstream in(line);
+	string word;
+	while(in >> word) {
+		words.push_back(word);
+	}
+	return words;
+}
+
+//index of the first line from first on starting with prefix, -1 if none
+static
+int _find_line(const vector<string> &lines, int first, const char *prefix) {
+	for(int k = first; k < (int) lines.size(); k++) {
+		if(lines[k].compare(0, strlen(prefix), prefix) == 0) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+void readShardOutputs(int numFiles, char **filenames, ShardOutputs *outputs) {
+	vector< vector<string> > &shards = outputs->lines;
+	shards.clear();
+	for(int f = 0; f < numFiles; f++) {
+		ifstream in(filenames[f]);
+		if(!in.is_open()) {
+			cerr<<"Error: cannot open "<<filenames[f]<<endl;
+			exit(1);
+		}
+		vector<string> lines;
+		string line;
+		while(getline(in, line)) {
+			lines.push_back(line);
+		}
+		int shard, numShards;
+		if(lines.empty() || sscanf(lines.back().c_str(), "Shard counters: shard=%d/%d", &shard, &numShards) < 2
+				|| shard < 0 || shard >= numShards) {
+			cerr<<"Error: "<<filenames[f]<<" is not the output of a -shard run."<<endl;
+			exit(1);
+		}
+		if(shards.empty()) {
+			shards.resize(numShards);
+		}
+		if(numShards != (int) shards.size() || !shards[shard].empty()) {
+			cerr<<"Error: "<<filenames[f]<<" is shard "<<shard<<"/"<<numShards<<", not one more of "
+				<<shards.size()<<" shards."<<endl;
+			exit(1);
+		}
+		shards[shard] = lines;
+	}
+	if(numFiles == 0 || numFiles != (int) shards.size()) {
+		cerr<<"Error: merge needs the outputs of all "<<shards.size()<<" shards."<<endl;
+		exit(1);
+	}
+
+	//the header ends with the empty line after "Random seed:", the pairs
+	//with "Number of pairs aligned:"
+	outputs->pairsBegin.assign(numFiles, 0);
+	outputs->pairsEnd.assign(numFiles, 0);
+	outputs->header.clear();
+	outputs->argWords.clear();
+	for(int shard = 0; shard < numFiles; shard++) {
+		const vector<string> &lines = shards[shard];
+		int k = _find_line(lines, 0, "Random seed:");
+		while(k >= 0 && k < (int) lines.size() && !lines[k].empty()) {
+			k++;
+		}
+		int pairsBegin = k + 1;
+		int pairsEnd = (k < 0 ? -1 : _find_line(lines, pairsBegin, "Number of pairs aligned:"));
+		if(pairsEnd < 0) {
+			cerr<<"Error: shard "<<shard<<" output is cut short."<<endl;
+			exit(1);
+		}
+		outputs->pairsBegin[shard] = pairsBegin;
+		outputs->pairsEnd[shard] = pairsEnd;
+		//what the whole run prints: the command line without -shard
+		vector<string> shardHeader(lines.begin(), lines.begin() + pairsBegin);
+		for(size_t k = 0; k < shardHeader.size(); k++) {
+			vector<string> words = _split_words(shardHeader[k]);
+			vector<string>::iterator it = find(words.begin(), words.end(), "-shard");
+			if(it != words.end() && it + 1 != words.end()) {
+				words.erase(it, it + 2);
+				shardHeader[k].clear();
+				for(size_t w = 0; w < words.size(); w++) {
+					shardHeader[k] += words[w] + " ";
+				}
+				if(shard == 0) {
+					outputs->argWords = words;
+				}
+			}
+		}
+		if(shard == 0) {
+			outputs->header = shardHeader;
+		}
+		else if(shardHeader != outputs->header) {
+			cerr<<"Error: shard "<<shard<<" is not a shard of the same run as shard 0."<<endl;
+			exit(1);
+		}
+	}
+	if(outputs->argWords.size() < 2) {
+		cerr<<"Error: no -shard command line in shard 0."<<endl;
+		exit(1);
+	}
+}
+
+void printShardPairs(const ShardOutputs *outputs) {
+	for(size_t k = 0; k < outputs->header.size(); k++) {
+		cout<<outputs->header[k]<<endl;
+	}
+	for(size_t shard = 0; shard < outputs->lines.size(); shard++) {
+		for(int k = outputs->pairsBegin[shard]; k < outputs->pairsEnd[shard]; k++) {
+			cout<<outputs->lines[shard][k]<<'\n';
+		}
+	}
+}
+
+long shardHeaderValue(const ShardOutputs *outputs, const char *prefix) {
+	int line = _find_line(outputs->header, 0, prefix);
+	return (line < 0 ? 0 : atol(outputs->header[line].c_str() + strlen(prefix)));
+}
+
+//total combined with the value of one more shard
+template <typename T>
+static
+T _merge_value(ShardMerge merge, bool firstShard, T total, T value) {
+	if(firstShard) {
+		return value;
+	}
+	if(merge == LARGEST_SHARD) {
+		return max(total, value);
+	}
+	if(merge == SMALLEST_SHARD) {
+		return min(total, value);
+	}
+	return total + value;
+}
+
+void mergeShardCounters(const ShardOutputs *outputs, const vector<ShardCounter> &counters, PidSummary *pids) {
+	initPidSummary(pids);
+	for(size_t shard = 0; shard < outputs->lines.size(); shard++) {
+		map<string, string> values;
+		vector<string> words = _split_words(outputs->lines[shard].back());
+		for(size_t w = 2; w < words.size(); w++) {
+			size_t eq = words[w].find('=');
+			if(eq != string::npos) {
+				values[words[w].substr(0, eq)] = words[w].substr(eq + 1);
+			}
+		}
+		for(size_t c = 0; c < counters.size(); c++) {
+			if(values.count(counters[c].name) == 0) {
+				cerr<<"Error: shard "<<shard<<" has no "<<counters[c].name<<" counter."<<endl;
+				exit(1);
+			}
+			const char *value = values[counters[c].name].c_str();
+			if(counters[c].count != NULL) {
+				*counters[c].count = _merge_value(counters[c].merge, shard == 0,
+						*counters[c].count, strtol(value, NULL, 10));
+			}
+			else {
+				*counters[c].amount = _merge_value(counters[c].merge, shard == 0,
+						*counters[c].amount, strtod(value, NULL));
+			}
+		}
+		PidSummary shardPids;
+		if(values.count("pids") == 0 || !parsePidSummary(values["pids"], &shardPids)) {
+			cerr<<"Error: shard "<<shard<<" has no pids counter."<<endl;
+			exit(1);
+		}
+		mergePidSummary(pids, &shardPids);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef _SHARDMERGE_H
+#define _SHARDMERGE_H
+
+#include "stdinc.h"
+#include "pidsummary.h"
+
+//The counters a -shard run ends its output with and the merge of the
+//outputs of all the shards of a run.  A shard prints its counters as
+//"Shard counters: shard=i/N name=value ... pids=<formatPidSummary()>" on
+//its last line; merge checks that the outputs are all the shards of one
+//command line, prints the header and the pairs in shard order and combines
+//the counters, from which the caller prints the summary of the whole run.
+
+//how merge combines a number over the shards
+enum ShardMerge {SUM_SHARDS, LARGEST_SHARD, SMALLEST_SHARD};
+
+//a number of a -shard run that merge combines over the shards
+typedef struct {
+	const char *name;
+	long *count; //NULL for an amount
+	double *amount;
+	ShardMerge merge;
+} ShardCounter;
+
+//the stdout of all the shards of a run
+typedef struct {
+	vector< vector<string> > lines; //by shard
+	vector<int> pairsBegin; //first line of the pairs of each shard
+	vector<int> pairsEnd;
+	vector<string> header; //of the whole run: the command line without -shard
+	vector<string> argWords; //that command line
+} ShardOutputs;
+
+//the last line of a -shard run
+extern void printShardCounters(const vector<ShardCounter> &counters, const PidSummary *pids,
+		int shard, int numShards);
+
+//Reads the outputs of the shards of one run, given in any order; exits if
+//they are not all the shards of the same command line.
+extern void readShardOutputs(int numFiles, char **filenames, ShardOutputs *outputs);
+//prints the header and the pairs of every shard in shard order
+extern void printShardPairs(const ShardOutputs *outputs);
+//the number after prefix on the first header line starting with it, 0 if none
+extern long shardHeaderValue(const ShardOutputs *outputs, const char *prefix);
+//Sets the numbers counters point to and pids to the combination over all
+//shards; exits if a shard lacks one of them.
+extern void mergeShardCounters(const ShardOutputs *outputs, const vector<ShardCounter> &counters, PidSummary *pids);
+
+#endif
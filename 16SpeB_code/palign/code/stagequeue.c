@@ -0,0 +1,91 @@
+#include "stagequeue.h"
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+//head and tail count every item ever popped and pushed; each sits on its
+//own cache line so the two sides do not share one
+struct StageQueue {
+	vector<void*> slots; //item k is at k % capacity
+	alignas(64) atomic<long> head;
+	alignas(64) atomic<long> tail;
+	atomic<bool> closed;
+	StageQueueStats stats; //pops touch emptyWaits only
+};
+
+StageQueue* constructStageQueue(int capacity) {
+	StageQueue *queue = new StageQueue;
+	queue->slots.resize(capacity > 0 ? capacity : 1);
+	queue->head.store(0);
+	queue->tail.store(0);
+	queue->closed.store(false);
+	memset(&queue->stats, 0, sizeof(queue->stats));
+	queue->stats.capacity = (int) queue->slots.size();
+	return queue;
+}
+
+void nilStageQueue(StageQueue *queue) {
+	delete queue;
+}
+
+//Waits a little longer every time: the other side is a pipeline stage
+//that takes milliseconds per item, so spinning would only take the CPU
+//away from it.
+static
+void _wait_stage(int *waits) {
+	if(*waits < 16) {
+		this_thread::yield();
+	}
+	else {
+		int shift = (*waits - 16 < 10 ? *waits - 16 : 10);
+		this_thread::sleep_for(chrono::microseconds(1 << shift));
+	}
+	(*waits)++;
+}
+
+void pushStage(StageQueue *queue, void *item) {
+	long tail = queue->tail.load(memory_order_relaxed);
+	long capacity = (long) queue->slots.size();
+	int waits = 0;
+	while(tail - queue->head.load(memory_order_acquire) >= capacity) {
+		_wait_stage(&waits);
+	}
+	queue->slots[tail % capacity] = item;
+	queue->tail.store(tail + 1, memory_order_release);
+
+	int depth = (int) (tail + 1 - queue->head.load(memory_order_acquire));
+	queue->stats.pushes++;
+	queue->stats.fullWaits += (waits > 0 ? 1 : 0);
+	queue->stats.depthSum += depth;
+	if(depth > queue->stats.maxDepth) {
+		queue->stats.maxDepth = depth;
+	}
+}
+
+void closeStageQueue(StageQueue *queue) {
+	queue->closed.store(true, memory_order_release);
+}
+
+bool popStage(StageQueue *queue, void **item) {
+	long head = queue->head.load(memory_order_relaxed);
+	int waits = 0;
+	while(queue->tail.load(memory_order_acquire) == head) {
+		//an item pushed before the queue was closed is still taken
+		if(queue->closed.load(memory_order_acquire) && queue->tail.load(memory_order_acquire) == head) {
+			queue->stats.emptyWaits += (waits > 0 ? 1 : 0);
+			return false;
+		}
+		_wait_stage(&waits);
+	}
+	*item = queue->slots[head % (long) queue->slots.size()];
+	queue->head.store(head + 1, memory_order_release);
+	queue->stats.emptyWaits += (waits > 0 ? 1 : 0);
+	return true;
+}
+
+void getStageQueueStats(const StageQueue *queue, StageQueueStats *stats) {
+	*stats = queue->stats;
+}
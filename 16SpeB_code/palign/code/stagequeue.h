@@ -0,0 +1,37 @@
+#ifndef _STAGEQUEUE_H
+#define _STAGEQUEUE_H
+
+#include "stdinc.h"
+
+//Bounded queue between two stages of the pipeline, one thread pushing and
+//one popping.  Neither side takes a lock: the pushing side only moves the
+//tail and the popping side only the head.  Pushing to a full queue waits
+//for the popping side (backpressure), popping an empty one waits for the
+//pushing side.
+
+typedef struct StageQueue StageQueue;
+
+//how full the queue ran, read once both sides are done
+typedef struct {
+	int capacity;
+	long pushes;
+	long fullWaits; //pushes that found the queue full
+	long emptyWaits; //pops that found the queue empty
+	int maxDepth;
+	double depthSum; //of the depth after every push
+} StageQueueStats;
+
+extern StageQueue* constructStageQueue(int capacity);
+extern void nilStageQueue(StageQueue *queue);
+
+//appends item, waiting while the queue is full
+extern void pushStage(StageQueue *queue, void *item);
+//no item follows
+extern void closeStageQueue(StageQueue *queue);
+//takes the oldest item into item, waiting while the queue is empty;
+//false once the queue is closed and empty
+extern bool popStage(StageQueue *queue, void **item);
+
+extern void getStageQueueStats(const StageQueue *queue, StageQueueStats *stats);
+
+#endif
@@ -0,0 +1,32 @@
+#!/bin/bash
+#Differential test of an alignment kernel against nwalign(): aligns a sample
+#of the pairs of every bundled FASTA file with -verify and the given
+#options, and fails if palign does or if any pair fails -verify.
+#
+#usage: ./test_verify.sh <palign options>, e.g. ./test_verify.sh -wfa
+#  PAIRS  the pairs of each file (default: -rand-pair 100, the same ones
+#         every time); -all-pair for every pair
+#  FASTA  the FASTA files (default: every bundled one)
+
+set -euo pipefail
+IFS=$'\n\t'
+
+cd "$(dirname "$0")"
+PALIGN=../palign.out
+PAIRS=${PAIRS:--rand-pair 100}
+FASTA=${FASTA:-$(ls ../../relevant_species/*.fsa)}
+
+IFS=$' \n\t'
+failures=0
+for fsa in ${FASTA}; do
+	summary=$(${PALIGN} "${fsa}" ${PAIRS} -s 1 -quiet -verify -threads "$(nproc)" "$@" | grep '^Number of pairs failing -verify:')
+	failed=${summary##*: }
+	echo "${fsa}: ${failed} pairs failing -verify with ${PAIRS} $*"
+	failures=$((failures + failed))
+done
+
+if [ "${failures}" -ne 0 ]; then
+	echo "FAILED: ${failures} pairs failing -verify with ${PAIRS} $*"
+	exit 1
+fi
+echo "PASSED: every pair agrees with nwalign() with ${PAIRS} $*"
@@ -0,0 +1,84 @@
+#include "textout.h"
+
+#include <charconv>
+
+using namespace std;
+
+//numToChar() of 0..NUMALPHAS-1, and '-' for GAP_CHAR
+static const char SEQ_CHARS[NUMCHARS + 1] = "ACGT-";
+
+void initTextBuffer(TextBuffer *buf) {
+	buf->text = NULL;
+	buf->len = 0;
+	buf->capacity = 0;
+}
+
+void freeTextBuffer(TextBuffer *buf) {
+	free(buf->text);
+	initTextBuffer(buf);
+}
+
+//room for more characters after buf->len
+static
+char* _reserve_text(TextBuffer *buf, size_t more) {
+	if(buf->len + more > buf->capacity) {
+		size_t capacity = (buf->capacity > 0 ? 2 * buf->capacity : 4096);
+		while(capacity < buf->len + more) {
+			capacity *= 2;
+		}
+		buf->text = (char*) realloc(buf->text, capacity);
+		if(buf->text == NULL) {
+			fprintf(stderr, "Out of memory at _reserve_text()\n");
+			abort();
+		}
+		buf->capacity = capacity;
+	}
+	return buf->text + buf->len;
+}
+
+void appendText(TextBuffer *buf, const char *text, size_t len) {
+	memcpy(_reserve_text(buf, len), text, len);
+	buf->len += len;
+}
+
+void appendText(TextBuffer *buf, const char *text) {
+	appendText(buf, text, strlen(text));
+}
+
+void appendText(TextBuffer *buf, const string &text) {
+	appendText(buf, text.data(), text.size());
+}
+
+void appendChar(TextBuffer *buf, char c) {
+	*_reserve_text(buf, 1) = c;
+	buf->len++;
+}
+
+void appendInt(TextBuffer *buf, long value) {
+	const int maxChars = 24;
+	char *first = _reserve_text(buf, maxChars);
+	buf->len += to_chars(first, first + maxChars, value).ptr - first;
+}
+
+void appendDouble(TextBuffer *buf, double value) {
+	const int maxChars = 32;
+	char *first = _reserve_text(buf, maxChars);
+	buf->len += to_chars(first, first + maxChars, value, chars_format::general, 6).ptr - first;
+}
+
+void appendSeq(TextBuffer *buf, const int *seq, int len) {
+	char *line = _reserve_text(buf, len + 1);
+	for(int i = 0; i < len; i++) {
+		if(DEBUG0) {
+			assert(seq[i] >= 0 && seq[i] <= GAP_CHAR);
+		}
+		line[i] = SEQ_CHARS[seq[i]];
+	}
+	line[len] = '\n';
+	buf->len += len + 1;
+}
+
+void writeTextBuffer(TextBuffer *buf, ostream &out) {
+	out.write(buf->text, buf->len);
+	buf->len = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef _TEXTOUT_H
+#define _TEXTOUT_H
+
+#include "stdinc.h"
+
+//Text of one pair (or more) put together in memory and written to an
+//ostream in one write(), with no flush per line.  The buffer grows to the
+//longest text written through it and is then reused as is.
+
+typedef struct {
+	char *text;
+	size_t len;
+	size_t capacity;
+} TextBuffer;
+
+extern void initTextBuffer(TextBuffer *buf);
+extern void freeTextBuffer(TextBuffer *buf);
+
+extern void appendText(TextBuffer *buf, const char *text, size_t len);
+extern void appendText(TextBuffer *buf, const char *text);
+extern void appendText(TextBuffer *buf, const string &text);
+extern void appendChar(TextBuffer *buf, char c);
+extern void appendInt(TextBuffer *buf, long value);
+//as ostream << value with the default format (%g, 6 digits)
+extern void appendDouble(TextBuffer *buf, double value);
+//the bases of seq, '-' for gaps, and a newline
+extern void appendSeq(TextBuffer *buf, const int *seq, int len);
+
+//writes the text to out and empties buf
+extern void writeTextBuffer(TextBuffer *buf, ostream &out);
+
+#endif
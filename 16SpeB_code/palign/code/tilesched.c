@@ -0,0 +1,98 @@
+#include "tilesched.h"
+
+#include <deque>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+//tiles cost milliseconds, so one lock over all deques is not contended
+struct TileScheduler {
+	mutex lock;
+	condition_variable queued; //a tile was pushed or the scheduler closed
+	condition_variable finished;
+	vector< deque<long> > deques;
+	set<long> done; //finished tiles not waited for yet
+	bool closed;
+};
+
+TileScheduler* constructTileScheduler(int numWorkers) {
+	TileScheduler *sched = new TileScheduler;
+	sched->deques.resize(numWorkers > 0 ? numWorkers : 1);
+	sched->closed = false;
+	return sched;
+}
+
+void nilTileScheduler(TileScheduler *sched) {
+	delete sched;
+}
+
+void pushTile(TileScheduler *sched, long tile) {
+	{
+		lock_guard<mutex> guard(sched->lock);
+		sched->deques[tile % sched->deques.size()].push_back(tile);
+	}
+	sched->queued.notify_all();
+}
+
+//under the lock: pops the tile worker should run, false if none
+static
+bool _pop_tile(TileScheduler *sched, int worker, long *tile) {
+	int from = -1;
+	if(worker >= 0 && !sched->deques[worker].empty()) {
+		from = worker;
+	}
+	else {
+		for(int k = 0; k < (int) sched->deques.size(); k++) {
+			if(!sched->deques[k].empty() && (from < 0 || sched->deques[k].front() < sched->deques[from].front())) {
+				from = k;
+			}
+		}
+	}
+	if(from < 0) {
+		return false;
+	}
+	*tile = sched->deques[from].front();
+	sched->deques[from].pop_front();
+	return true;
+}
+
+bool takeTile(TileScheduler *sched, int worker, long *tile, bool block) {
+	unique_lock<mutex> guard(sched->lock);
+	while(!_pop_tile(sched, worker, tile)) {
+		if(!block || sched->closed) {
+			return false;
+		}
+		sched->queued.wait(guard);
+	}
+	return true;
+}
+
+void finishTile(TileScheduler *sched, long tile) {
+	{
+		lock_guard<mutex> guard(sched->lock);
+		sched->done.insert(tile);
+	}
+	sched->finished.notify_all();
+}
+
+bool waitTile(TileScheduler *sched, long tile, bool block) {
+	unique_lock<mutex> guard(sched->lock);
+	while(sched->done.count(tile) == 0) {
+		if(!block) {
+			return false;
+		}
+		sched->finished.wait(guard);
+	}
+	sched->done.erase(tile);
+	return true;
+}
+
+void closeTileScheduler(TileScheduler *sched) {
+	{
+		lock_guard<mutex> guard(sched->lock);
+		sched->closed = true;
+	}
+	sched->queued.notify_all();
+}
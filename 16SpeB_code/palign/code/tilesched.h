@@ -0,0 +1,29 @@
+#ifndef _TILESCHED_H
+#define _TILESCHED_H
+
+#include "stdinc.h"
+
+//Work-stealing scheduler for -threads.  The producer numbers tiles of work
+//0, 1, 2, ... and deals them round-robin to one deque per worker; a worker
+//takes the oldest tile of its own deque and, when that is empty, steals
+//the oldest tile of any deque, so the tiles the producer reports next are
+//never left behind.  Finished tiles are waited for by number.
+
+typedef struct TileScheduler TileScheduler;
+
+extern TileScheduler* constructTileScheduler(int numWorkers);
+extern void nilTileScheduler(TileScheduler *sched);
+
+//queues tile on the deque of worker tile % numWorkers
+extern void pushTile(TileScheduler *sched, long tile);
+//next tile for worker (-1: steal only) into tile; if block, waits for one
+//and returns false once the scheduler is closed, otherwise returns false
+//if none is queued
+extern bool takeTile(TileScheduler *sched, int worker, long *tile, bool block);
+extern void finishTile(TileScheduler *sched, long tile);
+//true once tile is finished (then forgotten); if block, waits for that
+extern bool waitTile(TileScheduler *sched, long tile, bool block);
+//wakes the workers blocked in takeTile() for good
+extern void closeTileScheduler(TileScheduler *sched);
+
+#endif